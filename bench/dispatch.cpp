@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Transport agnostic RPC: server dispatch microbenchmark
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#include "client.h"
+#include "server.h"
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+
+static constexpr size_t callsPerThread = 200000;
+
+template <typename FuncID>
+static double dispatch_ns(rpc::Server& server, const FuncID& funcID, size_t numThreads)
+{
+	rpc::Client client;
+	auto [fut, buff, id] = client.call<int>(funcID, 3, 4);
+
+	std::vector<std::thread> threads;
+	std::atomic<bool> start{false};
+
+	for (size_t t = 0; t < numThreads; ++t) {
+		threads.emplace_back([&, buffer = std::cref(buff)] {
+			while (!start.load(std::memory_order_acquire))
+				std::this_thread::yield();
+
+			for (size_t i = 0; i < callsPerThread; ++i)
+				server.handle_call(buffer.get().data(), buffer.get().size());
+		});
+	}
+
+	auto begin = std::chrono::steady_clock::now();
+	start.store(true, std::memory_order_release);
+
+	for (auto& thread : threads)
+		thread.join();
+
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+
+	/* wall time per call, per thread */
+	return elapsed.count() / callsPerThread;
+}
+
+int main()
+{
+	rpc::Server server;
+
+	/* a few neighbours, so that the table is not trivially small */
+	for (int i = 0; i < 32; ++i)
+		server.bind("func" + std::to_string(i), [](int a) { return a; });
+
+	auto addHash = server.bind("add", [](int a, int b) {
+		return a + b;
+	});
+
+	size_t maxThreads = std::max(1U, std::thread::hardware_concurrency());
+
+	std::cout << "threads   by-name ns/call   by-hash ns/call\n";
+
+	for (size_t n = 1; n <= maxThreads; n *= 2) {
+		std::cout << std::setw(7) << n
+			<< std::setw(18) << std::fixed << std::setprecision(1) << dispatch_ns(server, "add", n)
+			<< std::setw(18) << dispatch_ns(server, addHash, n)
+			<< "\n";
+	}
+
+	return 0;
+}
@@ -0,0 +1,318 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Hot-path microbenchmarks: serialization, dispatch, response ingestion and
+ * round trips, over a matrix of argument shapes. Reports time, allocations
+ * and allocated bytes per operation.
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#include "rpc/client.h"
+#include "rpc/server.h"
+#include "transport/null/client.h"
+#include "transport/socket/tcp_client.h"
+#include "transport/socket/tcp_server.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/*
+ * Every allocation of the process (of all threads: a round trip counts both
+ * sides) goes through these, to be counted on the way to glibc
+ */
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+}
+
+static std::atomic<uint64_t> allocCount{0};
+static std::atomic<uint64_t> allocBytes{0};
+
+static void count_alloc(size_t size) noexcept
+{
+	allocCount.fetch_add(1, std::memory_order_relaxed);
+	allocBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+extern "C" {
+
+void* malloc(size_t size) noexcept
+{
+	count_alloc(size);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) noexcept
+{
+	count_alloc(count * size);
+	return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) noexcept
+{
+	count_alloc(size);
+	return __libc_realloc(ptr, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept
+{
+	count_alloc(size);
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) noexcept
+{
+	count_alloc(size);
+	*ptr = __libc_memalign(alignment, size);
+	return (*ptr != nullptr) ? 0 : ENOMEM;
+}
+
+void free(void* ptr) noexcept
+{
+	__libc_free(ptr);
+}
+
+}
+
+
+struct Result {
+	std::string name;
+	uint64_t iterations;
+	double ns;
+	double allocs;
+	double bytes;
+};
+
+struct Config {
+	std::string filter;
+	std::chrono::milliseconds minTime{200};
+};
+
+static Config config;
+static std::vector<Result> results;
+
+template <typename Op>
+static void measure(const std::string& name, Op&& op)
+{
+	if (name.find(config.filter) == std::string::npos)
+		return;
+
+	/* fills the pools and the caches */
+	for (int i = 0; i < 100; ++i)
+		op();
+
+	uint64_t iterations = 16;
+
+	while (true) {
+		uint64_t allocs = allocCount.load();
+		uint64_t bytes = allocBytes.load();
+		auto begin = std::chrono::steady_clock::now();
+
+		for (uint64_t i = 0; i < iterations; ++i)
+			op();
+
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+
+		if ((elapsed < config.minTime) && (iterations < (uint64_t(1) << 32))) {
+			iterations *= 2;
+			continue;
+		}
+
+		Result result{name, iterations, elapsed.count() / iterations,
+			      double(allocCount.load() - allocs) / iterations,
+			      double(allocBytes.load() - bytes) / iterations};
+
+		std::cout << std::left << std::setw(32) << name << std::right << std::fixed
+			<< std::setw(14) << std::setprecision(1) << result.ns
+			<< std::setw(14) << std::setprecision(2) << result.allocs
+			<< std::setw(14) << std::setprecision(1) << result.bytes
+			<< "\n";
+
+		results.push_back(result);
+		return;
+	}
+}
+
+/*
+ * The cases, for a function `shape` that takes `args` and returns `R`
+ */
+template <typename R, typename... Args>
+static void bench_shape(const std::string& shape, rpc::Server& server, rpc::NullClient& null, rpc::TcpClient& tcp, const Args&... args)
+{
+	uint32_t callID = 1;
+
+	measure("serialize_call/" + shape, [&] {
+		auto buffer = rpc::serialize_call(callID, shape, args...);
+		rpc::pool::recycle(std::move(buffer));
+	});
+
+	auto request = rpc::serialize_call(callID, shape, args...);
+
+	measure("handle_call/" + shape, [&] {
+		auto resp = server.handle_call(request.data(), request.size());
+		rpc::pool::recycle(std::move(resp));
+	});
+
+	/*
+	 * A response completes its call: ingest chunks of a stream instead,
+	 * which take the same path but leave the call in place for the next one
+	 */
+	rpc::Client client;
+	size_t chunks = 0;
+
+	auto [buffer, streamID] = client.stream_call<R>([&](R&&) {
+		++chunks;
+	}, [](std::exception_ptr) {
+	}, shape, args...);
+
+	auto resp = server.handle_call(buffer);
+	auto value = msgpack::unpack(resp.data(), resp.size()).get().via.array.ptr[1].template as<R>();
+
+	msgpack::sbuffer chunk;
+	msgpack::packer<msgpack::sbuffer> packer(chunk);
+	rpc::stream::pack_chunk(packer, streamID, value);
+
+	measure("ingest_resp/" + shape, [&] {
+		client.ingest_resp(chunk.data(), chunk.size());
+	});
+
+	client.cancel(streamID, std::runtime_error("done"));
+
+	measure("round_trip/null/" + shape, [&] {
+		null.call<R>(shape, args...);
+	});
+
+	measure("round_trip/tcp/" + shape, [&] {
+		tcp.call<R>(shape, args...);
+	});
+}
+
+static void bind_functions(rpc::Server& server)
+{
+	server.bind("scalars", [](int a, double b, bool c) {
+		return c ? (a + b) : (a - b);
+	});
+
+	server.bind("string", [](std::string s) {
+		return s;
+	});
+
+	server.bind("bin", [](std::vector<char> b) {
+		return b;
+	});
+
+	server.bind("nested", [](std::map<std::string, std::vector<int>> m) {
+		return m;
+	});
+}
+
+static void write_json(const std::string& path)
+{
+	std::ofstream out(path);
+
+	/* a line per benchmark, for diffing */
+	out << "{\n  \"benchmarks\": [\n";
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		const auto& result = results[i];
+
+		out << std::fixed << "    {\"name\": \"" << result.name << "\""
+			<< ", \"iterations\": " << result.iterations
+			<< std::setprecision(1) << ", \"ns_per_op\": " << result.ns
+			<< std::setprecision(3) << ", \"allocs_per_op\": " << result.allocs
+			<< std::setprecision(1) << ", \"bytes_per_op\": " << result.bytes
+			<< "}" << ((i + 1 < results.size()) ? ",\n" : "\n");
+	}
+
+	out << "  ]\n}\n";
+
+	if (!out)
+		throw std::runtime_error("cannot write " + path);
+}
+
+int main(int argc, char* argv[])
+{
+	std::string jsonPath;
+	uint16_t port = 5710;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+
+		if ((i + 1 < argc) && (arg == "--json")) {
+			jsonPath = argv[++i];
+		} else if ((i + 1 < argc) && (arg == "--filter")) {
+			config.filter = argv[++i];
+		} else if ((i + 1 < argc) && (arg == "--min-time")) {
+			config.minTime = std::chrono::milliseconds(std::stoi(argv[++i]));
+		} else if ((i + 1 < argc) && (arg == "--port")) {
+			port = std::stoi(argv[++i]);
+		} else {
+			std::cerr << "RPC hot-path microbenchmarks\n";
+			std::cerr << "Command line options:\n";
+			std::cerr << "  --json FILE       also write the results, machine-readable\n";
+			std::cerr << "  --filter STRING   only the benchmarks whose name contains it\n";
+			std::cerr << "  --min-time MS     per benchmark (200)\n";
+			std::cerr << "  --port PORT       of the TCP loopback server (5710)\n";
+			return 1;
+		}
+	}
+
+	try {
+		rpc::Server server;
+		bind_functions(server);
+
+		rpc::NullClient null(server);
+
+		/* never returns: left running until exit */
+		auto tcpServer = new rpc::TcpServer(port);
+		bind_functions(*tcpServer);
+
+		std::thread([tcpServer] {
+			tcpServer->run(*tcpServer);
+		}).detach();
+
+		rpc::TcpClient tcp("127.0.0.1", port, rpc::TcpClient::Mode::Pipelined);
+
+		std::cout << "benchmark                               ns/op     allocs/op      bytes/op\n";
+
+		bench_shape<double>("scalars", server, null, tcp, 42, 3.14, true);
+
+		/* the same call through a stub: its header packed once, the frame in place */
+		const rpc::Stub<double(int, double, bool)> scalars("scalars");
+
+		measure("serialize_call/stub/scalars", [&] {
+			auto buffer = rpc::serialize_call(1, scalars, 42, 3.14, true);
+			rpc::pool::recycle(std::move(buffer));
+		});
+
+		bench_shape<std::string>("string", server, null, tcp, std::string(64, 's'));
+		bench_shape<std::vector<char>>("bin", server, null, tcp, std::vector<char>(64 * 1024, 'b'));
+
+		std::map<std::string, std::vector<int>> nested;
+		for (int i = 0; i < 8; ++i)
+			nested["key" + std::to_string(i)] = std::vector<int>(16, i);
+
+		bench_shape<std::map<std::string, std::vector<int>>>("nested", server, null, tcp, nested);
+
+		if (!jsonPath.empty())
+			write_json(jsonPath);
+	} catch (const std::exception& ex) {
+		std::cerr << "Benchmark failed: " << ex.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Same-host round-trip benchmark: socket, io_uring and shared-memory transports
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#include "transport/socket/tcp_client.h"
+#include "transport/socket/tcp_server.h"
+#include "transport/shm/shm_client.h"
+#include "transport/shm/shm_server.h"
+#ifdef RPC_WITH_URING
+#include "transport/uring/uring_client.h"
+#include "transport/uring/uring_server.h"
+#endif
+
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+
+static constexpr size_t pipelineDepth = 64;
+
+static void bind_functions(rpc::Server& server)
+{
+	server.bind("add", [](int a, int b) {
+		return a + b;
+	});
+}
+
+/* one call in flight */
+template <typename Client>
+static double round_trip_ns(Client& client, size_t calls)
+{
+	auto begin = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < calls; ++i)
+		client.template call<int>("add", 1, 2);
+
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+	return elapsed.count() / calls;
+}
+
+/* `pipelineDepth` calls in flight */
+template <typename Client>
+static double pipelined_ns(Client& client, size_t calls)
+{
+	std::vector<std::future<int>> futures;
+	futures.reserve(pipelineDepth);
+
+	auto begin = std::chrono::steady_clock::now();
+
+	for (size_t i = 0; i < calls; ) {
+		for (size_t j = 0; (j < pipelineDepth) && (i < calls); ++j, ++i)
+			futures.push_back(client.template async_call<int>("add", 1, 2));
+
+		for (auto& future : futures)
+			future.get();
+
+		futures.clear();
+	}
+
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+	return elapsed.count() / calls;
+}
+
+static void report(const char* name, double roundTrip, double pipelined)
+{
+	std::cout << std::left << std::setw(24) << name << std::right
+		<< std::setw(18) << std::fixed << std::setprecision(1) << roundTrip
+		<< std::setw(18) << pipelined
+		<< "\n";
+}
+
+static void bench_socket(const char* name, uint16_t port, rpc::TcpServer::Model model, size_t calls)
+{
+	rpc::TcpServer::Options options;
+	options.model = model;
+
+	/* never returns: left running until exit */
+	auto server = new rpc::TcpServer(port, options);
+	bind_functions(*server);
+
+	std::thread([server] {
+		server->run(*server);
+	}).detach();
+
+	rpc::TcpClient syncClient("127.0.0.1", port);
+	rpc::TcpClient pipelinedClient("127.0.0.1", port, rpc::TcpClient::Mode::Pipelined);
+
+	report(name, round_trip_ns(syncClient, calls), pipelined_ns(pipelinedClient, calls));
+}
+
+#ifdef RPC_WITH_URING
+static void bench_uring(const char* name, uint16_t port, size_t calls)
+{
+	rpc::UringServer server(port);
+	bind_functions(server);
+
+	std::thread serverThread([&server] {
+		server.run(server);
+	});
+
+	{
+		rpc::UringClient client("127.0.0.1", port);
+
+		report(name, round_trip_ns(client, calls), pipelined_ns(client, calls));
+	}
+
+	server.stop();
+	serverThread.join();
+}
+#endif
+
+static void bench_shm(const char* name, std::chrono::microseconds busyPoll, size_t calls)
+{
+	rpc::ShmServer::Options options;
+	options.busyPoll = busyPoll;
+
+	rpc::ShmServer server("/rpc_transport_bench", options);
+	bind_functions(server);
+
+	std::thread serverThread([&server] {
+		server.run(server);
+	});
+
+	{
+		rpc::ShmClient client("/rpc_transport_bench", rpc::ShmClient::Options{busyPoll});
+
+		report(name, round_trip_ns(client, calls), pipelined_ns(client, calls));
+	}
+
+	server.stop();
+	serverThread.join();
+}
+
+int main(int argc, char* argv[])
+{
+	size_t calls = 20000;
+	uint16_t port = 5700;
+
+	if (argc > 1)
+		calls = std::max(1, std::stoi(argv[1]));
+
+	if (argc > 2)
+		port = std::stoi(argv[2]);
+
+	std::cout << "transport              round-trip ns/call  pipelined ns/call (" << pipelineDepth << " in flight)\n";
+
+	try {
+		bench_socket("socket, thread/conn", port, rpc::TcpServer::Model::ThreadPerConnection, calls);
+		bench_socket("socket, reactor", port + 1, rpc::TcpServer::Model::Reactor, calls);
+#ifdef RPC_WITH_URING
+		bench_uring("io_uring", port + 2, calls);
+#endif
+		bench_shm("shm, futex", std::chrono::microseconds(0), calls);
+
+		/* spinning needs a core per spinning thread: the server, the client reader */
+		if (std::thread::hardware_concurrency() > 2)
+			bench_shm("shm, busy-poll", std::chrono::microseconds(50), calls);
+	} catch (const std::exception& ex) {
+		std::cerr << "benchmark failed: " << ex.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}
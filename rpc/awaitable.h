@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: MIT
+/*
+ * C++20 coroutine support for RPC calls
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#define RPC_HAS_COROUTINES 1
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+
+namespace rpc {
+
+/*
+ * Awaitable RPC call.
+ * `launch` issues the call with a completion callback (see `Client::call()`);
+ * the awaiting coroutine is resumed from within that callback,
+ * i.e. on the thread that ingests the response.
+ */
+template <typename R, typename Launch>
+class CallAwaitable {
+public:
+	explicit CallAwaitable(Launch launch)
+		: m_launch(std::move(launch))
+	{ }
+
+	bool await_ready() const noexcept
+	{
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> handle)
+	{
+		/*
+		 * The coroutine (which owns this awaitable) may be resumed and
+		 * complete before `launch` returns: keep it off `this`.
+		 */
+		auto launch = std::move(m_launch);
+
+		launch([this, handle](std::exception_ptr exp, auto&&... value) {
+			m_exp = std::move(exp);
+
+			if constexpr (!std::is_same_v<R, void>)
+				m_value.emplace(std::forward<decltype(value)>(value)...);
+
+			handle.resume();
+		});
+	}
+
+	R await_resume()
+	{
+		if (m_exp != nullptr)
+			std::rethrow_exception(m_exp);
+
+		if constexpr (!std::is_same_v<R, void>)
+			return std::move(*m_value);
+	}
+
+private:
+	struct Empty { };
+
+	Launch m_launch;
+	std::exception_ptr m_exp;
+	std::conditional_t<std::is_same_v<R, void>, Empty, std::optional<R>> m_value;
+};
+
+template <typename R, typename Launch>
+auto make_awaitable(Launch&& launch)
+{
+	return CallAwaitable<R, std::decay_t<Launch>>(std::forward<Launch>(launch));
+}
+
+}
+
+#endif
@@ -0,0 +1,51 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Batch frames: many calls (or responses) in one msgpack array
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "msgpack.hpp"
+
+#include <cstdint>
+
+
+namespace rpc::batch {
+
+/*
+ * A batch is an array of calls, `[[callID, funcID, args...], ...]`, or an
+ * array of responses, `[[callID, value], ...]`. A single call or response
+ * starts with the callID instead, which tells the two apart.
+ *
+ * The element count is not known up front: the header is reserved as
+ * array32 and patched when the batch is complete.
+ */
+constexpr size_t header_size = 5;
+
+inline void reserve_header(msgpack::sbuffer& buffer)
+{
+	static const char header[header_size] = { '\xdd', 0, 0, 0, 0 };
+
+	buffer.write(header, header_size);
+}
+
+/* `offset`: of the header, e.g. behind that of the transport (see `Framing`) */
+inline void patch_header(msgpack::sbuffer& buffer, uint32_t count, size_t offset = 0) noexcept
+{
+	char* header = buffer.data() + offset;
+
+	header[1] = static_cast<char>(count >> 24);
+	header[2] = static_cast<char>(count >> 16);
+	header[3] = static_cast<char>(count >> 8);
+	header[4] = static_cast<char>(count);
+}
+
+inline bool is_batch(const msgpack::object& obj) noexcept
+{
+	return (obj.type == msgpack::type::ARRAY) && (obj.via.array.size > 0) &&
+	       (obj.via.array.ptr[0].type == msgpack::type::ARRAY);
+}
+
+}
@@ -0,0 +1,347 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Binary large objects: argument/return type that a transport may pass
+ * out-of-band, as a memfd, instead of copying it through the frame
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "msgpack.hpp"
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+
+namespace rpc {
+
+/*
+ * Bytes in memory, or in a memfd from `blob::memfd_min` up. Copies share
+ * the bytes.
+ *
+ * By default a blob is packed as msgpack `bin`, same as any payload. While
+ * a transport collects attachments (see `blob::Outgoing`), a memfd-backed
+ * blob is packed as a handle instead, and its fd travels next to the frame;
+ * the receiving side maps it (see `blob::Incoming`), with no copy either way.
+ */
+class Blob {
+public:
+	Blob() = default;
+
+	/* `size` bytes to fill through `data()` */
+	explicit Blob(size_t size);
+
+	Blob(const void* data, size_t size)
+		: Blob(size)
+	{
+		if (size > 0)
+			std::memcpy(this->data(), data, size);
+	}
+
+	char* data() noexcept
+	{
+		return m_region ? m_region->addr : nullptr;
+	}
+
+	const char* data() const noexcept
+	{
+		return m_region ? m_region->addr : nullptr;
+	}
+
+	size_t size() const noexcept
+	{
+		return m_region ? m_region->size : 0;
+	}
+
+	/* -1 unless memfd-backed */
+	int fd() const noexcept
+	{
+		return m_region ? m_region->fd : -1;
+	}
+
+	/*
+	 * Take over a received memfd: mapped copy-on-write, so the sender's bytes
+	 * stay as they are. The memfd must be sealed against shrinking (which
+	 * would fault the mapping), and hold `size` bytes at least.
+	 */
+	static Blob map(int fd, size_t size);
+
+private:
+	struct Region {
+		int fd = -1;
+		char* addr = nullptr;
+		size_t size = 0;
+		std::unique_ptr<char[]> heap;
+
+		~Region()
+		{
+			if (fd >= 0) {
+				if (addr != nullptr)
+					munmap(addr, size);
+
+				close(fd);
+			}
+		}
+	};
+
+	std::shared_ptr<Region> m_region;
+};
+
+
+namespace blob {
+
+/* smaller blobs are not worth a memfd */
+constexpr size_t memfd_min = 64 * 1024;
+
+/* msgpack ext type of a handle: [index:32][size:64], big-endian */
+constexpr int8_t ext_type = 0x42;
+constexpr size_t handle_size = 12;
+
+/* attachments per frame; the rest go inline */
+constexpr size_t max_fds = 64;
+
+/*
+ * The blobs attached to the frame being packed on this thread, if any:
+ * a transport that can pass fds sets it up around serialization, and
+ * sends `fds()` along with the frame.
+ */
+class Outgoing {
+public:
+	Outgoing() noexcept
+		: m_prev(current())
+	{
+		current() = this;
+	}
+
+	~Outgoing()
+	{
+		current() = m_prev;
+	}
+
+	Outgoing(const Outgoing&) = delete;
+	Outgoing& operator=(const Outgoing&) = delete;
+
+	/* `false` for no room: pack it inline */
+	bool attach(const Blob& blob, uint32_t& index)
+	{
+		if ((blob.fd() < 0) || (m_blobs.size() >= max_fds))
+			return false;
+
+		index = m_blobs.size();
+		m_blobs.push_back(blob);
+		return true;
+	}
+
+	/* attached so far */
+	size_t count() const noexcept
+	{
+		return m_blobs.size();
+	}
+
+	/* valid for as long as the blobs are attached */
+	std::vector<int> fds() const
+	{
+		std::vector<int> fds;
+
+		for (const auto& blob : m_blobs)
+			fds.push_back(blob.fd());
+
+		return fds;
+	}
+
+	/* the frame is sent: start the next one */
+	void clear() noexcept
+	{
+		m_blobs.clear();
+	}
+
+	static Outgoing*& current() noexcept
+	{
+		static thread_local Outgoing* outgoing = nullptr;
+		return outgoing;
+	}
+
+private:
+	Outgoing* m_prev;
+	std::vector<Blob> m_blobs;
+};
+
+/*
+ * The fds received with the frame being unpacked on this thread.
+ * Owns them: the ones no blob claims are closed.
+ */
+class Incoming {
+public:
+	explicit Incoming(std::vector<int>&& fds) noexcept
+		: m_fds(std::move(fds))
+		, m_prev(current())
+	{
+		current() = this;
+	}
+
+	~Incoming()
+	{
+		current() = m_prev;
+
+		for (int fd : m_fds) {
+			if (fd >= 0)
+				close(fd);
+		}
+	}
+
+	Incoming(const Incoming&) = delete;
+	Incoming& operator=(const Incoming&) = delete;
+
+	Blob claim(uint32_t index, size_t size)
+	{
+		if ((index >= m_fds.size()) || (m_fds[index] < 0))
+			throw std::runtime_error("blob: no such attachment");
+
+		int fd = m_fds[index];
+		m_fds[index] = -1;
+
+		return Blob::map(fd, size);
+	}
+
+	static Incoming*& current() noexcept
+	{
+		static thread_local Incoming* incoming = nullptr;
+		return incoming;
+	}
+
+private:
+	std::vector<int> m_fds;
+	Incoming* m_prev;
+};
+
+}
+
+
+inline Blob::Blob(size_t size)
+	: m_region(std::make_shared<Region>())
+{
+	m_region->size = size;
+
+	if (size < blob::memfd_min) {
+		m_region->heap.reset(new char[size]);
+		m_region->addr = m_region->heap.get();
+		return;
+	}
+
+	m_region->fd = memfd_create("rpc-blob", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (m_region->fd < 0)
+		throw std::runtime_error("memfd_create() failed");
+
+	if ((ftruncate(m_region->fd, size) < 0) ||
+	    (fcntl(m_region->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0))
+		throw std::runtime_error("blob: memfd setup failed");
+
+	void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_region->fd, 0);
+	if (addr == MAP_FAILED)
+		throw std::runtime_error("blob: mmap() failed");
+
+	m_region->addr = static_cast<char*>(addr);
+}
+
+inline Blob Blob::map(int fd, size_t size)
+{
+	Blob blob;
+
+	blob.m_region = std::make_shared<Region>();
+	blob.m_region->fd = fd;
+	blob.m_region->size = size;
+
+	int seals = fcntl(fd, F_GET_SEALS);
+	off_t length = lseek(fd, 0, SEEK_END);
+
+	if ((seals < 0) || !(seals & F_SEAL_SHRINK) || (length < 0) || (size_t(length) < size))
+		throw std::runtime_error("blob: attachment is not a sealed memfd of the size");
+
+	if (size == 0)
+		return blob;
+
+	void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (addr == MAP_FAILED)
+		throw std::runtime_error("blob: mmap() failed");
+
+	blob.m_region->addr = static_cast<char*>(addr);
+	return blob;
+}
+
+}
+
+
+namespace msgpack {
+MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
+namespace adaptor {
+
+template <>
+struct pack<rpc::Blob> {
+	template <typename Stream>
+	packer<Stream>& operator()(packer<Stream>& o, const rpc::Blob& v) const
+	{
+		auto outgoing = rpc::blob::Outgoing::current();
+		uint32_t index;
+
+		if ((outgoing == nullptr) || !outgoing->attach(v, index)) {
+			o.pack_bin(v.size());
+			o.pack_bin_body(v.data(), v.size());
+			return o;
+		}
+
+		char handle[rpc::blob::handle_size];
+		uint64_t size = v.size();
+
+		for (int i = 0; i < 4; ++i)
+			handle[i] = static_cast<char>(index >> (24 - 8 * i));
+
+		for (int i = 0; i < 8; ++i)
+			handle[4 + i] = static_cast<char>(size >> (56 - 8 * i));
+
+		o.pack_ext(sizeof(handle), rpc::blob::ext_type);
+		o.pack_ext_body(handle, sizeof(handle));
+		return o;
+	}
+};
+
+template <>
+struct convert<rpc::Blob> {
+	const msgpack::object& operator()(const msgpack::object& o, rpc::Blob& v) const
+	{
+		if (o.type == msgpack::type::BIN) {
+			v = rpc::Blob(o.via.bin.ptr, o.via.bin.size);
+			return o;
+		}
+
+		auto incoming = rpc::blob::Incoming::current();
+
+		if ((o.type != msgpack::type::EXT) || (o.via.ext.type() != rpc::blob::ext_type) ||
+		    (o.via.ext.size != rpc::blob::handle_size) || (incoming == nullptr))
+			throw msgpack::type_error();
+
+		auto handle = reinterpret_cast<const uint8_t*>(o.via.ext.data());
+		uint32_t index = 0;
+		uint64_t size = 0;
+
+		for (int i = 0; i < 4; ++i)
+			index = (index << 8) | handle[i];
+
+		for (int i = 0; i < 8; ++i)
+			size = (size << 8) | handle[4 + i];
+
+		v = incoming->claim(index, size);
+		return o;
+	}
+};
+
+}
+}
+}
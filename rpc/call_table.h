@@ -0,0 +1,462 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Pending calls of a client: a preallocated, lock-free slot table
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "metrics.h"
+
+#include "msgpack.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+
+namespace rpc {
+
+/*
+ * A move-only `void(const msgpack::object&, bool last, std::exception_ptr&&) noexcept`,
+ * held in place when it fits (the library's own waiters do), on the heap otherwise
+ */
+class Handler {
+public:
+	static constexpr size_t capacity = 96;
+
+	Handler() = default;
+
+	Handler(const Handler&) = delete;
+	Handler& operator=(const Handler&) = delete;
+
+	~Handler()
+	{
+		reset();
+	}
+
+	template <typename F>
+	void emplace(F&& func)
+	{
+		using Func = std::decay_t<F>;
+
+		reset();
+
+		if constexpr ((sizeof(Func) <= capacity) && (alignof(Func) <= alignof(std::max_align_t))) {
+			new (m_storage) Func(std::forward<F>(func));
+			m_ops = &inline_ops<Func>;
+		} else {
+			*reinterpret_cast<Func**>(m_storage) = new Func(std::forward<F>(func));
+			m_ops = &heap_ops<Func>;
+		}
+	}
+
+	void operator()(const msgpack::object& obj, bool last, std::exception_ptr&& exp) noexcept
+	{
+		m_ops->invoke(m_storage, obj, last, std::move(exp));
+	}
+
+	void reset() noexcept
+	{
+		if (m_ops != nullptr) {
+			m_ops->destroy(m_storage);
+			m_ops = nullptr;
+		}
+	}
+
+private:
+	struct Ops {
+		void (*invoke)(void*, const msgpack::object&, bool, std::exception_ptr&&) noexcept;
+		void (*destroy)(void*) noexcept;
+	};
+
+	template <typename Func>
+	static constexpr Ops inline_ops = {
+		[](void* storage, const msgpack::object& obj, bool last, std::exception_ptr&& exp) noexcept {
+			(*static_cast<Func*>(storage))(obj, last, std::move(exp));
+		},
+		[](void* storage) noexcept {
+			static_cast<Func*>(storage)->~Func();
+		},
+	};
+
+	template <typename Func>
+	static constexpr Ops heap_ops = {
+		[](void* storage, const msgpack::object& obj, bool last, std::exception_ptr&& exp) noexcept {
+			(**static_cast<Func**>(storage))(obj, last, std::move(exp));
+		},
+		[](void* storage) noexcept {
+			delete *static_cast<Func**>(storage);
+		},
+	};
+
+	alignas(std::max_align_t) unsigned char m_storage[capacity];
+	const Ops* m_ops = nullptr;
+};
+
+
+/*
+ * Each outstanding call owns a slot; its callID is `[generation][slot index]`,
+ * so that a response finds its slot straight away, and a response to a call
+ * that is done with (or a stale callID) does not match the slot's next call.
+ *
+ * A slot goes through its states with a CAS on a single word, `[callID][state]`:
+ *
+ *   Free -> Setup -> Pending <-> Busy -> Completing -> Free
+ *
+ * Setup while the call is prepared, Busy while a response that is not the
+ * last one is delivered, Completing while the last one is. A cancellation
+ * that comes while Busy is deferred: it marks the slot (Cancelling, then
+ * Cancelled once the exception is stored), and the delivering thread
+ * completes the call with it.
+ */
+class CallTable {
+public:
+	static constexpr size_t default_capacity = 4096;
+
+	/* rounded up to a power of 2 */
+	explicit CallTable(size_t capacity = default_capacity, uint32_t seed = 0)
+	{
+		while ((size_t(1) << m_bits) < capacity)
+			++m_bits;
+
+		if (m_bits > 24)
+			throw std::invalid_argument("call table: capacity too large");
+
+		m_mask = (uint32_t(1) << m_bits) - 1;
+		m_slots.reset(new Slot[m_mask + 1]);
+
+		for (uint32_t i = 0; i <= m_mask; ++i)
+			m_slots[i].word.store(make_word((seed << m_bits) | i, Free), std::memory_order_relaxed);
+	}
+
+	size_t capacity() const noexcept
+	{
+		return m_mask + 1;
+	}
+
+	/*
+	 * A free slot, held until `arm()` or `release()`: `false` if there is none
+	 */
+	bool claim(uint32_t& callID) noexcept
+	{
+		for (uint32_t tries = 0; tries <= m_mask; ++tries) {
+			auto& slot = m_slots[m_cursor.fetch_add(1, std::memory_order_relaxed) & m_mask];
+			auto word = slot.word.load(std::memory_order_relaxed);
+
+			if (state_of(word) != Free)
+				continue;
+
+			callID = next_generation(id_of(word));
+
+			if (slot.word.compare_exchange_strong(word, make_word(callID, Setup), std::memory_order_acquire, std::memory_order_relaxed))
+				return true;
+		}
+
+		return false;
+	}
+
+	/* the call is waiting for `handler(obj, last, exp)` */
+	template <typename F>
+	void arm(uint32_t callID, F&& handler)
+	{
+		auto& slot = slot_of(callID);
+
+		try {
+			slot.handler.emplace(std::forward<F>(handler));
+		} catch (...) {
+			release(callID);
+			throw;
+		}
+
+		slot.remaining = 0;
+		slot.word.store(make_word(callID, Pending), std::memory_order_release);
+	}
+
+	/* the claimed slot is not needed after all (or no response is: a tracked call counts as done) */
+	void release(uint32_t callID) noexcept
+	{
+		auto& slot = slot_of(callID);
+
+#ifndef RPC_NO_METRICS
+		record(slot, false);
+#endif
+
+		slot.word.store(make_word(callID, Free), std::memory_order_release);
+	}
+
+#ifndef RPC_NO_METRICS
+	/*
+	 * The call of a claimed slot counts in `metrics` from now until it
+	 * completes, along with the bytes of its responses (see `deliver()`)
+	 */
+	void track(uint32_t callID, const metrics::Metrics& metrics, size_t bytesOut) noexcept
+	{
+		auto& slot = slot_of(callID);
+
+		slot.metrics = &metrics;
+		slot.started = metrics::Clock::now();
+		slot.bytesIn = 0;
+		slot.bytesOut = bytesOut;
+
+		metrics.start();
+	}
+#endif
+
+	/* see `Client::expect()` */
+	bool expect(uint32_t callID, size_t responses) noexcept
+	{
+		auto& slot = slot_of(callID);
+
+		if (!take(slot, callID))
+			return false;
+
+		slot.remaining = responses;
+		give_back(slot, callID);
+		return true;
+	}
+
+	/*
+	 * One more response to `callID` (see `Client::ingest_resp()`), `bytes`
+	 * long on the wire; the last one completes the call. Returns `false`
+	 * if there is no such call.
+	 */
+	bool deliver(uint32_t callID, bool last, const msgpack::object& obj, std::exception_ptr&& exp, [[maybe_unused]] size_t bytes = 0) noexcept
+	{
+		auto& slot = slot_of(callID);
+
+		if (!take(slot, callID))
+			return false;
+
+#ifndef RPC_NO_METRICS
+		slot.bytesIn += bytes;
+#endif
+
+		if (slot.remaining > 0)
+			last = (--slot.remaining == 0);
+
+		if (!last) {
+			slot.handler(obj, false, std::move(exp));
+			give_back(slot, callID);
+			return true;
+		}
+
+		/* from now on, a cancellation comes too late */
+		auto word = make_word(callID, Busy);
+
+		if (slot.word.compare_exchange_strong(word, make_word(callID, Completing), std::memory_order_acq_rel, std::memory_order_relaxed))
+			finish(slot, callID, obj, std::move(exp));
+		else
+			finish_cancelled(slot, callID);
+
+		return true;
+	}
+
+	bool cancel(uint32_t callID, std::exception_ptr&& exp) noexcept
+	{
+		auto& slot = slot_of(callID);
+		auto word = slot.word.load(std::memory_order_acquire);
+
+		while (id_of(word) == callID) {
+			switch (state_of(word)) {
+			case Pending:
+				if (slot.word.compare_exchange_weak(word, make_word(callID, Completing), std::memory_order_acquire, std::memory_order_acquire)) {
+					finish(slot, callID, msgpack::object(), std::move(exp));
+					return true;
+				}
+
+				break;
+
+			case Busy:
+				/* a response is being delivered: that thread completes the call */
+				if (slot.word.compare_exchange_weak(word, make_word(callID, Cancelling), std::memory_order_acquire, std::memory_order_acquire)) {
+					slot.cancelled = std::move(exp);
+					slot.word.store(make_word(callID, Cancelled), std::memory_order_release);
+					return true;
+				}
+
+				break;
+
+			default:
+				/* not there yet, done with, or cancelled already */
+				return false;
+			}
+		}
+
+		return false;
+	}
+
+	/*
+	 * Done with before its last response is in, e.g. by the handler itself
+	 * (see `Client::multi_call()`): the call completes, failed if `exp` is
+	 * set, and the rest are dropped
+	 */
+	bool settle(uint32_t callID, std::exception_ptr exp = nullptr) noexcept
+	{
+		return cancel(callID, std::move(exp));
+	}
+
+	/* not completed yet */
+	bool pending(uint32_t callID) const noexcept
+	{
+		auto word = m_slots[callID & m_mask].word.load(std::memory_order_acquire);
+
+		return (id_of(word) == callID) && (state_of(word) != Free);
+	}
+
+	/*
+	 * Calls that start meanwhile may or may not be cancelled
+	 */
+	void cancel_all(const std::exception_ptr& exp) noexcept
+	{
+		for (uint32_t i = 0; i <= m_mask; ++i) {
+			auto word = m_slots[i].word.load(std::memory_order_acquire);
+			auto state = state_of(word);
+
+			if ((state == Pending) || (state == Busy))
+				cancel(id_of(word), std::exception_ptr(exp));
+		}
+	}
+
+private:
+	enum State : uint32_t {
+		Free,
+		Setup,
+		Pending,
+		Busy,
+		Cancelling,
+		Cancelled,
+		Completing,
+	};
+
+	/* a cache line or two each: slots of calls of different threads do not share one */
+	struct alignas(64) Slot {
+		std::atomic<uint64_t> word{0};
+
+		/* owned by whoever moved the slot out of Pending */
+		size_t remaining = 0;		/* 0: the caller tells the last response */
+		std::exception_ptr cancelled;
+		Handler handler;
+
+#ifndef RPC_NO_METRICS
+		const metrics::Metrics* metrics = nullptr;
+		metrics::Clock::time_point started;
+		uint64_t bytesIn = 0;
+		uint64_t bytesOut = 0;
+#endif
+	};
+
+	std::unique_ptr<Slot[]> m_slots;
+	uint32_t m_bits = 0;
+	uint32_t m_mask = 0;
+	std::atomic<uint32_t> m_cursor{0};
+
+	static uint64_t make_word(uint32_t callID, State state) noexcept
+	{
+		return (uint64_t(callID) << 32) | state;
+	}
+
+	static uint32_t id_of(uint64_t word) noexcept
+	{
+		return static_cast<uint32_t>(word >> 32);
+	}
+
+	static State state_of(uint64_t word) noexcept
+	{
+		return static_cast<State>(static_cast<uint32_t>(word));
+	}
+
+	Slot& slot_of(uint32_t callID) noexcept
+	{
+		return m_slots[callID & m_mask];
+	}
+
+	/* same slot, next use (the generation wraps around) */
+	uint32_t next_generation(uint32_t callID) const noexcept
+	{
+		return ((callID + (uint32_t(1) << m_bits)) & ~m_mask) | (callID & m_mask);
+	}
+
+	/* Pending -> Busy, waiting out another delivery to the same call */
+	bool take(Slot& slot, uint32_t callID) noexcept
+	{
+		auto word = make_word(callID, Pending);
+
+		while (!slot.word.compare_exchange_weak(word, make_word(callID, Busy), std::memory_order_acquire, std::memory_order_relaxed)) {
+			if (id_of(word) != callID)
+				return false;
+
+			switch (state_of(word)) {
+			case Pending:
+				break;
+
+			case Busy:
+			case Cancelling:
+			case Cancelled:
+				std::this_thread::yield();
+				break;
+
+			default:
+				return false;
+			}
+
+			word = make_word(callID, Pending);
+		}
+
+		return true;
+	}
+
+	/* Busy -> Pending, unless cancelled meanwhile */
+	void give_back(Slot& slot, uint32_t callID) noexcept
+	{
+		auto word = make_word(callID, Busy);
+
+		if (!slot.word.compare_exchange_strong(word, make_word(callID, Pending), std::memory_order_release, std::memory_order_relaxed))
+			finish_cancelled(slot, callID);
+	}
+
+	void finish_cancelled(Slot& slot, uint32_t callID) noexcept
+	{
+		/* the canceller is storing its exception */
+		while (state_of(slot.word.load(std::memory_order_acquire)) != Cancelled)
+			std::this_thread::yield();
+
+		auto exp = std::move(slot.cancelled);
+		finish(slot, callID, msgpack::object(), std::move(exp));
+	}
+
+	void finish(Slot& slot, uint32_t callID, const msgpack::object& obj, std::exception_ptr&& exp) noexcept
+	{
+#ifndef RPC_NO_METRICS
+		record(slot, exp != nullptr);
+#endif
+
+		slot.handler(obj, true, std::move(exp));
+		slot.handler.reset();
+		slot.cancelled = nullptr;
+
+		slot.word.store(make_word(callID, Free), std::memory_order_release);
+	}
+
+#ifndef RPC_NO_METRICS
+	/* by the thread that completes the call */
+	static void record(Slot& slot, bool failed) noexcept
+	{
+		if (slot.metrics == nullptr)
+			return;
+
+		slot.metrics->finish(metrics::elapsed_ns(slot.started), failed, slot.bytesIn, slot.bytesOut);
+		slot.metrics = nullptr;
+	}
+#endif
+};
+
+}
@@ -8,14 +8,30 @@
 #pragma once
 
 #include "errors.h"
+#include "func_hash.h"
+#include "batch.h"
+#include "pool.h"
+#include "call_table.h"
+#include "dispatch.h"
+#include "metrics.h"
+#include "deadline.h"
+#include "timer_wheel.h"
+#include "iobuffer.h"
+#include "single_flight.h"
+#include "stub.h"
+#include "framing.h"
 
 #include "msgpack.hpp"
 
-#include <unordered_map>
-#include <future>
-#include <mutex>
+#include <vector>
 #include <atomic>
+#include <functional>
+#include <type_traits>
+#include <future>
+#include <algorithm>
 #include <ctime>
+#include <string>
+#include <string_view>
 
 
 namespace rpc {
@@ -31,92 +47,518 @@ public:
 	{ }
 };
 
+/* a call past its deadline, see `Deadline` */
+class DeadlineExceeded : public ClientError {
+public:
+	DeadlineExceeded() noexcept
+		: ClientError("deadline exceeded")
+	{ }
+};
+
+/* the transport failed the call, not the server: it was not sent, or not answered */
+class ConnectionError : public ClientError {
+public:
+	explicit ConnectionError(const char* msg) noexcept
+		: ClientError(msg)
+	{ }
+};
+
+
+/*
+ * `[callID, funcID | hash, ` of a call of `argc` arguments; with a deadline,
+ * the budget left goes in place of the callID, see `deadline::pack_id()`
+ */
+template <typename Stream>
+void pack_call_head(msgpack::packer<Stream>& packer, uint32_t callID, std::string_view funcID, size_t argc)
+{
+	packer.pack_array(2 + argc);
+	packer.pack(callID);
+	packer.pack(funcID);
+}
+
+template <typename Stream>
+void pack_call_head(msgpack::packer<Stream>& packer, uint32_t callID, FuncHash funcID, size_t argc)
+{
+	packer.pack_array(2 + argc);
+	packer.pack(callID);
+	packer.pack(funcID.value());
+}
+
+template <typename Stream, typename FuncID>
+void pack_call_head(msgpack::packer<Stream>& packer, uint32_t callID, const Deadline<FuncID>& funcID, size_t argc)
+{
+	packer.pack_array(2 + argc);
+	deadline::pack_id(packer, callID, funcID.expiry());
+
+	if constexpr (std::is_same_v<FuncID, FuncHash>)
+		packer.pack(funcID.func_id().value());
+	else
+		packer.pack(std::string_view(funcID.func_id()));
+}
+
+/* made as a plain funcID where a call does not coalesce, see `SingleFlight` */
+template <typename Stream, typename FuncID>
+void pack_call_head(msgpack::packer<Stream>& packer, uint32_t callID, const SingleFlight<FuncID>& funcID, size_t argc)
+{
+	pack_call_head(packer, callID, funcID.func_id(), argc);
+}
+
+/* as any funcID where the stub does not make the call by itself (see `Stub`) */
+template <typename Stream, typename Signature>
+void pack_call_head(msgpack::packer<Stream>& packer, uint32_t callID, const Stub<Signature>& funcID, size_t argc)
+{
+	if (funcID.by_hash())
+		pack_call_head(packer, callID, funcID.hash(), argc);
+	else
+		pack_call_head(packer, callID, std::string_view(funcID.name()), argc);
+}
+
+/* the arguments are packed where they are, not copied into a tuple first */
+template <typename Stream, typename FuncID, typename... Args>
+void pack_call(msgpack::packer<Stream>& packer, uint32_t callID, const FuncID& funcID, Args&&... args)
+{
+	pack_call_head(packer, callID, funcID, sizeof...(Args));
+	(packer.pack(args), ...);
+}
+
+/* the payload of a view argument is referred to, anything else is packed */
+template <typename T>
+void pack_arg(msgpack::packer<IoBuffer>& packer, IoBuffer& buffer, const T& arg)
+{
+	if constexpr (std::is_same_v<T, std::string_view>) {
+		packer.pack_str(static_cast<uint32_t>(arg.size()));
+		buffer.reference(arg.data(), arg.size());
+	} else if constexpr (std::is_same_v<T, msgpack::type::raw_ref>) {
+		packer.pack_str(arg.size);
+		buffer.reference(arg.ptr, arg.size);
+	} else if constexpr (std::is_same_v<T, BinRef>) {
+		packer.pack_bin(static_cast<uint32_t>(arg.size));
+		buffer.reference(arg.ptr, arg.size);
+	} else {
+		packer.pack(arg);
+	}
+}
+
+/*
+ * Into a `msgpack::sbuffer`, behind room for the header of `framing`, or,
+ * if there are view arguments (see `is_view_v`), an `IoBuffer` that refers
+ * to their payloads: the caller keeps them valid until the frame is sent
+ */
+template <typename FuncID, typename... Args>
+auto serialize_call(const Framing& framing, uint32_t callID, const FuncID& funcID, Args&&... args)
+{
+	if constexpr (has_views_v<Args...>) {
+		IoBuffer buffer;
+		msgpack::packer<IoBuffer> packer(buffer);
+
+		pack_call_head(packer, callID, funcID, sizeof...(Args));
+		(pack_arg(packer, buffer, args), ...);
+		return buffer;
+	} else {
+		auto buffer = framing.buffer();
+		msgpack::packer<msgpack::sbuffer> packer(buffer);
+
+		pack_call(packer, callID, funcID, std::forward<Args>(args)...);
+		return buffer;
+	}
+}
+
+template <typename FuncID, typename... Args>
+auto serialize_call(uint32_t callID, const FuncID& funcID, Args&&... args)
+{
+	return serialize_call(Framing(), callID, funcID, std::forward<Args>(args)...);
+}
+
 
-template <typename... Args>
-msgpack::sbuffer serialize_call(uint32_t callID, const std::string& funcID, Args&&... args)
+/* with the header the stub packed once, see `Stub` */
+template <typename R, typename... Params, typename... Args>
+auto serialize_call(const Framing& framing, uint32_t callID, const Stub<R(Params...)>& stub, Args&&... args)
 {
-	auto data = std::make_tuple(callID, funcID, std::forward<Args>(args)...);
+	static_assert(sizeof...(Args) == sizeof...(Params), "the number of arguments does not match the stub");
+	static_assert((std::is_convertible_v<Args&&, Params> && ...), "an argument does not convert to its type in the stub");
+
+	if constexpr (has_views_v<Args...>) {
+		IoBuffer buffer;
+
+		stub.serialize(buffer, callID, [&](msgpack::packer<IoBuffer>& packer) {
+			(pack_arg(packer, buffer, stub::as_param<std::decay_t<Params>>(args)), ...);
+		});
 
-	msgpack::sbuffer buffer;
-	msgpack::packer<msgpack::sbuffer> packer(buffer);
+		return buffer;
+	} else {
+		auto buffer = framing.buffer();
 
-	packer.pack(data);
-	return buffer;
+		stub.serialize(buffer, callID, [&](auto& packer) {
+			(packer.pack(stub::as_param<std::decay_t<Params>>(args)), ...);
+		});
+
+		return buffer;
+	}
+}
+
+template <typename R, typename... Params, typename... Args>
+auto serialize_call(uint32_t callID, const Stub<R(Params...)>& stub, Args&&... args)
+{
+	return serialize_call(Framing(), callID, stub, std::forward<Args>(args)...);
 }
 
 
+/*
+ * `funcID` is either the function name, or its `FuncHash`, either may come
+ * with a `Deadline`, or be `SingleFlight`; or a `Stub`
+ */
+template <typename T>
+inline constexpr bool is_func_id_v = std::is_same_v<std::decay_t<T>, FuncHash> ||
+				     std::is_convertible_v<const T&, std::string> ||
+				     is_deadline_v<std::decay_t<T>> ||
+				     is_single_flight_v<std::decay_t<T>> ||
+				     is_stub_v<std::decay_t<T>>;
+
+
+/*
+ * When a `multi_call()` completes
+ */
+class Completion {
+public:
+	/* every response; any failure fails the call */
+	static Completion all() noexcept
+	{
+		return Completion(0);
+	}
+
+	/* the first `n` successful responses (a quorum), in arrival order */
+	static Completion first(size_t n) noexcept
+	{
+		return Completion(std::max<size_t>(n, 1));
+	}
+
+	static Completion first_success() noexcept
+	{
+		return Completion(1);
+	}
+
+	/* 0 for all */
+	size_t count() const noexcept
+	{
+		return m_count;
+	}
+
+private:
+	size_t m_count;
+
+	explicit Completion(size_t count) noexcept
+		: m_count(count)
+	{ }
+};
+
+template <typename T>
+inline constexpr bool is_completion_v = std::is_same_v<std::decay_t<T>, Completion>;
+
+
 class Client {
 public:
-	template <typename R, typename... Args>
-	auto call(const std::string& funcID, Args&&... args)
+	/*
+	 * Up to `maxPending` calls outstanding at a time (rounded up to a power of 2);
+	 * one more fails with `ClientError`. Calls with a deadline are timed by
+	 * `timers`, on its thread. The frames are packed behind room for the header
+	 * of `framing`, that of the transport that sends them (see `Framing`).
+	 */
+	explicit Client(size_t maxPending = CallTable::default_capacity, TimerWheel& timers = TimerWheel::shared(), const Framing& framing = Framing())
+		: m_calls(maxPending, static_cast<uint32_t>(std::time(nullptr)))
+		, m_timers(timers)
+		, m_framing(framing)
+	{ }
+
+	~Client()
 	{
-		auto data = serialize_call(m_callID, funcID, std::forward<Args>(args)...);
-		auto prom = std::make_shared<std::promise<R>>();
+		if (m_timed)
+			m_timers.cancel(this);
+	}
 
-		if constexpr (std::is_same_v<R, void>) {
-			/* no return value, do not wait */
-			prom->set_value();
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	auto call(const FuncID& funcID, Args&&... args)
+	{
+		std::promise<R> prom;
+		auto future = prom.get_future();
+
+		auto [data, callID] = call<R>(fulfil(std::move(prom)), funcID, std::forward<Args>(args)...);
+		return std::make_tuple(std::move(future), std::move(data), callID);
+	}
+
+	/*
+	 * Completion callback flavour of `call()`:
+	 *   callback(std::exception_ptr, R)  or  callback(std::exception_ptr) for `void`
+	 *
+	 * The callback must be movable and must not throw. It is invoked from the
+	 * thread that ingests the response (or cancels the call); for `void` it is
+	 * invoked right away.
+	 */
+	template <typename R, typename Callback, typename FuncID, typename... Args,
+		  std::enable_if_t<!is_func_id_v<Callback>, int> = 0>
+	auto call(Callback&& callback, const FuncID& funcID, Args&&... args)
+	{
+		if constexpr (is_single_flight_v<FuncID>) {
+			return coalesce<R>(std::forward<Callback>(callback), funcID.func_id(), std::forward<Args>(args)...);
 		} else {
-			std::lock_guard lock(m_mutex);
+			uint32_t callID = claim();
+			auto data = serialize(callID, funcID, std::forward<Args>(args)...);
 
-			auto wrapper = [=](const msgpack::object& obj, [[maybe_unused]] bool last, std::exception_ptr&& exp) noexcept {
-				if (exp != nullptr) {
-					prom->set_exception(exp);
-					return;
-				}
+			expect_resp<R>(callID, funcID, std::forward<Callback>(callback));
+			return std::make_tuple(std::move(data), callID);
+		}
+	}
 
-				auto resp = obj.as<R>();
 
-				prom->set_value(std::move(resp));
-			};
+	/*
+	 * Many independent calls in one frame:
+	 *
+	 *   auto batch = client.batch();
+	 *   auto a = batch.call<int>("get", 1);
+	 *   auto b = batch.call<int>("get", 2);
+	 *   auto [buffer, callIDs] = client.call_batch(std::move(batch));
+	 *
+	 * The server answers either with a single batch of responses or with each
+	 * response on its own (see `Server::handle_batch()`); `ingest_resp()`
+	 * takes both.
+	 */
+	class Batch {
+	public:
+		template <typename R, typename FuncID, typename... Args,
+			  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+		std::future<R> call(const FuncID& funcID, Args&&... args)
+		{
+			std::promise<R> prom;
+			auto future = prom.get_future();
+
+			call<R>(fulfil(std::move(prom)), funcID, std::forward<Args>(args)...);
+			return future;
+		}
 
-			m_respWaiters.emplace(m_callID, wrapper);
+		/* see `Client::call()` */
+		template <typename R, typename Callback, typename FuncID, typename... Args,
+			  std::enable_if_t<!is_func_id_v<Callback>, int> = 0>
+		uint32_t call(Callback&& callback, const FuncID& funcID, Args&&... args)
+		{
+			uint32_t callID = m_client.claim();
+
+			try {
+				msgpack::packer<msgpack::sbuffer> packer(m_buffer);
+				[[maybe_unused]] size_t offset = m_buffer.size();
+
+				pack_call(packer, callID, funcID, std::forward<Args>(args)...);
+#ifndef RPC_NO_METRICS
+				m_client.m_calls.track(callID, m_client.metrics_of(funcID), m_buffer.size() - offset);
+#endif
+				m_callIDs.push_back(callID);
+			} catch (...) {
+				m_client.m_calls.release(callID);
+				throw;
+			}
+
+			m_client.expect_resp<R>(callID, funcID, std::forward<Callback>(callback));
+			return callID;
 		}
 
-		return std::make_tuple(prom->get_future(), std::move(data), m_callID++);
+		size_t size() const noexcept
+		{
+			return m_callIDs.size();
+		}
+
+	private:
+		friend class Client;
+
+		Client& m_client;
+		msgpack::sbuffer m_buffer;
+		std::vector<uint32_t> m_callIDs;
+
+		explicit Batch(Client& client)
+			: m_client(client)
+			, m_buffer(client.m_framing.buffer())
+		{
+			batch::reserve_header(m_buffer);
+		}
+	};
+
+	Batch batch()
+	{
+		return Batch(*this);
+	}
+
+	/*
+	 * Returns the frame, empty for an empty batch, and the callIDs in it
+	 */
+	std::tuple<msgpack::sbuffer, std::vector<uint32_t>> call_batch(Batch&& batch)
+	{
+		if (batch.size() == 0)
+			return std::make_tuple(msgpack::sbuffer(0), std::vector<uint32_t>());
+
+		batch::patch_header(batch.m_buffer, batch.size(), m_framing.header);
+		return std::make_tuple(std::move(batch.m_buffer), std::move(batch.m_callIDs));
+	}
+
+
+	/*
+	 * Call a streaming function (see `Writer`):
+	 *   onChunk(T&&) for each chunk, in order, as it comes in,
+	 *   then onDone(std::exception_ptr) once, when the stream ends or fails
+	 *
+	 * Both are invoked from the thread that ingests the responses, and must
+	 * not throw; a throwing `onChunk()` fails the stream. A function that
+	 * does not stream comes as a single chunk.
+	 */
+	template <typename T, typename OnChunk, typename OnDone, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	auto stream_call(OnChunk&& onChunk, OnDone&& onDone, const FuncID& funcID, Args&&... args)
+	{
+		uint32_t callID = claim();
+		auto data = serialize(callID, funcID, std::forward<Args>(args)...);
+
+		auto wrapper = [onChunk = std::forward<OnChunk>(onChunk), onDone = std::forward<OnDone>(onDone), done = false](const msgpack::object& obj, bool last, std::exception_ptr&& exp) mutable noexcept {
+			if (done)
+				return;
+
+			if ((exp == nullptr) && !obj.is_nil()) {
+				try {
+					onChunk(obj.as<T>());
+				} catch (...) {
+					exp = std::current_exception();
+				}
+			}
+
+			if ((exp != nullptr) || last) {
+				done = true;
+				onDone(std::move(exp));
+			}
+		};
+
+		arm(callID, funcID, std::move(wrapper));
+
+		return std::make_tuple(std::move(data), callID);
+	}
+
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	auto multi_call(const FuncID& funcID, Args&&... args)
+	{
+		return multi_call<R>(Completion::all(), funcID, std::forward<Args>(args)...);
+	}
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	auto multi_call(Completion completion, const FuncID& funcID, Args&&... args)
+	{
+		using Result = std::conditional_t<std::is_same_v<R, void>, void, std::vector<R>>;
+
+		std::promise<Result> prom;
+		auto future = prom.get_future();
+
+		auto [data, callID] = multi_call<R>(completion, fulfil(std::move(prom)), funcID, std::forward<Args>(args)...);
+		return std::make_tuple(std::move(future), std::move(data), callID);
 	}
 
+	/*
+	 * Completion callback flavour of `multi_call()`:
+	 *   callback(std::exception_ptr, std::vector<R>)  or  callback(std::exception_ptr) for `void`
+	 */
+	template <typename R, typename Callback, typename FuncID, typename... Args,
+		  std::enable_if_t<!is_func_id_v<Callback> && !is_completion_v<Callback>, int> = 0>
+	auto multi_call(Callback&& callback, const FuncID& funcID, Args&&... args)
+	{
+		return multi_call<R>(Completion::all(), std::forward<Callback>(callback), funcID, std::forward<Args>(args)...);
+	}
 
-	template <typename R, typename... Args>
-	auto multi_call(const std::string& funcID, Args&&... args)
+	/*
+	 * With `Completion::first(n)`, the call completes upon the n-th successful
+	 * response, and fails once the last response (see `expect()`) or failure
+	 * (see `ingest_error()`) is in without a quorum. Later responses are dropped:
+	 * the call is not `pending()` any more.
+	 */
+	template <typename R, typename Callback, typename FuncID, typename... Args,
+		  std::enable_if_t<!is_func_id_v<Callback>, int> = 0>
+	auto multi_call(Completion completion, Callback&& callback, const FuncID& funcID, Args&&... args)
 	{
-		auto data = serialize_call(m_callID, funcID, std::forward<Args>(args)...);
+		uint32_t callID = claim();
+		auto data = serialize(callID, funcID, std::forward<Args>(args)...);
 
 		if constexpr (std::is_same_v<R, void>) {
 			/* no return value, do not wait */
-			auto prom = std::make_shared<std::promise<R>>();
-
-			prom->set_value();
-			return std::make_tuple(prom->get_future(), std::move(data), m_callID++);
+			m_calls.release(callID);
+			callback(nullptr);
 		} else {
-			auto prom = std::make_shared<std::promise<std::vector<R>>>();
-			auto retval = std::make_shared<std::vector<R>>();
+			struct State {
+				std::vector<R> retval;
+				std::exception_ptr error;
+				bool done = false;
+			};
 
-			std::lock_guard lock(m_mutex);
+			size_t quorum = completion.count();
 
-			auto wrapper = [=](const msgpack::object& obj, bool last, std::exception_ptr&& exp) noexcept {
-				if (exp != nullptr) {
-					prom->set_exception(exp);
+			auto wrapper = [this, callID, callback = std::forward<Callback>(callback), state = State(), quorum](const msgpack::object& obj, bool last, std::exception_ptr&& exp) mutable noexcept {
+				if (state.done)
 					return;
-				}
 
-				auto resp = obj.as<R>();
-				retval->push_back(std::move(resp));
+				if (exp == nullptr) {
+					try {
+						state.retval.push_back(obj.as<R>());
+					} catch (...) {
+						exp = std::current_exception();
+					}
+				}
 
-				if (last) {
-					prom->set_value(std::move(*retval));
+				if ((exp != nullptr) && (state.error == nullptr))
+					state.error = exp;
+
+				if ((quorum == 0) && (exp != nullptr)) {
+					state.done = true;
+					callback(std::move(exp), std::vector<R>());
+				} else if ((quorum > 0) && (state.retval.size() >= quorum)) {
+					state.done = true;
+					callback(nullptr, std::move(state.retval));
+				} else if (last) {
+					state.done = true;
+
+					if (quorum == 0)
+						callback(nullptr, std::move(state.retval));
+					else
+						callback((state.error != nullptr) ? state.error : std::make_exception_ptr(ClientError("no quorum")), std::vector<R>());
 				}
+
+				/* settled before the last response: the slot does not wait for it */
+				if (state.done && !last)
+					m_calls.settle(callID, (quorum == 0) ? state.error : nullptr);
 			};
 
-			m_respWaiters.emplace(m_callID, wrapper);
-			return std::make_tuple(prom->get_future(), std::move(data), m_callID++);
+			arm(callID, funcID, std::move(wrapper));
 		}
+
+		return std::make_tuple(std::move(data), callID);
+	}
+
+	/*
+	 * Let the client count the responses to a `multi_call()` by itself:
+	 * the `last` argument of `ingest_resp()` is then ignored for this call,
+	 * and the call completes upon the n-th response.
+	 */
+	bool expect(uint32_t callID, size_t responses) noexcept
+	{
+		return m_calls.expect(callID, responses);
+	}
+
+	/* still waiting for a response (or one more) */
+	bool pending(uint32_t callID) const noexcept
+	{
+		return m_calls.pending(callID);
 	}
 
 
 	/*
 	 * Cancellation can be invoked, e.g. upon timeout.
 	 * The exception will be thrown by the `future`.
+	 *
+	 * Cancelling a stream or a `multi_call()` while one of its responses
+	 * is being ingested takes effect once that one is in.
 	 */
 	template<typename ExceptionT>
 	bool cancel(uint32_t callID, ExceptionT&& ex) noexcept
@@ -126,58 +568,424 @@ public:
 
 	bool cancel(uint32_t callID, std::exception_ptr&& exp) noexcept
 	{
-		std::function<void(const msgpack::object&, bool, std::exception_ptr&&)> wrapper;
+		return m_calls.cancel(callID, std::move(exp));
+	}
 
-		{
-			std::lock_guard lock(m_mutex);
-			auto it = m_respWaiters.find(callID);
 
-			if (it == m_respWaiters.end())
-				return false;
+	/*
+	 * Fail every outstanding call, e.g. when the connection is lost
+	 */
+	void cancel_all(const std::exception_ptr& exp) noexcept
+	{
+		m_calls.cancel_all(exp);
+	}
+
 
-			wrapper = std::move(it->second);
-			m_respWaiters.erase(it);
+	/*
+	 * Either a single response, or a batch of responses (each is the last one
+	 * of its call). A stream chunk (see `Writer`) tells by itself whether it
+	 * is the last one. A batch is ingested in full even if some of its responses
+	 * are not, the first such error is thrown afterwards.
+	 *
+	 * Returns the callID of the response (of a batch: of its last response).
+	 */
+	uint32_t ingest_resp(const char* data, size_t size, bool last = true)
+	{
+		/* the response is converted before returning: no need to copy the payload */
+		pool::Zone zone;
+		auto resp = msgpack::unpack(*zone, data, size, reference_payload);
+
+		if (!batch::is_batch(resp))
+			return ingest_one(resp, last, size);
+
+		std::exception_ptr error;
+		uint32_t callID = 0;
+		size_t share = (resp.via.array.size > 0) ? (size / resp.via.array.size) : 0;
+
+		for (uint32_t i = 0; i < resp.via.array.size; ++i) {
+			try {
+				callID = ingest_one(resp.via.array.ptr[i], true/*last*/, share);
+			} catch (...) {
+				if (error == nullptr)
+					error = std::current_exception();
+			}
 		}
 
-		wrapper({}, true, std::move(exp));
-		return true;
+		if (error != nullptr)
+			std::rethrow_exception(error);
+
+		return callID;
+	}
+
+	uint32_t ingest_resp(const msgpack::sbuffer& buffer, bool last = true)
+	{
+		return ingest_resp(buffer.data(), buffer.size(), last);
 	}
 
+	/*
+	 * A response that will not come, e.g. a server timed out or is gone:
+	 * counts as one of the responses to a `multi_call()` (see `Completion`),
+	 * fails any other call, same as `cancel()`.
+	 */
+	bool ingest_error(uint32_t callID, std::exception_ptr exp, bool last = true) noexcept
+	{
+		return m_calls.deliver(callID, last, msgpack::object(), std::move(exp));
+	}
 
-	void ingest_resp(const msgpack::sbuffer& buffer, bool last = true)
+#ifndef RPC_NO_METRICS
+	/*
+	 * Per function called (see `MethodStats`), from the request being
+	 * serialized until the call completes: responded to, failed or cancelled.
+	 * A function called by `FuncHash` before it is by name is `#<hash>`.
+	 * For the server's side, call `rpc::stats_func_id`.
+	 */
+	Stats stats() const
 	{
-		std::vector<msgpack::object> items;
+		Stats stats;
 
-		msgpack::unpack(buffer.data(), buffer.size()).get().convert(items);
+		m_metrics.for_each([&](const std::string& funcID, const metrics::Metrics& metrics) {
+			stats.emplace(funcID, metrics.stats());
+		});
 
-		if (items.size() != 2)
-			throw ClientError("malformed response buffer");
+		return stats;
+	}
+#endif
 
-		auto callID = items[0].as<uint32_t>();
-		std::function<void(const msgpack::object&, bool, std::exception_ptr&&)> wrapper;
+	/*
+	 * The completion callback (see `call()`) that fulfils `prom`: held in
+	 * the call's slot, no need to share it
+	 */
+	template <typename T>
+	static auto fulfil(std::promise<T>&& prom)
+	{
+		if constexpr (std::is_same_v<T, void>) {
+			return [prom = std::move(prom)](std::exception_ptr exp) mutable {
+				if (exp != nullptr)
+					prom.set_exception(exp);
+				else
+					prom.set_value();
+			};
+		} else {
+			return [prom = std::move(prom)](std::exception_ptr exp, T value) mutable {
+				if (exp != nullptr)
+					prom.set_exception(exp);
+				else
+					prom.set_value(std::move(value));
+			};
+		}
+	}
 
-		{
-			std::lock_guard lock(m_mutex);
-			auto it = m_respWaiters.find(callID);
+	/* the `Handler` that completes a call with the response converted to `R` */
+	template <typename R, typename Callback>
+	static auto resp_handler(Callback&& callback)
+	{
+		return [callback = std::forward<Callback>(callback)](const msgpack::object& obj, [[maybe_unused]] bool last, std::exception_ptr&& exp) mutable noexcept {
+			R resp{};
+
+			if (exp == nullptr) {
+				try {
+					obj.convert(resp);
+				} catch (...) {
+					exp = std::current_exception();
+				}
+			}
 
-			if (it == m_respWaiters.end())
-				throw ClientError("unexpected callID on return: " + std::to_string(callID));
+			callback(std::move(exp), std::move(resp));
+		};
+	}
 
-			if (last) {
-				wrapper = std::move(it->second);
-				m_respWaiters.erase(it);
-			} else {
-				wrapper = it->second;
+	/*
+	 * The key under which a `SingleFlight` call coalesces (see `coalesce()`):
+	 * for one that does above its `Client`s, as `TcpPoolClient` does
+	 */
+	template <typename FuncID, typename... Args>
+	static std::string flight_key(const FuncID& funcID, const Args&... args)
+	{
+		auto packed = pool::sbuffer();
+
+		pack_flight(packed, funcID, args...);
+		std::string key(packed.data(), packed.size());
+		pool::recycle(std::move(packed));
+		return key;
+	}
+
+private:
+	CallTable m_calls;
+	TimerWheel& m_timers;
+	const Framing m_framing;
+	std::atomic<bool> m_timed{false};
+
+#ifndef RPC_NO_METRICS
+	/* by hash, whether the calls are by name or by `FuncHash` */
+	DispatchTable<metrics::Metrics> m_metrics;
+
+	/* registered upon the function's first call */
+	template <typename FuncID>
+	const metrics::Metrics& metrics_of(const FuncID& funcID)
+	{
+		uint32_t hash;
+		std::string name;
+
+		if constexpr (std::is_same_v<FuncID, FuncHash>) {
+			hash = funcID.value();
+		} else if constexpr (std::is_convertible_v<const FuncID&, std::string_view>) {
+			hash = hash_func_id(funcID);
+		} else {
+			name = funcID;
+			hash = hash_func_id(name);
+		}
+
+		if (const auto* metrics = m_metrics.find(hash); metrics != nullptr)
+			return *metrics;
+
+		if constexpr (std::is_same_v<FuncID, FuncHash>)
+			name = "#" + std::to_string(hash);
+		else if constexpr (std::is_convertible_v<const FuncID&, std::string_view>)
+			name = std::string_view(funcID);
+
+		/* another thread may have just registered it */
+		m_metrics.insert(hash, name, metrics::Metrics());
+		return *m_metrics.find(hash);
+	}
+
+	template <typename FuncID>
+	const metrics::Metrics& metrics_of(const Deadline<FuncID>& funcID)
+	{
+		return metrics_of(funcID.func_id());
+	}
+
+	template <typename FuncID>
+	const metrics::Metrics& metrics_of(const SingleFlight<FuncID>& funcID)
+	{
+		return metrics_of(funcID.func_id());
+	}
+
+	/* by the hash and the name the stub has at hand */
+	template <typename Signature>
+	const metrics::Metrics& metrics_of(const Stub<Signature>& funcID)
+	{
+		uint32_t hash = funcID.hash().value();
+
+		if (const auto* metrics = m_metrics.find(hash); metrics != nullptr)
+			return *metrics;
+
+		m_metrics.insert(hash, funcID.name(), metrics::Metrics());
+		return *m_metrics.find(hash);
+	}
+#endif
+
+	FlightTable m_flights;
+
+	uint32_t claim()
+	{
+		uint32_t callID;
+
+		if (!m_calls.claim(callID))
+			throw ClientError("too many calls in flight");
+
+		return callID;
+	}
+
+	/* of a frame as sent, past the header of the framing */
+	size_t frame_size(const msgpack::sbuffer& buffer) const noexcept
+	{
+		return m_framing.body_size(buffer);
+	}
+
+	size_t frame_size(const IoBuffer& buffer) const noexcept
+	{
+		return buffer.size();
+	}
+
+	/* the call of a claimed slot */
+	template <typename FuncID, typename... Args>
+	auto serialize(uint32_t callID, const FuncID& funcID, Args&&... args)
+	{
+		try {
+			auto buffer = serialize_call(m_framing, callID, funcID, std::forward<Args>(args)...);
+
+#ifndef RPC_NO_METRICS
+			m_calls.track(callID, metrics_of(funcID), frame_size(buffer));
+#endif
+			return buffer;
+		} catch (...) {
+			m_calls.release(callID);
+			throw;
+		}
+	}
+
+	template <typename R, typename FuncID, typename Callback>
+	void expect_resp(uint32_t callID, [[maybe_unused]] const FuncID& funcID, Callback&& callback)
+	{
+		if constexpr (std::is_same_v<R, void>) {
+			/* no return value, do not wait */
+			m_calls.release(callID);
+			callback(nullptr);
+		} else {
+			arm(callID, funcID, resp_handler<R>(std::forward<Callback>(callback)));
+		}
+	}
+
+	/* the hash of the function, then the arguments */
+	template <typename FuncID, typename... Args>
+	static void pack_flight(msgpack::sbuffer& packed, const FuncID& funcID, const Args&... args)
+	{
+		msgpack::packer<msgpack::sbuffer> packer(packed);
+
+		if constexpr (std::is_same_v<FuncID, FuncHash>)
+			packer.pack_fix_uint32(funcID.value());
+		else
+			packer.pack_fix_uint32(hash_func_id(funcID));
+
+		(packer.pack(args), ...);
+	}
+
+	/*
+	 * A call of `SingleFlight`: it joins an identical one in flight, if any,
+	 * and is not made. The key is the hash of the function (so that calls by
+	 * name and by `FuncHash` coalesce) and the arguments, packed once: the
+	 * call that is made is its head and those very bytes.
+	 */
+	template <typename R, typename Callback, typename FuncID, typename... Args>
+	auto coalesce(Callback&& callback, const FuncID& funcID, Args&&... args)
+	{
+		if constexpr (std::is_same_v<R, void>) {
+			/* no response to share */
+			return call<R>(std::forward<Callback>(callback), funcID, std::forward<Args>(args)...);
+		} else {
+			/* the hash always takes the same 5 bytes */
+			constexpr size_t hash_size = 5;
+
+			auto packed = pool::sbuffer();
+			pack_flight(packed, funcID, args...);
+
+			std::string key(packed.data(), packed.size());
+			auto handler = resp_handler<R>(std::forward<Callback>(callback));
+			uint32_t claimed = claim();
+			uint32_t callID = claimed;
+			bool joined;
+
+			try {
+				joined = m_flights.join(key, callID, std::move(handler));
+			} catch (...) {
+				m_calls.release(claimed);
+				throw;
 			}
+
+			if (joined) {
+				m_calls.release(claimed);
+				pool::recycle(std::move(packed));
+				return std::make_tuple(msgpack::sbuffer(0), callID);
+			}
+
+			/* those that joined meanwhile fail along */
+			auto fail = [&](std::exception_ptr exp) noexcept {
+				for (auto& follower : m_flights.land(key))
+					follower(msgpack::object(), true, std::exception_ptr(exp));
+			};
+
+			auto buffer = m_framing.buffer();
+
+			try {
+				msgpack::packer<msgpack::sbuffer> head(buffer);
+
+				pack_call_head(head, callID, funcID, sizeof...(Args));
+				buffer.write(packed.data() + hash_size, packed.size() - hash_size);
+#ifndef RPC_NO_METRICS
+				m_calls.track(callID, metrics_of(funcID), frame_size(buffer));
+#endif
+			} catch (...) {
+				fail(std::current_exception());
+				m_calls.release(callID);
+				throw;
+			}
+
+			pool::recycle(std::move(packed));
+
+			try {
+				m_calls.arm(callID, [this, key, handler = std::move(handler)](const msgpack::object& obj, bool last, std::exception_ptr&& exp) mutable noexcept {
+					for (auto& follower : m_flights.land(key))
+						follower(obj, last, std::exception_ptr(exp));
+
+					handler(obj, last, std::move(exp));
+				});
+			} catch (...) {
+				/* the slot is released */
+				fail(std::current_exception());
+				throw;
+			}
+
+			return std::make_tuple(std::move(buffer), callID);
+		}
+	}
+
+	/*
+	 * The call waits for `handler`. One with a deadline is cancelled once it
+	 * expires, and its timer goes as soon as it completes, whichever way.
+	 */
+	template <typename FuncID, typename F>
+	void arm(uint32_t callID, [[maybe_unused]] const FuncID& funcID, F&& handler)
+	{
+		if constexpr (is_deadline_v<FuncID>) {
+			TimerWheel::Handle timer;
+
+			m_timed = true;
+
+			try {
+				timer = m_timers.schedule(funcID.expiry(), this, callID, [](void* client, uint32_t callID) noexcept {
+					static_cast<Client*>(client)->cancel(callID, DeadlineExceeded());
+				});
+			} catch (...) {
+				/* cannot be timed: fail it rather than let it wait forever */
+				auto exp = std::current_exception();
+
+				m_calls.arm(callID, std::forward<F>(handler));
+				cancel(callID, std::move(exp));
+				return;
+			}
+
+			try {
+				m_calls.arm(callID, [this, timer, handler = std::forward<F>(handler)](const msgpack::object& obj, bool last, std::exception_ptr&& exp) mutable noexcept {
+					if (last)
+						m_timers.cancel(timer);
+
+					handler(obj, last, std::move(exp));
+				});
+			} catch (...) {
+				m_timers.cancel(timer);
+				throw;
+			}
+
+			/* the timer finds the call not armed yet if it is due that soon */
+			if (deadline::Clock::now() >= funcID.expiry())
+				cancel(callID, DeadlineExceeded());
+		} else {
+			m_calls.arm(callID, std::forward<F>(handler));
 		}
+	}
+
+	/* `bytes`: of the response on the wire */
+	uint32_t ingest_one(const msgpack::object& resp, bool last, size_t bytes)
+	{
+		/* [callID, value]  or a stream chunk: [callID, chunk | nil, last] */
+		if ((resp.type != msgpack::type::ARRAY) || (resp.via.array.size < 2) || (resp.via.array.size > 3))
+			throw ClientError("malformed response buffer");
+
+		auto callID = resp.via.array.ptr[0].as<uint32_t>();
+
+		if (resp.via.array.size == 3)
+			last = resp.via.array.ptr[2].as<bool>();
+
+		if (!m_calls.deliver(callID, last, resp.via.array.ptr[1], nullptr, bytes))
+			throw ClientError("unexpected callID on return: " + std::to_string(callID));
 
-		wrapper(items[1], last, nullptr);
+		return callID;
 	}
 
-private:
-	std::atomic<uint32_t> m_callID{static_cast<uint32_t>(std::time(nullptr))};
-	std::unordered_map<uint32_t, std::function<void(const msgpack::object&, bool, std::exception_ptr&&)>> m_respWaiters;
-	std::mutex m_mutex;
+	static bool reference_payload(msgpack::type::object_type, std::size_t, void*) noexcept
+	{
+		return true;
+	}
 };
 
 }
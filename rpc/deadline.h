@@ -0,0 +1,125 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Call deadlines: the remaining time budget travels with the call
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "func_hash.h"
+
+#include "msgpack.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+
+namespace rpc {
+
+namespace deadline {
+
+using Clock = std::chrono::steady_clock;
+
+/*
+ * A call with a deadline starts with `ext(ext_type, [callID][budget])`
+ * rather than the callID, both 32-bit big-endian, the budget in µs
+ * (up to about 71 minutes) as of when the call is serialized. The clocks
+ * of the two sides need not agree: the server counts the budget from
+ * when it receives the call.
+ */
+constexpr int8_t ext_type = 1;
+constexpr uint32_t ext_size = 8;
+
+template <typename Stream>
+void pack_id(msgpack::packer<Stream>& packer, uint32_t callID, Clock::time_point expiry)
+{
+	auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(expiry - Clock::now()).count();
+	uint32_t budget = (remaining <= 0) ? 0 : (remaining >= UINT32_MAX) ? UINT32_MAX : static_cast<uint32_t>(remaining);
+
+	char body[ext_size];
+
+	for (int i = 0; i < 4; ++i) {
+		body[i] = static_cast<char>(callID >> (24 - 8 * i));
+		body[4 + i] = static_cast<char>(budget >> (24 - 8 * i));
+	}
+
+	packer.pack_ext(ext_size, ext_type);
+	packer.pack_ext_body(body, ext_size);
+}
+
+/* the callID of a call; `true` if it comes with a budget (in µs) */
+inline bool unpack_id(const msgpack::object& obj, uint32_t& callID, uint32_t& budget)
+{
+	if ((obj.type != msgpack::type::EXT) || (obj.via.ext.type() != ext_type) || (obj.via.ext.size != ext_size)) {
+		callID = obj.as<uint32_t>();
+		return false;
+	}
+
+	auto body = reinterpret_cast<const uint8_t*>(obj.via.ext.data());
+
+	callID = (uint32_t(body[0]) << 24) | (uint32_t(body[1]) << 16) | (uint32_t(body[2]) << 8) | body[3];
+	budget = (uint32_t(body[4]) << 24) | (uint32_t(body[5]) << 16) | (uint32_t(body[6]) << 8) | body[7];
+	return true;
+}
+
+}
+
+
+/*
+ * A funcID (the name or its `FuncHash`) that comes with a deadline:
+ *
+ *   client.call<int>(rpc::with_deadline("get", 50ms), key);
+ *
+ * Taken wherever a funcID is. The client fails the call with `DeadlineExceeded`
+ * once it expires (see `TimerWheel`), and the server skips calling the
+ * function if the call expires before it gets to it.
+ */
+template <typename FuncID>
+class Deadline {
+public:
+	Deadline(const FuncID& funcID, deadline::Clock::time_point expiry)
+		: m_funcID(funcID)
+		, m_expiry(expiry)
+	{ }
+
+	const FuncID& func_id() const noexcept
+	{
+		return m_funcID;
+	}
+
+	deadline::Clock::time_point expiry() const noexcept
+	{
+		return m_expiry;
+	}
+
+private:
+	FuncID m_funcID;
+	deadline::Clock::time_point m_expiry;
+};
+
+template <typename T>
+inline constexpr bool is_deadline_v = false;
+
+template <typename FuncID>
+inline constexpr bool is_deadline_v<Deadline<FuncID>> = true;
+
+/* e.g. one that the call being served has left, passed on to a nested call */
+template <typename FuncID>
+auto with_deadline(const FuncID& funcID, deadline::Clock::time_point expiry)
+{
+	if constexpr (std::is_same_v<FuncID, FuncHash>)
+		return Deadline<FuncHash>(funcID, expiry);
+	else
+		return Deadline<std::string>(funcID, expiry);
+}
+
+template <typename FuncID, typename Rep, typename Period>
+auto with_deadline(const FuncID& funcID, std::chrono::duration<Rep, Period> budget)
+{
+	return with_deadline(funcID, deadline::Clock::now() + std::chrono::duration_cast<deadline::Clock::duration>(budget));
+}
+
+}
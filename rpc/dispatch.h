@@ -0,0 +1,384 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Lock-free (for readers) function dispatch table
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "func_hash.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace rpc {
+
+/*
+ * Open-addressing table keyed by the function hash.
+ *
+ * Readers never lock: they load the current immutable snapshot, counted
+ * (in a stripe of counters of their own) in the current epoch while they
+ * look it up, or while they hold what `pin()` found. Writers (`insert()` /
+ * `erase()`) are serialized, build a new snapshot, and publish it with a
+ * single atomic exchange. The old one is retired in the current epoch:
+ * the writers start the next epoch once the readers of the previous one
+ * are gone, and free a retired snapshot once no reader counted in its
+ * epoch (or before) is left. They do not wait for that: a snapshot a
+ * long call holds on to is freed by a writer that comes after.
+ *
+ * The values are shared among the snapshots: an erased one goes with the
+ * last snapshot that has it. `find()` does not count while the value is
+ * used, for one never erased; `pin()` does.
+ */
+template <typename T>
+class DispatchTable {
+public:
+	enum class Status {
+		Inserted,
+		Exists,		/* the same funcID is already bound */
+		Collision,	/* a different funcID has the same hash */
+	};
+
+	DispatchTable()
+	{
+		publish(std::make_unique<Snapshot>(0));
+	}
+
+	DispatchTable(const DispatchTable&) = delete;
+	DispatchTable& operator=(const DispatchTable&) = delete;
+
+	~DispatchTable()
+	{
+		delete m_current.load(std::memory_order_relaxed);
+	}
+
+	/* a value `pin()` found: not freed while it is held, even if erased meanwhile */
+	class Pinned {
+	public:
+		Pinned() = default;
+
+		Pinned(Pinned&& other) noexcept
+			: m_value(other.m_value)
+			, m_count(std::exchange(other.m_count, nullptr))
+		{ }
+
+		Pinned& operator=(Pinned&& other) noexcept
+		{
+			if (this != &other) {
+				release();
+				m_value = other.m_value;
+				m_count = std::exchange(other.m_count, nullptr);
+			}
+
+			return *this;
+		}
+
+		~Pinned()
+		{
+			release();
+		}
+
+		const T* get() const noexcept
+		{
+			return m_value;
+		}
+
+		const T& operator*() const noexcept
+		{
+			return *m_value;
+		}
+
+		const T* operator->() const noexcept
+		{
+			return m_value;
+		}
+
+		explicit operator bool() const noexcept
+		{
+			return (m_value != nullptr);
+		}
+
+	private:
+		friend class DispatchTable;
+
+		const T* m_value = nullptr;
+		std::atomic<size_t>* m_count = nullptr;
+
+		void release() noexcept
+		{
+			if (m_count != nullptr)
+				m_count->fetch_sub(1, std::memory_order_release);
+
+			m_count = nullptr;
+		}
+	};
+
+	const T* find(uint32_t hash) const noexcept
+	{
+		return read([&](const Snapshot& snapshot) {
+			return find_in(snapshot, hash);
+		});
+	}
+
+	const T* find(std::string_view funcID) const noexcept
+	{
+		return read([&](const Snapshot& snapshot) {
+			return find_in(snapshot, funcID);
+		});
+	}
+
+	/* `find()`, for a value that may be erased while it is used, e.g. a method being called */
+	Pinned pin(uint32_t hash) const noexcept
+	{
+		Pinned pinned;
+
+		pinned.m_count = &enter();
+		pinned.m_value = find_in(*m_current.load(std::memory_order_seq_cst), hash);
+		return pinned;
+	}
+
+	Pinned pin(std::string_view funcID) const noexcept
+	{
+		Pinned pinned;
+
+		pinned.m_count = &enter();
+		pinned.m_value = find_in(*m_current.load(std::memory_order_seq_cst), funcID);
+		return pinned;
+	}
+
+	Status insert(const std::string& funcID, T&& value)
+	{
+		return insert(hash_func_id(funcID), funcID, std::move(value));
+	}
+
+	/* under `hash` rather than that of `funcID`, e.g. when only the hash is known */
+	Status insert(uint32_t hash, const std::string& funcID, T&& value)
+	{
+		std::lock_guard lock(m_mutex);
+
+		const Snapshot* current = m_current.load(std::memory_order_relaxed);
+
+		if (const Slot* slot = current->find(hash); slot != nullptr)
+			return (slot->funcID == funcID) ? Status::Exists : Status::Collision;
+
+		auto snapshot = std::make_unique<Snapshot>(current->count + 1);
+
+		for (const auto& slot : current->slots) {
+			if (slot.value)
+				snapshot->add(slot);
+		}
+
+		snapshot->add({hash, funcID, std::make_shared<const T>(std::move(value))});
+		publish(std::move(snapshot));
+
+		return Status::Inserted;
+	}
+
+	bool erase(const std::string& funcID)
+	{
+		std::lock_guard lock(m_mutex);
+
+		const Snapshot* current = m_current.load(std::memory_order_relaxed);
+		const Slot* victim = current->find(hash_func_id(funcID));
+
+		if ((victim == nullptr) || (victim->funcID != funcID))
+			return false;
+
+		auto snapshot = std::make_unique<Snapshot>(current->count - 1);
+
+		for (const auto& slot : current->slots) {
+			if (slot.value && (&slot != victim))
+				snapshot->add(slot);
+		}
+
+		publish(std::move(snapshot));
+		return true;
+	}
+
+	/* `func(funcID, value)` for each entry of the current snapshot, in no particular order */
+	template <typename Func>
+	void for_each(Func&& func) const
+	{
+		read([&](const Snapshot& snapshot) {
+			for (const auto& slot : snapshot.slots) {
+				if (slot.value)
+					func(slot.funcID, *slot.value);
+			}
+		});
+	}
+
+private:
+	struct Slot {
+		uint32_t hash;
+		std::string funcID;
+		std::shared_ptr<const T> value;	/* shared among snapshots */
+	};
+
+	struct Snapshot {
+		std::vector<Slot> slots;
+		size_t mask;
+		size_t count = 0;
+
+		explicit Snapshot(size_t capacity)
+		{
+			/* keep the load factor at or below 1/2 */
+			size_t size = 8;
+
+			while (size < capacity * 2)
+				size <<= 1;
+
+			slots.resize(size);
+			mask = size - 1;
+		}
+
+		const Slot* find(uint32_t hash) const noexcept
+		{
+			for (size_t i = hash & mask; slots[i].value; i = (i + 1) & mask) {
+				if (slots[i].hash == hash)
+					return &slots[i];
+			}
+
+			return nullptr;
+		}
+
+		void add(const Slot& slot)
+		{
+			size_t i = slot.hash & mask;
+
+			while (slots[i].value)
+				i = (i + 1) & mask;
+
+			slots[i] = slot;
+			++count;
+		}
+	};
+
+	/* a cache line each: readers of different threads mostly count apart */
+	struct alignas(64) Readers {
+		std::atomic<size_t> count{0};
+	};
+
+	static constexpr size_t reader_stripes = 16;
+
+	std::atomic<const Snapshot*> m_current{nullptr};
+
+	/* by the parity of the epoch they started in */
+	mutable std::array<std::array<Readers, reader_stripes>, 2> m_readers;
+	std::atomic<size_t> m_epoch{0};
+
+	/* by the writers: the snapshots replaced, by the epoch they were replaced in */
+	std::vector<std::pair<size_t, std::unique_ptr<const Snapshot>>> m_retired;
+	std::mutex m_mutex;
+
+	static const T* find_in(const Snapshot& snapshot, uint32_t hash) noexcept
+	{
+		const Slot* slot = snapshot.find(hash);
+
+		return (slot != nullptr) ? slot->value.get() : nullptr;
+	}
+
+	static const T* find_in(const Snapshot& snapshot, std::string_view funcID) noexcept
+	{
+		const Slot* slot = snapshot.find(hash_func_id(funcID));
+
+		if ((slot == nullptr) || (slot->funcID != funcID))
+			return nullptr;
+
+		return slot->value.get();
+	}
+
+	/*
+	 * Counted as a reader, before the snapshot is loaded, in an epoch that
+	 * has not ended yet: the counter to let go of
+	 */
+	std::atomic<size_t>& enter() const noexcept
+	{
+		size_t stripe = reader_stripe();
+
+		while (true) {
+			size_t epoch = m_epoch.load(std::memory_order_seq_cst);
+			auto& count = m_readers[epoch & 1][stripe].count;
+
+			count.fetch_add(1, std::memory_order_seq_cst);
+
+			if (m_epoch.load(std::memory_order_seq_cst) == epoch)
+				return count;
+
+			count.fetch_sub(1, std::memory_order_release);
+		}
+	}
+
+	/* `func(snapshot)`, the snapshot not to be freed meanwhile */
+	template <typename Func>
+	decltype(auto) read(Func&& func) const
+	{
+		struct Reading {
+			std::atomic<size_t>& count;
+
+			~Reading()
+			{
+				count.fetch_sub(1, std::memory_order_release);
+			}
+		} reading{enter()};
+
+		return func(*m_current.load(std::memory_order_seq_cst));
+	}
+
+	static size_t reader_stripe() noexcept
+	{
+		static std::atomic<size_t> next{0};
+		thread_local size_t stripe = next.fetch_add(1, std::memory_order_relaxed) % reader_stripes;
+
+		return stripe;
+	}
+
+	/* writer lock held (or constructing) */
+	void publish(std::unique_ptr<Snapshot>&& snapshot)
+	{
+		std::unique_ptr<const Snapshot> retired(m_current.exchange(snapshot.release(), std::memory_order_seq_cst));
+
+		if (!retired)
+			return;
+
+		/* a reader that may still have it counts in this epoch, or in the one before */
+		m_retired.emplace_back(m_epoch.load(std::memory_order_seq_cst), std::move(retired));
+		reclaim();
+	}
+
+	bool drained(size_t parity) const noexcept
+	{
+		for (const auto& readers : m_readers[parity]) {
+			if (readers.count.load(std::memory_order_seq_cst) != 0)
+				return false;
+		}
+
+		return true;
+	}
+
+	/*
+	 * Writer lock held. The next epoch starts once the readers of the one
+	 * before the current are gone (they count the same way), so that readers
+	 * are only ever counted in the current epoch and the previous one.
+	 */
+	void reclaim() noexcept
+	{
+		size_t epoch = m_epoch.load(std::memory_order_seq_cst);
+
+		if (drained((epoch + 1) & 1))
+			epoch = m_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+
+		m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(), [&](const auto& retired) {
+			return (retired.first + 2 <= epoch) || ((retired.first + 1 == epoch) && drained(retired.first & 1));
+		}), m_retired.end());
+	}
+};
+
+}
@@ -0,0 +1,64 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Frames packed behind room for the transport's header
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "pool.h"
+
+#include "msgpack.hpp"
+
+#include <cstddef>
+
+
+namespace rpc {
+
+/*
+ * How a transport frames what it sends: `header` bytes of its own (e.g. the
+ * length of the frame) in front of each one. A `Client` or `Server` made
+ * with its framing packs each frame it produces behind room for the header:
+ * the transport back-patches it once the frame is complete, and sends the
+ * frame as it is, in one piece, from the buffer it was packed into.
+ *
+ * Frames with view arguments (see `IoBuffer`) go in segments anyway, and are
+ * not framed. The frames a `Client` or `Server` is handed are without the
+ * header, whatever the framing.
+ */
+struct Framing {
+	static constexpr size_t max_header = 16;
+
+	size_t header = 0;
+
+	/* from the buffer pool, the header reserved */
+	msgpack::sbuffer buffer() const
+	{
+		auto buffer = pool::sbuffer();
+
+		reserve(buffer);
+		return buffer;
+	}
+
+	void reserve(msgpack::sbuffer& buffer) const
+	{
+		static const char room[max_header] = {};
+
+		buffer.write(room, header);
+	}
+
+	/* what the frame is past the header */
+	const char* body(const msgpack::sbuffer& buffer) const noexcept
+	{
+		return buffer.data() + header;
+	}
+
+	/* 0 for no frame at all, e.g. no response */
+	size_t body_size(const msgpack::sbuffer& buffer) const noexcept
+	{
+		return (buffer.size() > header) ? (buffer.size() - header) : 0;
+	}
+};
+
+}
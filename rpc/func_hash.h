@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Compact numeric function identifiers
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+
+namespace rpc {
+
+/*
+ * 32-bit FNV-1a hash of the function name.
+ * Evaluated at compile time for literal names.
+ */
+constexpr uint32_t hash_func_id(std::string_view funcID) noexcept
+{
+	uint32_t hash = 2166136261u;
+
+	for (char c : funcID) {
+		hash ^= static_cast<uint8_t>(c);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+
+/*
+ * Numeric function ID, as assigned by `Server::bind()`.
+ * Calling by hash saves the server from string handling on dispatch.
+ */
+class FuncHash {
+public:
+	constexpr explicit FuncHash(std::string_view funcID) noexcept
+		: m_value(hash_func_id(funcID))
+	{ }
+
+	constexpr explicit FuncHash(uint32_t value) noexcept
+		: m_value(value)
+	{ }
+
+	constexpr uint32_t value() const noexcept
+	{
+		return m_value;
+	}
+
+	constexpr bool operator==(const FuncHash& other) const noexcept
+	{
+		return m_value == other.m_value;
+	}
+
+	constexpr bool operator!=(const FuncHash& other) const noexcept
+	{
+		return m_value != other.m_value;
+	}
+
+private:
+	uint32_t m_value;
+};
+
+/* the built-in function of `Server` that returns `true`, whatever the build: is it there */
+inline constexpr char ping_func_id[] = "__ping";
+
+}
@@ -0,0 +1,209 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Scatter-gather frames: large view arguments are sent from where they are
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "pool.h"
+
+#include "msgpack.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+
+namespace rpc {
+
+/*
+ * Bytes of the caller's, packed as msgpack `bin`: what `msgpack::type::raw_ref`
+ * is to `str`. On the server side, it refers to the payload in the request
+ * (same as `std::string_view`), valid for the duration of the call.
+ */
+struct BinRef {
+	const char* ptr = nullptr;
+	size_t size = 0;
+
+	BinRef() = default;
+
+	BinRef(const void* ptr, size_t size) noexcept
+		: ptr(static_cast<const char*>(ptr))
+		, size(size)
+	{ }
+
+	/* of a contiguous container of bytes, e.g. `std::vector<char>` */
+	template <typename Container, typename = decltype(std::declval<const Container&>().data())>
+	explicit BinRef(const Container& bytes) noexcept
+		: BinRef(bytes.data(), bytes.size() * sizeof(*bytes.data()))
+	{ }
+};
+
+/*
+ * Arguments whose payload a call refers to rather than copies (see `IoBuffer`):
+ * the caller keeps it valid until the call is sent
+ */
+template <typename T>
+inline constexpr bool is_view_v = std::is_same_v<T, std::string_view> ||
+				  std::is_same_v<T, msgpack::type::raw_ref> ||
+				  std::is_same_v<T, BinRef>;
+
+template <typename... Args>
+inline constexpr bool has_views_v = (is_view_v<std::decay_t<Args>> || ...);
+
+
+/*
+ * A frame in segments. Whatever is packed into it is copied into a pooled
+ * buffer of its own, except for what is `reference()`d: the payloads of view
+ * arguments, from `ref_min` bytes up (smaller ones are cheaper to copy than
+ * to send from elsewhere). A transport sends the segments with vectored I/O,
+ * or gathers them wherever it copies the frame anyway.
+ */
+class IoBuffer {
+public:
+	static constexpr size_t ref_min = 512;
+
+	IoBuffer()
+		: m_own(pool::sbuffer())
+	{ }
+
+	/* a msgpack stream: copied */
+	void write(const char* data, size_t size)
+	{
+		m_own.write(data, size);
+		m_size += size;
+
+		if (!m_segments.empty() && (m_segments.back().ptr == nullptr))
+			m_segments.back().size += size;
+		else
+			m_segments.push_back({nullptr, m_own.size() - size, size});
+	}
+
+	/* not copied: `data` stays valid until the frame is sent */
+	void reference(const char* data, size_t size)
+	{
+		if (size < ref_min) {
+			write(data, size);
+			return;
+		}
+
+		m_segments.push_back({data, 0, size});
+		m_size += size;
+	}
+
+	size_t size() const noexcept
+	{
+		return m_size;
+	}
+
+	size_t count() const noexcept
+	{
+		return m_segments.size();
+	}
+
+	/* `func(const char* data, size_t size)` for each segment, in order */
+	template <typename Func>
+	void for_each(Func&& func) const
+	{
+		for (const auto& segment : m_segments)
+			func((segment.ptr != nullptr) ? segment.ptr : (m_own.data() + segment.offset), segment.size);
+	}
+
+	/* all in one, e.g. for a transport that needs the frame contiguous */
+	msgpack::sbuffer gather() const
+	{
+		auto buffer = pool::sbuffer();
+
+		for_each([&](const char* data, size_t size) {
+			buffer.write(data, size);
+		});
+
+		return buffer;
+	}
+
+	/* the buffer of its own back to the pool, see `pool::recycle()` */
+	void recycle() noexcept
+	{
+		pool::recycle(std::move(m_own));
+		m_segments.clear();
+		m_size = 0;
+	}
+
+private:
+	struct Segment {
+		const char* ptr;	/* nullptr: at `offset` of the buffer of its own */
+		size_t offset;
+		size_t size;
+	};
+
+	msgpack::sbuffer m_own;
+	std::vector<Segment> m_segments;
+	size_t m_size = 0;
+};
+
+
+/*
+ * Either kind of frame a client produces (`IoBuffer` for calls with view
+ * arguments, `msgpack::sbuffer` otherwise), segment by segment
+ */
+template <typename Func>
+void for_each_segment(const msgpack::sbuffer& buffer, Func&& func)
+{
+	func(buffer.data(), buffer.size());
+}
+
+template <typename Func>
+void for_each_segment(const IoBuffer& buffer, Func&& func)
+{
+	buffer.for_each(std::forward<Func>(func));
+}
+
+namespace pool {
+
+inline void recycle(IoBuffer&& buffer) noexcept
+{
+	buffer.recycle();
+}
+
+}
+
+}
+
+
+namespace msgpack {
+MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
+namespace adaptor {
+
+template <>
+struct pack<rpc::BinRef> {
+	template <typename Stream>
+	packer<Stream>& operator()(packer<Stream>& o, const rpc::BinRef& v) const
+	{
+		o.pack_bin(static_cast<uint32_t>(v.size));
+		o.pack_bin_body(v.ptr, static_cast<uint32_t>(v.size));
+		return o;
+	}
+};
+
+template <>
+struct convert<rpc::BinRef> {
+	const msgpack::object& operator()(const msgpack::object& o, rpc::BinRef& v) const
+	{
+		if (o.type == msgpack::type::BIN)
+			v = rpc::BinRef(o.via.bin.ptr, o.via.bin.size);
+		else if (o.type == msgpack::type::STR)
+			v = rpc::BinRef(o.via.str.ptr, o.via.str.size);
+		else
+			throw msgpack::type_error();
+
+		return o;
+	}
+};
+
+}
+}
+}
@@ -0,0 +1,326 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Per-method call metrics: counts, bytes, in-flight gauge and latency histogram
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "msgpack.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+
+
+namespace rpc {
+
+/*
+ * What `Server::stats()` and `Client::stats()` return, per method
+ * (and what the `__stats` built-in responds with). Latencies are in ns,
+ * within the width of a histogram bucket (see `metrics::bucket_of()`).
+ */
+struct MethodStats {
+	uint64_t calls = 0;		/* completed */
+	uint64_t errors = 0;		/* of them, failed */
+	uint64_t expired = 0;		/* not called: past the deadline (see `Deadline`) */
+	int64_t inFlight = 0;
+	uint64_t bytesIn = 0;
+	uint64_t bytesOut = 0;
+
+	uint64_t latencyMean = 0;
+	uint64_t latencyP50 = 0;
+	uint64_t latencyP90 = 0;
+	uint64_t latencyP99 = 0;
+	uint64_t latencyP999 = 0;
+	uint64_t latencyMax = 0;
+};
+
+using Stats = std::map<std::string, MethodStats>;
+
+/* the built-in function of `Server` that returns its `Stats` */
+inline constexpr char stats_func_id[] = "__stats";
+
+}
+
+
+namespace rpc::metrics {
+
+/*
+ * Log-linear (HDR-style) buckets: each power of 2 is split into 2^sub_bits
+ * buckets, i.e. a bucket is within 1/8 of its value. Latencies from 2^40 ns
+ * (18 minutes) up land in the last one.
+ */
+constexpr unsigned sub_bits = 3;
+constexpr unsigned max_exponent = 40;
+constexpr size_t buckets = size_t(max_exponent - sub_bits + 1) << sub_bits;
+
+constexpr size_t bucket_of(uint64_t value) noexcept
+{
+	if (value < (uint64_t(1) << sub_bits))
+		return value;
+
+	unsigned exponent = 63 - __builtin_clzll(value);
+
+	if (exponent >= max_exponent)
+		return buckets - 1;
+
+	return (size_t(exponent - sub_bits + 1) << sub_bits) + ((value >> (exponent - sub_bits)) & ((1 << sub_bits) - 1));
+}
+
+/* the lowest value of a bucket */
+constexpr uint64_t bucket_floor(size_t index) noexcept
+{
+	if (index < (size_t(1) << sub_bits))
+		return index;
+
+	unsigned exponent = (index >> sub_bits) + sub_bits - 1;
+	uint64_t sub = index & ((1 << sub_bits) - 1);
+
+	return (uint64_t(1) << exponent) | (sub << (exponent - sub_bits));
+}
+
+/* the highest value of the bucket the `permille`-th of `count` values is in */
+inline uint64_t percentile(const uint64_t* histogram, uint64_t count, uint64_t permille, uint64_t max) noexcept
+{
+	uint64_t rank = (count * permille + 999) / 1000;
+	uint64_t seen = 0;
+
+	for (size_t b = 0; b < buckets; ++b) {
+		seen += histogram[b];
+
+		if (seen >= rank)
+			return (b + 1 < buckets) ? std::min(bucket_floor(b + 1) - 1, max) : max;
+	}
+
+	return max;
+}
+
+}
+
+
+#ifndef RPC_NO_METRICS
+
+namespace rpc::metrics {
+
+/*
+ * Threads record into one of a few shards (a thread always into the same
+ * one), each on cache lines of its own, so that threads rarely write to
+ * the same line. Reading sums them up.
+ */
+constexpr size_t shards = 8;
+
+inline size_t shard_index() noexcept
+{
+	static std::atomic<size_t> next{0};
+	static thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed) % shards;
+
+	return index;
+}
+
+using Clock = std::chrono::steady_clock;
+
+inline uint64_t elapsed_ns(Clock::time_point since) noexcept
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count();
+}
+
+
+/*
+ * The metrics of a method. Recording is a handful of relaxed atomic
+ * additions to the thread's shard.
+ */
+class Metrics {
+public:
+	Metrics()
+		:m_shards(new Shard[shards])
+	{ }
+
+	void start() const noexcept
+	{
+		m_shards[shard_index()].inFlight.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/* a call that `start()`ed: the thread may be another */
+	void finish(uint64_t latency, bool failed, uint64_t bytesIn, uint64_t bytesOut) const noexcept
+	{
+		auto& shard = m_shards[shard_index()];
+
+		shard.inFlight.fetch_sub(1, std::memory_order_relaxed);
+		shard.calls.fetch_add(1, std::memory_order_relaxed);
+		shard.bytesIn.fetch_add(bytesIn, std::memory_order_relaxed);
+		shard.bytesOut.fetch_add(bytesOut, std::memory_order_relaxed);
+		shard.latencySum.fetch_add(latency, std::memory_order_relaxed);
+		shard.latency[bucket_of(latency)].fetch_add(1, std::memory_order_relaxed);
+
+		if (failed)
+			shard.errors.fetch_add(1, std::memory_order_relaxed);
+
+		auto max = shard.latencyMax.load(std::memory_order_relaxed);
+
+		while ((latency > max) && !shard.latencyMax.compare_exchange_weak(max, latency, std::memory_order_relaxed))
+			;
+	}
+
+	/* a call that was not made, see `MethodStats::expired` */
+	void expire() const noexcept
+	{
+		m_shards[shard_index()].expired.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/* a moment's view: the shards are read one by one, as they are recorded to */
+	MethodStats stats() const noexcept
+	{
+		MethodStats stats;
+		uint64_t latencySum = 0;
+		uint64_t histogram[buckets] = {};
+
+		for (size_t i = 0; i < shards; ++i) {
+			const auto& shard = m_shards[i];
+
+			stats.calls += shard.calls.load(std::memory_order_relaxed);
+			stats.errors += shard.errors.load(std::memory_order_relaxed);
+			stats.expired += shard.expired.load(std::memory_order_relaxed);
+			stats.inFlight += shard.inFlight.load(std::memory_order_relaxed);
+			stats.bytesIn += shard.bytesIn.load(std::memory_order_relaxed);
+			stats.bytesOut += shard.bytesOut.load(std::memory_order_relaxed);
+			latencySum += shard.latencySum.load(std::memory_order_relaxed);
+			stats.latencyMax = std::max(stats.latencyMax, shard.latencyMax.load(std::memory_order_relaxed));
+
+			for (size_t b = 0; b < buckets; ++b)
+				histogram[b] += shard.latency[b].load(std::memory_order_relaxed);
+		}
+
+		uint64_t count = 0;
+
+		for (size_t b = 0; b < buckets; ++b)
+			count += histogram[b];
+
+		if (count == 0)
+			return stats;
+
+		stats.latencyMean = latencySum / count;
+		stats.latencyP50 = percentile(histogram, count, 500, stats.latencyMax);
+		stats.latencyP90 = percentile(histogram, count, 900, stats.latencyMax);
+		stats.latencyP99 = percentile(histogram, count, 990, stats.latencyMax);
+		stats.latencyP999 = percentile(histogram, count, 999, stats.latencyMax);
+		return stats;
+	}
+
+private:
+	struct alignas(64) Shard {
+		std::atomic<uint64_t> calls{0};
+		std::atomic<uint64_t> errors{0};
+		std::atomic<uint64_t> expired{0};
+		std::atomic<int64_t> inFlight{0};
+		std::atomic<uint64_t> bytesIn{0};
+		std::atomic<uint64_t> bytesOut{0};
+		std::atomic<uint64_t> latencySum{0};
+		std::atomic<uint64_t> latencyMax{0};
+		std::atomic<uint64_t> latency[buckets] = {};
+	};
+
+	std::unique_ptr<Shard[]> m_shards;
+};
+
+}
+
+#endif
+
+
+namespace msgpack {
+MSGPACK_API_VERSION_NAMESPACE(MSGPACK_DEFAULT_API_NS) {
+namespace adaptor {
+
+/* a map, by field name: readable by any msgpack client */
+template <>
+struct pack<rpc::MethodStats> {
+	template <typename Stream>
+	packer<Stream>& operator()(packer<Stream>& o, const rpc::MethodStats& v) const
+	{
+		o.pack_map(12);
+		o.pack("calls");
+		o.pack(v.calls);
+		o.pack("errors");
+		o.pack(v.errors);
+		o.pack("expired");
+		o.pack(v.expired);
+		o.pack("in_flight");
+		o.pack(v.inFlight);
+		o.pack("bytes_in");
+		o.pack(v.bytesIn);
+		o.pack("bytes_out");
+		o.pack(v.bytesOut);
+		o.pack("latency_mean");
+		o.pack(v.latencyMean);
+		o.pack("latency_p50");
+		o.pack(v.latencyP50);
+		o.pack("latency_p90");
+		o.pack(v.latencyP90);
+		o.pack("latency_p99");
+		o.pack(v.latencyP99);
+		o.pack("latency_p999");
+		o.pack(v.latencyP999);
+		o.pack("latency_max");
+		o.pack(v.latencyMax);
+		return o;
+	}
+};
+
+/* unknown fields are skipped, missing ones left 0 */
+template <>
+struct convert<rpc::MethodStats> {
+	const msgpack::object& operator()(const msgpack::object& o, rpc::MethodStats& v) const
+	{
+		if (o.type != msgpack::type::MAP)
+			throw msgpack::type_error();
+
+		v = rpc::MethodStats();
+
+		for (uint32_t i = 0; i < o.via.map.size; ++i) {
+			const auto& kv = o.via.map.ptr[i];
+
+			if (kv.key.type != msgpack::type::STR)
+				continue;
+
+			std::string_view key(kv.key.via.str.ptr, kv.key.via.str.size);
+
+			if (key == "calls")
+				kv.val.convert(v.calls);
+			else if (key == "errors")
+				kv.val.convert(v.errors);
+			else if (key == "expired")
+				kv.val.convert(v.expired);
+			else if (key == "in_flight")
+				kv.val.convert(v.inFlight);
+			else if (key == "bytes_in")
+				kv.val.convert(v.bytesIn);
+			else if (key == "bytes_out")
+				kv.val.convert(v.bytesOut);
+			else if (key == "latency_mean")
+				kv.val.convert(v.latencyMean);
+			else if (key == "latency_p50")
+				kv.val.convert(v.latencyP50);
+			else if (key == "latency_p90")
+				kv.val.convert(v.latencyP90);
+			else if (key == "latency_p99")
+				kv.val.convert(v.latencyP99);
+			else if (key == "latency_p999")
+				kv.val.convert(v.latencyP999);
+			else if (key == "latency_max")
+				kv.val.convert(v.latencyMax);
+		}
+
+		return o;
+	}
+};
+
+}
+}
+}
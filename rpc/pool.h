@@ -0,0 +1,315 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Buffer pool: frame buffers and unpack zones reused across calls
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "msgpack.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace rpc {
+
+/*
+ * Where the client, the server and the transports take their short-lived
+ * buffers from, and give them back to once done: `msgpack::sbuffer` frames,
+ * `std::vector<char>` receive buffers and unpack zones. A buffer comes back
+ * cleared, with its capacity, so that steady traffic does not allocate.
+ *
+ * A buffer may be given back to a pool other than the one it was taken
+ * from, or not at all (it is then freed as usual).
+ */
+class BufferPool {
+public:
+	struct Stats {
+		uint64_t hits = 0;	/* taken from the pool */
+		uint64_t misses = 0;	/* allocated anew */
+	};
+
+	virtual ~BufferPool() = default;
+
+	virtual msgpack::sbuffer take_sbuffer() = 0;
+	virtual void give(msgpack::sbuffer&& buffer) noexcept = 0;
+
+	virtual std::vector<char> take_bytes() = 0;
+	virtual void give(std::vector<char>&& bytes) noexcept = 0;
+
+	virtual std::unique_ptr<msgpack::zone> take_zone() = 0;
+	virtual void give(std::unique_ptr<msgpack::zone>&& zone) noexcept = 0;
+
+	Stats stats() const noexcept
+	{
+		return Stats{m_hits.load(std::memory_order_relaxed), m_misses.load(std::memory_order_relaxed)};
+	}
+
+protected:
+	void count(bool hit) noexcept
+	{
+		(hit ? m_hits : m_misses).fetch_add(1, std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<uint64_t> m_hits{0};
+	std::atomic<uint64_t> m_misses{0};
+};
+
+
+/*
+ * Free lists of bounded depth, for one thread at a time. Buffers that grew
+ * over `maxRetained` are freed rather than kept.
+ */
+class LocalPool : public BufferPool {
+public:
+	struct Options {
+		size_t depth = 16;			/* buffers kept, of each kind */
+		size_t maxRetained = 1024 * 1024;	/* bytes, per buffer */
+	};
+
+	LocalPool()
+		:LocalPool(Options())
+	{ }
+
+	explicit LocalPool(const Options& options)
+		:m_options(options)
+	{
+		/* so that giving back does not allocate */
+		m_sbuffers.reserve(options.depth);
+		m_bytes.reserve(options.depth);
+		m_zones.reserve(options.depth);
+	}
+
+	msgpack::sbuffer take_sbuffer() override
+	{
+		count(!m_sbuffers.empty());
+
+		if (m_sbuffers.empty())
+			return msgpack::sbuffer();
+
+		auto buffer = std::move(m_sbuffers.back());
+		m_sbuffers.pop_back();
+		return buffer;
+	}
+
+	void give(msgpack::sbuffer&& buffer) noexcept override
+	{
+		/* a moved-from buffer has nothing to keep */
+		if ((buffer.data() == nullptr) || (buffer.size() > m_options.maxRetained) ||
+		    (m_sbuffers.size() >= m_options.depth))
+			return;
+
+		buffer.clear();
+		m_sbuffers.push_back(std::move(buffer));
+	}
+
+	std::vector<char> take_bytes() override
+	{
+		count(!m_bytes.empty());
+
+		if (m_bytes.empty())
+			return std::vector<char>();
+
+		auto bytes = std::move(m_bytes.back());
+		m_bytes.pop_back();
+		return bytes;
+	}
+
+	void give(std::vector<char>&& bytes) noexcept override
+	{
+		if ((bytes.capacity() == 0) || (bytes.capacity() > m_options.maxRetained) ||
+		    (m_bytes.size() >= m_options.depth))
+			return;
+
+		bytes.clear();
+		m_bytes.push_back(std::move(bytes));
+	}
+
+	std::unique_ptr<msgpack::zone> take_zone() override
+	{
+		count(!m_zones.empty());
+
+		if (m_zones.empty())
+			return std::make_unique<msgpack::zone>();
+
+		auto zone = std::move(m_zones.back());
+		m_zones.pop_back();
+		return zone;
+	}
+
+	void give(std::unique_ptr<msgpack::zone>&& zone) noexcept override
+	{
+		if ((zone == nullptr) || (m_zones.size() >= m_options.depth))
+			return;
+
+		/* keeps the first chunk */
+		zone->clear();
+		m_zones.push_back(std::move(zone));
+	}
+
+private:
+	Options m_options;
+
+	std::vector<msgpack::sbuffer> m_sbuffers;
+	std::vector<std::vector<char>> m_bytes;
+	std::vector<std::unique_ptr<msgpack::zone>> m_zones;
+};
+
+
+/*
+ * Same, for any number of threads: for buffers that are taken on one
+ * thread and given back on another (e.g. a reactor thread receives,
+ * the workers respond), which thread-local pools do not even out.
+ */
+class SharedPool : public LocalPool {
+public:
+	using LocalPool::LocalPool;
+
+	msgpack::sbuffer take_sbuffer() override
+	{
+		std::lock_guard lock(m_mutex);
+		return LocalPool::take_sbuffer();
+	}
+
+	void give(msgpack::sbuffer&& buffer) noexcept override
+	{
+		std::lock_guard lock(m_mutex);
+		LocalPool::give(std::move(buffer));
+	}
+
+	std::vector<char> take_bytes() override
+	{
+		std::lock_guard lock(m_mutex);
+		return LocalPool::take_bytes();
+	}
+
+	void give(std::vector<char>&& bytes) noexcept override
+	{
+		std::lock_guard lock(m_mutex);
+		LocalPool::give(std::move(bytes));
+	}
+
+	std::unique_ptr<msgpack::zone> take_zone() override
+	{
+		std::lock_guard lock(m_mutex);
+		return LocalPool::take_zone();
+	}
+
+	void give(std::unique_ptr<msgpack::zone>&& zone) noexcept override
+	{
+		std::lock_guard lock(m_mutex);
+		LocalPool::give(std::move(zone));
+	}
+
+private:
+	std::mutex m_mutex;
+};
+
+
+namespace pool {
+
+/* this thread's own */
+inline BufferPool& local()
+{
+	static thread_local LocalPool pool;
+	return pool;
+}
+
+inline std::atomic<BufferPool*>& installed() noexcept
+{
+	static std::atomic<BufferPool*> pool{nullptr};
+	return pool;
+}
+
+/*
+ * Have every thread use `pool` rather than its own, e.g. a `SharedPool`;
+ * it must be thread-safe, and outlive its use.
+ * `nullptr` goes back to the thread-local pools.
+ */
+inline void install(BufferPool* pool) noexcept
+{
+	installed().store(pool, std::memory_order_release);
+}
+
+inline BufferPool& current()
+{
+	auto pool = installed().load(std::memory_order_acquire);
+	return (pool != nullptr) ? *pool : local();
+}
+
+inline msgpack::sbuffer sbuffer()
+{
+	return current().take_sbuffer();
+}
+
+inline std::vector<char> bytes()
+{
+	return current().take_bytes();
+}
+
+/* done with it */
+inline void recycle(msgpack::sbuffer&& buffer) noexcept
+{
+	try {
+		current().give(std::move(buffer));
+	} catch (...) {
+		/* no memory for the pool itself: let it go */
+	}
+}
+
+inline void recycle(std::vector<char>&& bytes) noexcept
+{
+	try {
+		current().give(std::move(bytes));
+	} catch (...) {
+	}
+}
+
+inline void recycle(std::unique_ptr<msgpack::zone>&& zone) noexcept
+{
+	try {
+		current().give(std::move(zone));
+	} catch (...) {
+	}
+}
+
+/*
+ * A pooled unpack zone, given back upon destruction:
+ *
+ *   pool::Zone zone;
+ *   auto obj = msgpack::unpack(*zone, data, size);
+ *
+ * `obj` is valid as long as `zone` is.
+ */
+class Zone {
+public:
+	Zone()
+		:m_zone(current().take_zone())
+	{ }
+
+	~Zone()
+	{
+		recycle(std::move(m_zone));
+	}
+
+	Zone(const Zone&) = delete;
+	Zone& operator=(const Zone&) = delete;
+
+	msgpack::zone& operator*() noexcept
+	{
+		return *m_zone;
+	}
+
+private:
+	std::unique_ptr<msgpack::zone> m_zone;
+};
+
+}
+
+}
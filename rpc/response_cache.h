@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Response cache of a bound function: repeated calls answered without calling it
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "msgpack.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+
+namespace rpc {
+
+/*
+ * How much of a function's responses `Server::bind()` keeps. Past either
+ * limit, the least recently used ones go; with a `ttl`, a response is not
+ * used once it is older than that.
+ */
+struct CachePolicy {
+	size_t maxEntries = 1024;
+	size_t maxBytes = 1024 * 1024;		/* of the responses */
+	std::chrono::milliseconds ttl{0};	/* 0: until evicted */
+};
+
+/* what `Server::cache_stats()` returns, per cached function */
+struct CacheStats {
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;		/* to make room, or expired */
+	uint64_t entries = 0;
+	uint64_t bytes = 0;
+};
+
+
+/*
+ * Packed responses, by the packed arguments of the call. The calls are
+ * spread over a few shards by the hash of their arguments, each under
+ * a lock of its own. The limits of the policy hold for all of them: past
+ * either, an insert evicts the least recently used of its own shard, then
+ * of the others, one shard at a time.
+ *
+ * A cached response is one whose callID is packed as uint32 (`pack_id()`),
+ * always 5 bytes in the same place: a hit is a copy of it, with the callID
+ * of the call patched in.
+ */
+class ResponseCache {
+public:
+	static constexpr size_t shards = 8;
+
+	explicit ResponseCache(const CachePolicy& policy)
+		: m_maxEntries(std::max<size_t>(policy.maxEntries, 1))
+		, m_maxBytes(policy.maxBytes)
+		, m_ttl(policy.ttl)
+		, m_shards(new Shard[shards])
+	{ }
+
+	/* the head of a response to cache: [callID, ... */
+	template <typename Stream>
+	static void pack_id(msgpack::packer<Stream>& packer, uint32_t callID)
+	{
+		packer.pack_array(2);
+		packer.pack_fix_uint32(callID);
+	}
+
+	/* the response to the call of `callID`, appended to `resp`: `false` on a miss */
+	bool find(std::string_view args, uint32_t callID, msgpack::sbuffer& resp)
+	{
+		uint64_t hash = hash_of(args);
+		auto& shard = m_shards[hash % shards];
+		std::lock_guard lock(shard.mutex);
+
+		auto it = shard.index.find(hash);
+
+		if ((it == shard.index.end()) || (it->second->args != args)) {
+			++shard.misses;
+			return false;
+		}
+
+		auto entry = it->second;
+
+		if ((m_ttl.count() > 0) && (Clock::now() >= entry->expiry)) {
+			drop(shard, entry);
+			++shard.evictions;
+			++shard.misses;
+			return false;
+		}
+
+		/* most recently used first */
+		shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+		++shard.hits;
+
+		size_t offset = resp.size();
+
+		resp.write(entry->resp.data(), entry->resp.size());
+
+		for (int i = 0; i < 4; ++i)
+			resp.data()[offset + id_offset + i] = static_cast<char>(callID >> (24 - 8 * i));
+
+		return true;
+	}
+
+	/* `resp` as packed after `pack_id()`: replaces any other for the same `args` */
+	void insert(std::string_view args, std::string_view resp)
+	{
+		if (resp.size() > m_maxBytes)
+			return;
+
+		uint64_t hash = hash_of(args);
+		size_t home = hash % shards;
+
+		{
+			auto& shard = m_shards[home];
+			std::lock_guard lock(shard.mutex);
+
+			if (auto it = shard.index.find(hash); it != shard.index.end())
+				drop(shard, it->second);
+
+			auto expiry = (m_ttl.count() > 0) ? Clock::now() + m_ttl : Clock::time_point();
+
+			shard.lru.push_front({hash, std::string(args), std::string(resp), expiry});
+			shard.index.emplace(hash, shard.lru.begin());
+			shard.bytes += resp.size();
+			m_entries.fetch_add(1, std::memory_order_relaxed);
+			m_bytes.fetch_add(resp.size(), std::memory_order_relaxed);
+
+			/* all but the one just cached */
+			while (over() && (shard.lru.size() > 1)) {
+				drop(shard, std::prev(shard.lru.end()));
+				++shard.evictions;
+			}
+		}
+
+		/* the others make room, in turn, never two locks at a time */
+		for (bool dropped = true; over() && dropped; ) {
+			dropped = false;
+
+			for (size_t i = 1; (i < shards) && over(); ++i) {
+				auto& shard = m_shards[(home + i) % shards];
+				std::lock_guard lock(shard.mutex);
+
+				if (!shard.lru.empty()) {
+					drop(shard, std::prev(shard.lru.end()));
+					++shard.evictions;
+					dropped = true;
+				}
+			}
+		}
+	}
+
+	/* a moment's view, shard by shard */
+	CacheStats stats() const
+	{
+		CacheStats stats;
+
+		for (size_t i = 0; i < shards; ++i) {
+			const auto& shard = m_shards[i];
+			std::lock_guard lock(shard.mutex);
+
+			stats.hits += shard.hits;
+			stats.misses += shard.misses;
+			stats.evictions += shard.evictions;
+			stats.entries += shard.lru.size();
+			stats.bytes += shard.bytes;
+		}
+
+		return stats;
+	}
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	/* of the callID in a cached response: after the array and the uint32 tags */
+	static constexpr size_t id_offset = 2;
+
+	struct Entry {
+		uint64_t hash;
+		std::string args;
+		std::string resp;
+		Clock::time_point expiry;
+	};
+
+	struct alignas(64) Shard {
+		mutable std::mutex mutex;
+		std::list<Entry> lru;
+		std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+		size_t bytes = 0;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+	};
+
+	const size_t m_maxEntries;
+	const size_t m_maxBytes;
+	const std::chrono::milliseconds m_ttl;
+	std::unique_ptr<Shard[]> m_shards;
+
+	/* of all the shards */
+	std::atomic<size_t> m_entries{0};
+	std::atomic<size_t> m_bytes{0};
+
+	bool over() const noexcept
+	{
+		return (m_entries.load(std::memory_order_relaxed) > m_maxEntries) ||
+		       (m_bytes.load(std::memory_order_relaxed) > m_maxBytes);
+	}
+
+	/* 64-bit FNV-1a: arguments that collide take turns in the cache */
+	static uint64_t hash_of(std::string_view bytes) noexcept
+	{
+		uint64_t hash = 14695981039346656037ull;
+
+		for (char c : bytes) {
+			hash ^= static_cast<uint8_t>(c);
+			hash *= 1099511628211ull;
+		}
+
+		return hash;
+	}
+
+	/* shard lock held */
+	void drop(Shard& shard, std::list<Entry>::iterator entry) noexcept
+	{
+		shard.bytes -= entry->resp.size();
+		m_entries.fetch_sub(1, std::memory_order_relaxed);
+		m_bytes.fetch_sub(entry->resp.size(), std::memory_order_relaxed);
+		shard.index.erase(entry->hash);
+		shard.lru.erase(entry);
+	}
+};
+
+}
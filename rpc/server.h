@@ -8,13 +8,25 @@
 #pragma once
 
 #include "errors.h"
+#include "func_hash.h"
+#include "dispatch.h"
+#include "batch.h"
+#include "streaming.h"
+#include "pool.h"
+#include "metrics.h"
+#include "deadline.h"
+#include "response_cache.h"
+#include "framing.h"
+#include "blob.h"
 
 #include "msgpack.hpp"
 
-#include <shared_mutex>
-#include <mutex>
+#include <algorithm>
 #include <functional>
+#include <map>
+#include <memory>
 #include <type_traits>
+#include <utility>
 
 
 /*
@@ -56,6 +68,35 @@ public:
 	using args_tuple = typename call_type::args_tuple;
 };
 
+/*
+ * Helper to strip cv/ref qualifiers off the argument types,
+ * so that the arguments can be default-constructed and converted in place
+ */
+template <typename T>
+struct decay_tuple;
+
+template <typename... Args>
+struct decay_tuple<std::tuple<Args...>> {
+	using type = std::tuple<std::decay_t<Args>...>;
+};
+
+/*
+ * Helper to tell a streaming function (see `rpc::Writer`) by its first argument,
+ * and split it off the arguments that come with the call
+ */
+template <typename T>
+struct stream_traits {
+	static constexpr bool value = false;
+	using args_tuple = T;
+};
+
+template <typename T, typename... Args>
+struct stream_traits<std::tuple<rpc::Writer<T>, Args...>> {
+	static constexpr bool value = true;
+	using chunk_type = T;
+	using args_tuple = std::tuple<Args...>;
+};
+
 
 namespace rpc {
 
@@ -73,74 +114,484 @@ public:
 
 class Server {
 public:
+	/* `framing`: of the transport that sends the responses, see `Framing` */
+	explicit Server(const Framing& framing = Framing())
+		: m_framing(framing)
+	{
+		/* reserved: any client may ask if the server is there, e.g. a health check */
+		bind(ping_func_id, []() {
+			return true;
+		});
+
+#ifndef RPC_NO_METRICS
+		/* reserved: any client may ask how the server does */
+		bind(stats_func_id, [this]() {
+			return stats();
+		});
+#endif
+	}
+
+	/*
+	 * Returns the numeric ID, which clients may use instead of the name.
+	 * Binding an already bound name is a no-op.
+	 */
+	template <typename Func>
+	FuncHash bind(const std::string& funcID, Func&& func)
+	{
+		return bind(funcID, std::forward<Func>(func), nullptr);
+	}
+
+	/*
+	 * Same, for a pure (or idempotent) function: its responses are cached
+	 * (see `CachePolicy`), and a call with the same arguments, packed the
+	 * same, as a cached one is answered from the cache, without calling
+	 * the function. A call with a `Blob` passed out-of-band, as an argument
+	 * or as the result, is neither answered from the cache nor cached.
+	 */
+	template <typename Func>
+	FuncHash bind(const std::string& funcID, const CachePolicy& policy, Func&& func)
+	{
+		using RetType = typename function_traits<std::decay_t<Func>>::return_type;
+		static_assert(!std::is_same_v<RetType, void>, "a cached function returns a value");
+
+		return bind(funcID, std::forward<Func>(func), std::make_unique<ResponseCache>(policy));
+	}
+
+	void unbind(const std::string& funcID)
+	{
+		m_methods.erase(funcID);
+	}
+
+	/* of the responses: one handed over in place, e.g. by `NullClient`, is the body past the header */
+	const Framing& framing() const noexcept
+	{
+		return m_framing;
+	}
+
+	/* per bound function with a cache: how well it does */
+	std::map<std::string, CacheStats> cache_stats() const
+	{
+		std::map<std::string, CacheStats> stats;
+
+		m_methods.for_each([&](const std::string& funcID, const Method& method) {
+			if (method.cache)
+				stats.emplace(funcID, method.cache->stats());
+		});
+
+		return stats;
+	}
+
+#ifndef RPC_NO_METRICS
+	/*
+	 * Per bound function (see `MethodStats`), as the `__stats` built-in
+	 * responds. Calls to unbound functions, and malformed ones, are not
+	 * counted anywhere.
+	 */
+	Stats stats() const
+	{
+		Stats stats;
+
+		m_methods.for_each([&](const std::string& funcID, const Method& method) {
+			stats.emplace(funcID, method.metrics.stats());
+		});
+
+		return stats;
+	}
+#endif
+
+	/*
+	 * The buffer is parsed exactly once; string/bin payloads are not copied,
+	 * so the bound function may take `std::string_view` / `msgpack::type::raw_ref`
+	 * arguments, which remain valid for the duration of the call.
+	 *
+	 * A batch of calls is answered with a single batch of responses.
+	 * So is a streaming call (see `Writer`): its chunks are collected into
+	 * a batch, use the `emit` flavour to send them as they come.
+	 *
+	 * The buffers come from the buffer pool (see `BufferPool`): give the
+	 * response back with `pool::recycle()` once it is sent. Each is packed
+	 * behind room for the header of the `Framing` the server is made with.
+	 *
+	 * A call that comes with a deadline (see `Deadline`) and is past it by
+	 * the time its turn comes is not made, and gets no response. Its budget
+	 * counts from `received`; a transport that queues requests passes the
+	 * time it read the request, otherwise it is upon handling.
+	 */
+	msgpack::sbuffer handle_call(const char* data, size_t size, deadline::Clock::time_point received = {})
+	{
+		pool::Zone zone;
+		auto call = msgpack::unpack(*zone, data, size, reference_payload);
+
+		msgpack::sbuffer resp(0);
+		uint32_t count = 0;
+
+		auto collect = [&](msgpack::sbuffer&& one) {
+			if (count++ == 0) {
+				resp = m_framing.buffer();
+				batch::reserve_header(resp);
+			}
+
+			resp.write(m_framing.body(one), m_framing.body_size(one));
+			pool::recycle(std::move(one));
+		};
+
+		if (!batch::is_batch(call)) {
+			Frame frame{size, received};
+			auto one = dispatch(call, collect, frame);
+
+			/* not a stream */
+			if (count == 0)
+				return one;
+
+			collect(std::move(one));
+		} else {
+			for_each_call(call, {size, received}, collect, collect);
+		}
+
+		if (count == 0) {
+			/* all void: nothing to send, nor to allocate */
+			pool::recycle(std::move(resp));
+			return msgpack::sbuffer(0);
+		}
+
+		batch::patch_header(resp, count, m_framing.header);
+		return resp;
+	}
+
+	msgpack::sbuffer handle_call(const msgpack::sbuffer& buffer)
+	{
+		return handle_call(buffer.data(), buffer.size());
+	}
+
+	/*
+	 * Same as above, each frame goes to `emit(msgpack::sbuffer&&)`: the chunks
+	 * of a stream one at a time, as they are written, and the responses to
+	 * a batch in a single frame.
+	 */
+	template <typename Emit>
+	void handle_call(const char* data, size_t size, Emit&& emit, deadline::Clock::time_point received = {})
+	{
+		pool::Zone zone;
+		auto call = msgpack::unpack(*zone, data, size, reference_payload);
+
+		if (!batch::is_batch(call)) {
+			Frame frame{size, received};
+			auto resp = dispatch(call, emit, frame);
+
+			if (resp.size() > 0)
+				emit(std::move(resp));
+
+			return;
+		}
+
+		auto resp = m_framing.buffer();
+		uint32_t count = 0;
+
+		batch::reserve_header(resp);
+
+		for_each_call(call, {size, received}, emit, [&](msgpack::sbuffer&& one) {
+			resp.write(m_framing.body(one), m_framing.body_size(one));
+			pool::recycle(std::move(one));
+			++count;
+		});
+
+		if (count > 0) {
+			batch::patch_header(resp, count, m_framing.header);
+			emit(std::move(resp));
+		} else {
+			pool::recycle(std::move(resp));
+		}
+	}
+
+	/*
+	 * Stream the responses to a batch back as they complete: `emit(msgpack::sbuffer&&)`
+	 * gets each (non-void) response as soon as its call returns. A single call
+	 * is a batch of one.
+	 */
+	template <typename Emit>
+	void handle_batch(const char* data, size_t size, Emit&& emit, deadline::Clock::time_point received = {})
+	{
+		pool::Zone zone;
+		auto call = msgpack::unpack(*zone, data, size, reference_payload);
+
+		if (!batch::is_batch(call)) {
+			Frame frame{size, received};
+			auto resp = dispatch(call, emit, frame);
+
+			if (resp.size() > 0)
+				emit(std::move(resp));
+
+			return;
+		}
+
+		for_each_call(call, {size, received}, emit, emit);
+	}
+
+	/* all responses in one frame, same as `handle_call()` */
+	msgpack::sbuffer handle_batch(const char* data, size_t size, deadline::Clock::time_point received = {})
+	{
+		return handle_call(data, size, received);
+	}
+
+private:
+	using Callback = std::function<msgpack::sbuffer(uint32_t, const msgpack::object&, const stream::Sink&)>;
+
+	/* a bound function */
+	struct Method {
+		Callback callback;
+		std::unique_ptr<ResponseCache> cache;
+#ifndef RPC_NO_METRICS
+		metrics::Metrics metrics;
+#endif
+	};
+
+	DispatchTable<Method> m_methods;
+	const Framing m_framing;
+
+	/* `cache`: none, unless bound with a `CachePolicy` */
 	template <typename Func>
-	void bind(const std::string& funcID, Func&& func) noexcept
+	FuncHash bind(const std::string& funcID, Func&& func, std::unique_ptr<ResponseCache> cache)
 	{
-		std::unique_lock lock(m_mutex);
+		bool cached = (cache != nullptr);
 
-		auto wrapper = [=](uint32_t callID, const msgpack::sbuffer& buffer) -> msgpack::sbuffer {
+		auto wrapper = [=, &framing = m_framing](uint32_t callID, const msgpack::object& call, const stream::Sink& sink) -> msgpack::sbuffer {
 			using Traits = function_traits<std::decay_t<Func>>;
-			using ArgTuple = typename Traits::args_tuple;
+			using Stream = stream_traits<typename decay_tuple<typename Traits::args_tuple>::type>;
+			using ArgTuple = typename Stream::args_tuple;
 			using RetType = typename Traits::return_type;
 
-			using FullTuple = decltype(std::tuple_cat(std::make_tuple(uint32_t(0), std::string()), ArgTuple()));
-			FullTuple full;
+			/* call layout: [callID, funcID | hash, args...] */
+			if (call.via.array.size < (2 + std::tuple_size_v<ArgTuple>))
+				throw ServerError("too few arguments in call buffer");
+
+			using Params = typename Traits::args_tuple;
+			using Indices = std::make_index_sequence<std::tuple_size_v<ArgTuple>>;
+
+			ArgTuple args;
+			convert_args(call.via.array.ptr + 2, args, Indices());
+
+			if constexpr (Stream::value) {
+				static_assert(std::is_same_v<RetType, void>, "a streaming function returns void");
+
+				/* the chunks go out as they are written, the end of the stream is the response */
+				Writer<typename Stream::chunk_type> writer(callID, sink, framing);
+
+				invoke<Params, 1>(func, args, Indices(), writer);
 
-			msgpack::unpack(buffer.data(), buffer.size()).get().convert(full);
+				auto resp = framing.buffer();
+				msgpack::packer<msgpack::sbuffer> packer(resp);
 
-			msgpack::sbuffer resp;
-			msgpack::packer<msgpack::sbuffer> packer(resp);
+				stream::pack_end(packer, callID);
+				return resp;
+			} else if constexpr (std::is_same_v<RetType, void>) {
+				/* no return value, nothing allocated */
+				invoke<Params, 0>(func, args, Indices());
+				return msgpack::sbuffer(0);
+			} else {
+				/* return value */
+				auto val = invoke<Params, 0>(func, args, Indices());
+				auto resp = framing.buffer();
+				msgpack::packer<msgpack::sbuffer> packer(resp);
 
-			std::apply([&](auto&&, auto&&, auto&&... args) {
-				if constexpr (std::is_same_v<RetType, void>) {
-					/* no return value */
-					func(std::forward<decltype(args)>(args)...);
+				if (cached) {
+					ResponseCache::pack_id(packer, callID);
 				} else {
-					/* return value */
-					auto val = func(std::forward<decltype(args)>(args)...);
 					packer.pack_array(2);
 					packer.pack(callID);
-					packer.pack(val);
 				}
-			}, full);
 
-			return resp;
+				packer.pack(val);
+				return resp;
+			}
+		};
+
+		if (m_methods.insert(funcID, Method{wrapper, std::move(cache)}) == DispatchTable<Method>::Status::Collision)
+			throw ServerError("funcID hash collision: " + funcID);
+
+		return FuncHash(funcID);
+	}
+
+	/* of the request being handled */
+	struct Frame {
+		size_t size;				/* on the wire: of a batch, each call's share */
+		deadline::Clock::time_point received;	/* none: upon the first call with a deadline */
+	};
+
+	static bool reference_payload(msgpack::type::object_type, std::size_t, void*) noexcept
+	{
+		return true;
+	}
+
+	/*
+	 * The chunks of a stream go to `sink`, the (last) response is returned:
+	 * none for a call past its deadline.
+	 */
+	msgpack::sbuffer dispatch(const msgpack::object& call, const stream::Sink& sink, Frame& frame)
+	{
+		if ((call.type != msgpack::type::ARRAY) || (call.via.array.size < 2))
+			throw ServerError("malformed call buffer");
+
+		uint32_t callID;
+		uint32_t budget = 0;
+		bool timed = deadline::unpack_id(call.via.array.ptr[0], callID, budget);
+		const auto& funcID = call.via.array.ptr[1];
+		/* held through the call: it may be unbound meanwhile */
+		DispatchTable<Method>::Pinned method;
+
+		/* funcID is either the name, or its numeric hash */
+		if (funcID.type == msgpack::type::STR) {
+			std::string_view name(funcID.via.str.ptr, funcID.via.str.size);
+
+			method = m_methods.pin(name);
+			if (!method)
+				throw ServerError("unregistered function: " + std::string(name));
+		} else {
+			auto hash = funcID.as<uint32_t>();
+
+			method = m_methods.pin(hash);
+			if (!method)
+				throw ServerError("unregistered function hash: " + std::to_string(hash));
+		}
+
+		if (timed) {
+			auto now = deadline::Clock::now();
+
+			if (frame.received == deadline::Clock::time_point())
+				frame.received = now;
+
+			/* nobody is waiting for the response any more */
+			if (now - frame.received > std::chrono::microseconds(budget)) {
+#ifndef RPC_NO_METRICS
+				method->metrics.expire();
+#endif
+				return msgpack::sbuffer(0);
+			}
+		}
+
+		/* FIXME: handle exceptions */
+#ifdef RPC_NO_METRICS
+		return call_method(*method, callID, call, sink);
+#else
+		/* the chunks of a stream count as they go */
+		uint64_t bytesOut = 0;
+
+		auto counted = [&](msgpack::sbuffer&& chunk) {
+			bytesOut += m_framing.body_size(chunk);
+			sink(std::move(chunk));
 		};
 
-		m_callbacks.emplace(funcID, wrapper);
+		auto started = metrics::Clock::now();
+		method->metrics.start();
+
+		try {
+			auto resp = call_method(*method, callID, call, stream::Sink(counted));
+
+			method->metrics.finish(metrics::elapsed_ns(started), false, frame.size, bytesOut + m_framing.body_size(resp));
+			return resp;
+		} catch (...) {
+			method->metrics.finish(metrics::elapsed_ns(started), true, frame.size, bytesOut);
+			throw;
+		}
+#endif
 	}
 
-	void unbind(const std::string& funcID) noexcept
+	/* or answer from its cache, by the arguments of the call, as packed */
+	msgpack::sbuffer call_method(const Method& method, uint32_t callID, const msgpack::object& call, const stream::Sink& sink) const
 	{
-		std::unique_lock lock(m_mutex);
+		if (!method.cache)
+			return method.callback(callID, call, sink);
+
+		const auto* first = call.via.array.ptr + 2;
+		const auto* last = call.via.array.ptr + call.via.array.size;
+
+		/* a blob passed out-of-band is not its bytes: the same handle may be another blob */
+		if (std::any_of(first, last, has_blob_handle))
+			return method.callback(callID, call, sink);
+
+		auto args = pool::sbuffer();
+		msgpack::packer<msgpack::sbuffer> packer(args);
+
+		for (const auto* arg = first; arg != last; ++arg)
+			packer.pack(*arg);
+
+		std::string_view key(args.data(), args.size());
+		auto resp = m_framing.buffer();
+
+		if (!method.cache->find(key, callID, resp)) {
+			pool::recycle(std::move(resp));
+
+			auto outgoing = blob::Outgoing::current();
+			size_t attached = (outgoing != nullptr) ? outgoing->count() : 0;
 
-		m_callbacks.erase(funcID);
+			resp = method.callback(callID, call, sink);
+
+			/* nor is a result attached as a memfd: its handle is good for this frame only */
+			if ((outgoing == nullptr) || (outgoing->count() == attached))
+				method.cache->insert(key, std::string_view(m_framing.body(resp), m_framing.body_size(resp)));
+		}
+
+		pool::recycle(std::move(args));
+		return resp;
 	}
 
-	msgpack::sbuffer handle_call(const msgpack::sbuffer& buffer)
+	/* see `Blob` */
+	static bool has_blob_handle(const msgpack::object& obj) noexcept
 	{
-		std::shared_lock lock(m_mutex);
+		switch (obj.type) {
+		case msgpack::type::EXT:
+			return obj.via.ext.type() == blob::ext_type;
 
-		auto [callID, funcID] = get_id(buffer);
-		auto callback = m_callbacks.find(funcID);
+		case msgpack::type::ARRAY:
+			return std::any_of(obj.via.array.ptr, obj.via.array.ptr + obj.via.array.size, has_blob_handle);
 
-		if (callback == m_callbacks.end())
-			throw ServerError("unregistered function: " + funcID);
+		case msgpack::type::MAP:
+			return std::any_of(obj.via.map.ptr, obj.via.map.ptr + obj.via.map.size, [](const msgpack::object_kv& kv) {
+				return has_blob_handle(kv.key) || has_blob_handle(kv.val);
+			});
 
-		/* FIXME: handle exceptions */
-		return callback->second(callID, buffer);
+		default:
+			return false;
+		}
 	}
 
-private:
-	std::unordered_map<std::string, std::function<msgpack::sbuffer(uint32_t, const msgpack::sbuffer&)>> m_callbacks;
-	std::shared_mutex m_mutex;
+	/* the size of the batch is shared evenly among its calls */
+	template <typename Chunk, typename Emit>
+	void for_each_call(const msgpack::object& calls, Frame frame, Chunk& chunk, Emit&& emit)
+	{
+		const stream::Sink sink(chunk);
+
+		if (calls.via.array.size > 0)
+			frame.size /= calls.via.array.size;
+
+		for (uint32_t i = 0; i < calls.via.array.size; ++i) {
+			auto resp = dispatch(calls.via.array.ptr[i], sink, frame);
 
-	std::tuple<uint32_t, std::string> get_id(const msgpack::sbuffer& buffer)
+			if (resp.size() > 0)
+				emit(std::move(resp));
+		}
+	}
+
+	template <typename ArgTuple, size_t... I>
+	static void convert_args(const msgpack::object* objs, ArgTuple& args, std::index_sequence<I...>)
 	{
-		std::tuple<uint32_t, std::string> id;
+		(objs[I].convert(std::get<I>(args)), ...);
+	}
 
-		msgpack::unpack(buffer.data(), buffer.size()).get().convert(id);
-		return id;
+	/* a converted argument as the function takes it: a non-const reference refers to it, anything else takes it over */
+	template <typename Param, typename T>
+	static decltype(auto) pass_arg(T& arg) noexcept
+	{
+		if constexpr (std::is_lvalue_reference_v<Param> && !std::is_const_v<std::remove_reference_t<Param>>)
+			return (arg);
+		else
+			return std::move(arg);
+	}
+
+	/* `func(lead..., args...)`, the arguments being the parameters of `Params` from `Offset` on */
+	template <typename Params, size_t Offset, typename Func, typename ArgTuple, size_t... I, typename... Lead>
+	static decltype(auto) invoke(const Func& func, ArgTuple& args, std::index_sequence<I...>, Lead&... lead)
+	{
+		return func(lead..., pass_arg<std::tuple_element_t<Offset + I, Params>>(std::get<I>(args))...);
 	}
 };
 
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Single-flight calls: identical calls in flight share a single round-trip
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "func_hash.h"
+#include "call_table.h"
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+
+
+namespace rpc {
+
+/*
+ * A funcID (the name or its `FuncHash`) whose calls coalesce:
+ *
+ *   auto [fut, buff, id] = client.call<Row>(rpc::single_flight("get"), key);
+ *
+ * A call made while one of the same function with the same arguments is in
+ * flight is not made: its frame is empty, nothing to send, and it completes
+ * with the response to that one (or fails with it). So does `cancel()`ing
+ * it, by the callID of that one, for all of them.
+ *
+ * Taken by `Client::call()` (and the transports' `call()` / `async_call()`),
+ * other calls make it as a plain funcID. Calls coalesce per `Client`, i.e.
+ * per connection, but for `TcpPoolClient`, where they do across the pool.
+ */
+template <typename FuncID>
+class SingleFlight {
+public:
+	explicit SingleFlight(const FuncID& funcID)
+		: m_funcID(funcID)
+	{ }
+
+	const FuncID& func_id() const noexcept
+	{
+		return m_funcID;
+	}
+
+private:
+	FuncID m_funcID;
+};
+
+template <typename T>
+inline constexpr bool is_single_flight_v = false;
+
+template <typename FuncID>
+inline constexpr bool is_single_flight_v<SingleFlight<FuncID>> = true;
+
+template <typename FuncID>
+auto single_flight(const FuncID& funcID)
+{
+	if constexpr (std::is_same_v<FuncID, FuncHash>)
+		return SingleFlight<FuncHash>(funcID);
+	else
+		return SingleFlight<std::string>(funcID);
+}
+
+
+/*
+ * The calls in flight that identical ones join, by key: the hash of the
+ * function and the packed arguments
+ */
+class FlightTable {
+public:
+	/*
+	 * If a call is in flight under `key`, `handler` (see `Handler`) gets
+	 * its response, and `callID` is set to its. Otherwise the call of
+	 * `callID` is the one in flight under `key` from now on.
+	 */
+	template <typename F>
+	bool join(const std::string& key, uint32_t& callID, F&& handler)
+	{
+		std::lock_guard lock(m_mutex);
+
+		auto [it, lead] = m_flights.try_emplace(key);
+
+		if (lead) {
+			it->second.callID = callID;
+			return false;
+		}
+
+		it->second.followers.emplace_back().emplace(std::forward<F>(handler));
+		callID = it->second.callID;
+		return true;
+	}
+
+	/* the call under `key` is done: the handlers of those that joined it */
+	std::list<Handler> land(const std::string& key) noexcept
+	{
+		std::list<Handler> followers;
+		std::lock_guard lock(m_mutex);
+
+		if (auto it = m_flights.find(key); it != m_flights.end()) {
+			followers.swap(it->second.followers);
+			m_flights.erase(it);
+		}
+
+		return followers;
+	}
+
+private:
+	struct Flight {
+		uint32_t callID = 0;
+		std::list<Handler> followers;
+	};
+
+	std::mutex m_mutex;
+	std::unordered_map<std::string, Flight> m_flights;
+};
+
+}
@@ -0,0 +1,109 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Server-streaming responses: many chunks under one callID
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "framing.h"
+
+#include "msgpack.hpp"
+
+#include <cstdint>
+#include <utility>
+
+
+namespace rpc {
+
+namespace stream {
+
+/*
+ * A chunk is a response with a third element, `[callID, chunk, false]`;
+ * the stream ends with `[callID, nil, true]`. Each chunk is a frame of
+ * its own (or an element of a batch of responses), so it can go out
+ * before the next one is produced.
+ */
+template <typename T>
+inline void pack_chunk(msgpack::packer<msgpack::sbuffer>& packer, uint32_t callID, const T& chunk)
+{
+	packer.pack_array(3);
+	packer.pack(callID);
+	packer.pack(chunk);
+	packer.pack(false);
+}
+
+inline void pack_end(msgpack::packer<msgpack::sbuffer>& packer, uint32_t callID)
+{
+	packer.pack_array(3);
+	packer.pack(callID);
+	packer.pack_nil();
+	packer.pack(true);
+}
+
+/*
+ * Where the chunks go: a non-owning reference to `emit(msgpack::sbuffer&&)`
+ */
+class Sink {
+public:
+	template <typename Emit>
+	Sink(Emit& emit) noexcept
+		: m_emit(&emit)
+		, m_call([](void* emit, msgpack::sbuffer&& chunk) {
+			(*static_cast<Emit*>(emit))(std::move(chunk));
+		})
+	{ }
+
+	void operator()(msgpack::sbuffer&& chunk) const
+	{
+		m_call(m_emit, std::move(chunk));
+	}
+
+private:
+	void* m_emit;
+	void (*m_call)(void*, msgpack::sbuffer&&);
+};
+
+}
+
+/*
+ * A bound function streams its result when it takes a `Writer` first:
+ *
+ *   server.bind("scan", [](rpc::Writer<Row>& out, std::string table) {
+ *       for (...)
+ *           out.write(row);
+ *   });
+ *
+ * and returns `void`; the stream ends when it returns. Chunks must not be nil.
+ */
+template <typename T>
+class Writer {
+public:
+	Writer(const Writer&) = delete;
+	Writer& operator=(const Writer&) = delete;
+
+	void write(const T& chunk)
+	{
+		auto buffer = m_framing.buffer();
+		msgpack::packer<msgpack::sbuffer> packer(buffer);
+
+		stream::pack_chunk(packer, m_callID, chunk);
+		m_sink(std::move(buffer));
+	}
+
+private:
+	friend class Server;
+
+	uint32_t m_callID;
+	const stream::Sink& m_sink;
+	const Framing& m_framing;
+
+	Writer(uint32_t callID, const stream::Sink& sink, const Framing& framing) noexcept
+		: m_callID(callID)
+		, m_sink(sink)
+		, m_framing(framing)
+	{ }
+};
+
+}
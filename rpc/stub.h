@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Typed client stubs: a bound function declared once, its header packed once
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "func_hash.h"
+#include "iobuffer.h"
+
+#include "msgpack.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+
+namespace rpc {
+
+namespace stub {
+
+/* the most a value of `T` takes packed; 0: it varies, e.g. a string */
+template <typename T>
+constexpr size_t max_packed_size() noexcept
+{
+	if constexpr (std::is_same_v<T, bool>)
+		return 1;
+	else if constexpr (std::is_integral_v<T>)
+		return 1 + sizeof(T);
+	else if constexpr (std::is_same_v<T, float>)
+		return 5;
+	else if constexpr (std::is_same_v<T, double>)
+		return 9;
+	else
+		return 0;
+}
+
+/* of the arguments, if every one of them is of a fixed most */
+template <typename... Params>
+constexpr size_t max_args_size() noexcept
+{
+	if constexpr (((max_packed_size<std::decay_t<Params>>() > 0) && ...))
+		return (max_packed_size<std::decay_t<Params>>() + ... + 0);
+	else
+		return 0;
+}
+
+/* a frame being assembled in place: it is known to fit */
+class FrameStream {
+public:
+	explicit FrameStream(char* data) noexcept
+		: m_data(data)
+	{ }
+
+	void write(const char* data, size_t size) noexcept
+	{
+		std::memcpy(m_data + m_size, data, size);
+		m_size += size;
+	}
+
+	size_t size() const noexcept
+	{
+		return m_size;
+	}
+
+private:
+	char* m_data;
+	size_t m_size = 0;
+};
+
+/* what a string is packed into once */
+struct StringStream {
+	std::string& str;
+
+	void write(const char* data, size_t size)
+	{
+		str.append(data, size);
+	}
+};
+
+/*
+ * An argument to an arithmetic parameter is packed as the declared type,
+ * whatever it converts from (a frame assembled in place counts on it),
+ * anything else as it is
+ */
+template <typename Param, typename Arg>
+decltype(auto) as_param(const Arg& arg)
+{
+	if constexpr (std::is_arithmetic_v<Param>)
+		return static_cast<Param>(arg);
+	else
+		return (arg);
+}
+
+}
+
+
+/*
+ * A bound function, as the client sees it:
+ *
+ *   const rpc::Stub<double(double, double)> add("add");
+ *
+ *   double sum = add(client, 1, 2);
+ *   auto future = add.async(client, 1, 2);
+ *
+ * where `client` is that of any transport. Calls through the stub are checked
+ * against the signature at compile time, and pack its header as it was packed
+ * once, upon construction: the name (or `FuncHash`) is not handled again.
+ * The frame of a signature whose arguments are all of a fixed most size
+ * (numbers, bools) is assembled in place, in a single write to its buffer.
+ *
+ * A stub is a funcID of its own; as such, `Client` (or a transport) takes
+ * it wherever it takes a name, and packs it as its name (or `FuncHash`)
+ * where it is not made by itself, e.g. in a batch.
+ */
+template <typename Signature>
+class Stub;
+
+template <typename R, typename... Params>
+class Stub<R(Params...)> {
+public:
+	using return_type = R;
+
+	/* of the whole frame, if it is of a fixed most size; otherwise 0 */
+	static constexpr size_t fixed_size = (stub::max_args_size<Params...>() > 0) || (sizeof...(Params) == 0)
+		? (3 + 5 + stub::max_args_size<Params...>())	/* array header, callID, arguments */
+		: 0;
+
+	explicit Stub(std::string_view funcID)
+		: m_name(funcID)
+		, m_hash(hash_func_id(funcID))
+	{
+		pack_head([&](auto& packer) {
+			packer.pack(funcID);
+		});
+	}
+
+	explicit Stub(FuncHash funcID)
+		: m_name("#" + std::to_string(funcID.value()))
+		, m_hash(funcID.value())
+		, m_byHash(true)
+	{
+		pack_head([&](auto& packer) {
+			packer.pack(funcID.value());
+		});
+	}
+
+	template <typename Transport>
+	decltype(auto) operator()(Transport& transport, const Params&... args) const
+	{
+		return transport.template call<R>(*this, args...);
+	}
+
+	template <typename Transport>
+	decltype(auto) async(Transport& transport, const Params&... args) const
+	{
+		return transport.template async_call<R>(*this, args...);
+	}
+
+	/* "#<hash>" for one by `FuncHash` */
+	const std::string& name() const noexcept
+	{
+		return m_name;
+	}
+
+	FuncHash hash() const noexcept
+	{
+		return FuncHash(m_hash);
+	}
+
+	bool by_hash() const noexcept
+	{
+		return m_byHash;
+	}
+
+	/*
+	 * The call, into `buffer` (a `msgpack::sbuffer` or an `IoBuffer`):
+	 * `pack(packer)` packs the arguments
+	 */
+	template <typename Buffer, typename Pack>
+	void serialize(Buffer& buffer, uint32_t callID, Pack&& pack) const
+	{
+		if constexpr ((fixed_size > 0) && std::is_same_v<Buffer, msgpack::sbuffer>) {
+			if (m_funcID.size() <= max_func_id) {
+				char frame[fixed_size + max_func_id];
+				stub::FrameStream stream(frame);
+				msgpack::packer<stub::FrameStream> packer(stream);
+
+				pack_call(stream, packer, callID, pack);
+				buffer.write(frame, stream.size());
+				return;
+			}
+		}
+
+		msgpack::packer<Buffer> packer(buffer);
+
+		pack_call(buffer, packer, callID, pack);
+	}
+
+private:
+	/* of a name, assembled in place along with the rest of the frame */
+	static constexpr size_t max_func_id = 64;
+
+	std::string m_name;
+	uint32_t m_hash;
+	bool m_byHash = false;
+
+	/* packed once: `[` of the call, and its funcID */
+	std::string m_array;
+	std::string m_funcID;
+
+	template <typename PackFuncID>
+	void pack_head(PackFuncID&& packFuncID)
+	{
+		stub::StringStream array{m_array};
+		msgpack::packer<stub::StringStream>(array).pack_array(2 + sizeof...(Params));
+
+		stub::StringStream funcID{m_funcID};
+		msgpack::packer<stub::StringStream> packer(funcID);
+		packFuncID(packer);
+	}
+
+	template <typename Stream, typename Pack>
+	void pack_call(Stream& stream, msgpack::packer<Stream>& packer, uint32_t callID, Pack& pack) const
+	{
+		stream.write(m_array.data(), m_array.size());
+		packer.pack(callID);
+		stream.write(m_funcID.data(), m_funcID.size());
+		pack(packer);
+	}
+};
+
+template <typename T>
+inline constexpr bool is_stub_v = false;
+
+template <typename Signature>
+inline constexpr bool is_stub_v<Stub<Signature>> = true;
+
+}
@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Hashed timing wheel: many short-lived timers on a single thread
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace rpc {
+
+/*
+ * A timer goes to the slot of the tick it is due at, modulo the number of
+ * slots; the wheel's thread visits a slot per tick and fires the timers of
+ * that slot that are due. Scheduling is a push to a vector, and a timer
+ * fires within a tick after its time.
+ *
+ * A timer is cancelled by its handle, a lookup in its own slot, e.g. once
+ * the call it times completes; all of an owner's timers go at once, see
+ * `cancel()`. With no timers left, the wheel's thread sleeps.
+ */
+class TimerWheel {
+public:
+	using Clock = std::chrono::steady_clock;
+	using Fire = void (*)(void* owner, uint32_t id) noexcept;
+
+	/* of a scheduled timer; a default one is of none */
+	struct Handle {
+		uint64_t tick = 0;
+		uint64_t seq = 0;
+	};
+
+	explicit TimerWheel(std::chrono::milliseconds tick = std::chrono::milliseconds(1), size_t slots = 1024)
+		: m_tick(std::max(tick, std::chrono::milliseconds(1)))
+		, m_slots(std::max<size_t>(slots, 1))
+		, m_epoch(Clock::now())
+	{ }
+
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	~TimerWheel()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_stop = true;
+		}
+
+		m_wakeup.notify_all();
+
+		if (m_thread.joinable())
+			m_thread.join();
+	}
+
+	/* the process-wide wheel, started upon its first timer, never destroyed */
+	static TimerWheel& shared()
+	{
+		static TimerWheel* wheel = new TimerWheel();
+
+		return *wheel;
+	}
+
+	/* `fire(owner, id)` on the wheel's thread, once `due` */
+	Handle schedule(Clock::time_point due, void* owner, uint32_t id, Fire fire)
+	{
+		std::lock_guard lock(m_mutex);
+
+		/* due already: upon the next tick */
+		uint64_t tick = std::max(tick_of(due), m_current + 1);
+		uint64_t seq = ++m_seq;
+
+		m_slots[tick % m_slots.size()].push_back({tick, seq, owner, id, fire});
+
+		if (m_count++ == 0) {
+			if (!m_thread.joinable())
+				m_thread = std::thread([this] { run(); });
+
+			m_wakeup.notify_all();
+		}
+
+		return {tick, seq};
+	}
+
+	/*
+	 * Drop a timer unless it is fired (or being fired) already; returns
+	 * whether it was dropped. May be called from a timer.
+	 */
+	bool cancel(Handle timer) noexcept
+	{
+		if (timer.seq == 0)
+			return false;
+
+		std::lock_guard lock(m_mutex);
+		auto& slot = m_slots[timer.tick % m_slots.size()];
+
+		for (size_t i = 0; i < slot.size(); ++i) {
+			if (slot[i].seq == timer.seq) {
+				slot[i] = slot.back();
+				slot.pop_back();
+				--m_count;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/* timers yet to fire */
+	size_t size() const noexcept
+	{
+		std::lock_guard lock(m_mutex);
+
+		return m_count;
+	}
+
+	/*
+	 * Drop the owner's timers, e.g. as it is destroyed; returns once any
+	 * being fired are done. Not to be called from a timer.
+	 */
+	void cancel(void* owner) noexcept
+	{
+		std::unique_lock lock(m_mutex);
+
+		for (auto& slot : m_slots) {
+			for (size_t i = 0; i < slot.size();) {
+				if (slot[i].owner == owner) {
+					slot[i] = slot.back();
+					slot.pop_back();
+					--m_count;
+				} else {
+					++i;
+				}
+			}
+		}
+
+		m_fired.wait(lock, [this] {
+			return !m_firing;
+		});
+	}
+
+private:
+	struct Timer {
+		uint64_t tick;
+		uint64_t seq;
+		void* owner;
+		uint32_t id;
+		Fire fire;
+	};
+
+	const Clock::duration m_tick;
+	std::vector<std::vector<Timer>> m_slots;
+	const Clock::time_point m_epoch;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_wakeup;
+	uint64_t m_current = 0;		/* the last tick visited */
+	uint64_t m_seq = 0;
+	size_t m_count = 0;
+	bool m_stop = false;
+
+	/* set while firing, so that `cancel()` waits the timers out */
+	bool m_firing = false;
+	std::condition_variable m_fired;
+	std::thread m_thread;
+
+	uint64_t tick_of(Clock::time_point time) const noexcept
+	{
+		return (time <= m_epoch) ? 0 : ((time - m_epoch) + m_tick - Clock::duration(1)) / m_tick;
+	}
+
+	void run() noexcept
+	{
+		std::vector<Timer> due;
+		std::unique_lock lock(m_mutex);
+
+		while (!m_stop) {
+			if (m_count == 0) {
+				m_wakeup.wait(lock);
+				continue;
+			}
+
+			uint64_t now = (Clock::now() - m_epoch) / m_tick;
+
+			/* a whole turn visits every slot, however late the thread is */
+			uint64_t from = std::max(m_current + 1, (now >= m_slots.size()) ? (now - m_slots.size() + 1) : 0);
+
+			for (uint64_t tick = from; tick <= now; ++tick) {
+				auto& slot = m_slots[tick % m_slots.size()];
+
+				for (size_t i = 0; i < slot.size();) {
+					if (slot[i].tick <= now) {
+						due.push_back(slot[i]);
+						slot[i] = slot.back();
+						slot.pop_back();
+					} else {
+						++i;
+					}
+				}
+			}
+
+			m_current = std::max(m_current, now);
+			m_count -= due.size();
+
+			if (!due.empty()) {
+				m_firing = true;
+				lock.unlock();
+
+				for (const auto& timer : due)
+					timer.fire(timer.owner, timer.id);
+
+				due.clear();
+				lock.lock();
+
+				m_firing = false;
+				m_fired.notify_all();
+				continue;
+			}
+
+			m_wakeup.wait_until(lock, m_epoch + (m_current + 1) * m_tick);
+		}
+	}
+};
+
+}
@@ -9,6 +9,7 @@
 
 #include "rpc/client.h"
 #include "rpc/server.h"
+#include "rpc/awaitable.h"
 
 
 namespace rpc {
@@ -19,30 +20,162 @@ public:
 		:m_server(server)
 	{ }
 
-	template <typename R, typename... Args>
-	R call(const std::string& funcID, Args&&... args)
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	R call(const FuncID& funcID, Args&&... args)
+	{
+		return async_call<R>(funcID, std::forward<Args>(args)...).get();
+	}
+
+	/*
+	 * The call is handled in place, hence the future is ready on return
+	 */
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	std::future<R> async_call(const FuncID& funcID, Args&&... args)
 	{
 		auto [future, buffer, id] = m_client.call<R>(funcID, std::forward<Args>(args)...);
 
-		[[maybe_unused]] auto resp = m_server.handle_call(buffer);
+		dispatch(std::move(buffer), id);
+		return std::move(future);
+	}
+
+	template <typename R, typename Callback, typename FuncID, typename... Args,
+		  std::enable_if_t<!is_func_id_v<Callback>, int> = 0>
+	uint32_t async_call(Callback&& callback, const FuncID& funcID, Args&&... args)
+	{
+		auto [buffer, id] = m_client.call<R>(std::forward<Callback>(callback), funcID, std::forward<Args>(args)...);
+
+		dispatch(std::move(buffer), id);
+		return id;
+	}
+
+	/*
+	 * Batch calls (see `Client::Batch`), handled in place upon `call_batch()`
+	 */
+	Client::Batch batch()
+	{
+		return m_client.batch();
+	}
+
+	void call_batch(Client::Batch&& batch)
+	{
+		auto [buffer, ids] = m_client.call_batch(std::move(batch));
+		if (ids.empty())
+			return;
+
+		msgpack::sbuffer resp(0);
+
+		try {
+			resp = m_server.handle_call(buffer);
+		} catch (...) {
+			pool::recycle(std::move(buffer));
+
+			for (auto id : ids)
+				m_client.cancel(id, std::current_exception());
+
+			return;
+		}
+
+		pool::recycle(std::move(buffer));
 
-		if constexpr (std::is_same_v<R, void>) {
-			/* no return value, do not wait */
+		if (resp.size() == 0) {
+			/* no return values */
 			return;
-		} else {
-			try {
-				m_client.ingest_resp(resp, true/*last*/);
-			} catch (...) {
-				m_client.cancel(id, std::move(std::current_exception()));
-			}
-
-			return future.get();
 		}
+
+		try {
+			ingest(resp);
+		} catch (...) {
+			for (auto id : ids)
+				m_client.cancel(id, std::current_exception());
+		}
+
+		pool::recycle(std::move(resp));
+	}
+
+	/*
+	 * Streaming call (see `Client::stream_call()`), handled in place:
+	 * all the chunks are delivered before it returns
+	 */
+	template <typename T, typename OnChunk, typename OnDone, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	uint32_t stream_call(OnChunk&& onChunk, OnDone&& onDone, const FuncID& funcID, Args&&... args)
+	{
+		auto [buffer, id] = m_client.stream_call<T>(std::forward<OnChunk>(onChunk), std::forward<OnDone>(onDone), funcID, std::forward<Args>(args)...);
+
+		dispatch(std::move(buffer), id);
+		return id;
 	}
 
+#ifdef RPC_HAS_COROUTINES
+	template <typename R, typename FuncID, typename... Args>
+	auto co_call(const FuncID& funcID, Args&&... args)
+	{
+		return make_awaitable<R>([this, funcID, args = std::make_tuple(std::forward<Args>(args)...)](auto&& callback) mutable {
+			std::apply([&](auto&... args) {
+				async_call<R>(std::move(callback), funcID, std::move(args)...);
+			}, args);
+		});
+	}
+#endif
+
 private:
     rpc::Client m_client;
     rpc::Server& m_server;
+
+	/* whatever the server's framing (e.g. that of `TcpServer`), the client takes the frame without the header */
+	void ingest(const msgpack::sbuffer& resp)
+	{
+		const auto& framing = m_server.framing();
+
+		m_client.ingest_resp(framing.body(resp), framing.body_size(resp), true/*last*/);
+	}
+
+	/* the server takes the call in one piece */
+	void dispatch(IoBuffer&& buffer, uint32_t id)
+	{
+		auto gathered = buffer.gather();
+
+		pool::recycle(std::move(buffer));
+		dispatch(std::move(gathered), id);
+	}
+
+	void dispatch(msgpack::sbuffer&& buffer, uint32_t id)
+	{
+		/* a call that joined one in flight (see `SingleFlight`): nothing to handle */
+		if (buffer.size() == 0)
+			return;
+
+		msgpack::sbuffer resp(0);
+
+		try {
+			resp = m_server.handle_call(buffer);
+		} catch (...) {
+			pool::recycle(std::move(buffer));
+
+			/* a call with no return value has no slot to fail: it throws, as it did */
+			if (!m_client.cancel(id, std::current_exception()))
+				throw;
+
+			return;
+		}
+
+		pool::recycle(std::move(buffer));
+
+		if (resp.size() == 0) {
+			/* no return value */
+			return;
+		}
+
+		try {
+			ingest(resp);
+		} catch (...) {
+			m_client.cancel(id, std::move(std::current_exception()));
+		}
+
+		pool::recycle(std::move(resp));
+	}
 };
 
 }
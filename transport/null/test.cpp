@@ -22,6 +22,11 @@ int main()
 		return a + b;
 	});
 
+	server.bind("range", [](rpc::Writer<int>& out, int n) {
+		for (int i = 0; i < n; ++i)
+			out.write(i);
+	});
+
 	try {
 		rpc::NullClient client(server);
 
@@ -30,6 +35,34 @@ int main()
 		int result = client.call<int>("add", 3, 4);
 		std::cout << "Result: " << result << "\n";
 
+		auto future = client.async_call<int>("add", 5, 6);
+		std::cout << "Async result: " << future.get() << "\n";
+
+		client.async_call<int>([](std::exception_ptr exp, int result) {
+			if (exp == nullptr)
+				std::cout << "Callback result: " << result << "\n";
+		}, "add", 7, 8);
+
+		int sum = 0;
+		client.stream_call<int>([&](int chunk) {
+			sum += chunk;
+		}, [&](std::exception_ptr exp) {
+			if (exp == nullptr)
+				std::cout << "Stream sum: " << sum << "\n";
+		}, "range", 10);
+
+		/* a call that the server fails fails its future, and gives its slot back */
+		size_t failed = 0;
+
+		for (size_t i = 0; i < 2 * rpc::CallTable::default_capacity; ++i) {
+			try {
+				client.call<int>("nosuch", 1);
+			} catch (const rpc::ServerError&) {
+				++failed;
+			}
+		}
+
+		std::cout << "Server errors: " << ((failed == 2 * rpc::CallTable::default_capacity) ? "OK" : "FAILED") << "\n";
 	} catch (const rpc::ServerError& ex) {
 		std::cerr << "RPC call failed: " << ex.what() << "\n";
 	} catch (...) {
@@ -0,0 +1,377 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Shared-memory segment for same-host RPC: a slot per client, each holding
+ * a lock-free single-producer/single-consumer ring per direction, and
+ * futex doorbells to sleep on.
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+
+namespace shm {
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+	      "shared-memory atomics must be lock-free");
+
+constexpr size_t cache_line = 64;
+
+/*
+ * A futex the other side rings when there is something to look at.
+ *
+ * A waiter reads `sequence()` before it looks, and sleeps only if the bell
+ * has not been rung since; ringing is a plain increment unless someone
+ * sleeps, so a busy peer pays no system call.
+ */
+struct Bell {
+	std::atomic<uint32_t> seq;
+	std::atomic<uint32_t> waiters;
+
+	uint32_t sequence() const noexcept
+	{
+		return seq.load();
+	}
+
+	void ring() noexcept
+	{
+		seq.fetch_add(1);
+
+		if (waiters.load() > 0)
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+	}
+
+	/* returns on a ring since `sequence()` returned `last`, on timeout, or spuriously */
+	void wait(uint32_t last, std::chrono::milliseconds timeout) noexcept
+	{
+		auto sec = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+		timespec ts{static_cast<time_t>(sec.count()), static_cast<long>(std::chrono::nanoseconds(timeout - sec).count())};
+
+		waiters.fetch_add(1);
+
+		if (seq.load() == last)
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&seq), FUTEX_WAIT, last, &ts, nullptr, 0);
+
+		waiters.fetch_sub(1);
+	}
+};
+
+struct RingControl {
+	alignas(cache_line) std::atomic<uint64_t> head;		/* consumer */
+	alignas(cache_line) std::atomic<uint64_t> tail;		/* producer */
+};
+
+/*
+ * Frames of bytes in a ring of shared memory, one producer and one
+ * consumer. A frame is [length:32][body], padded to 8 bytes, and never
+ * wraps around: when it does not fit before the end, a wrap marker sends
+ * the consumer back to the start. Hence a frame takes at most half the ring.
+ */
+class Ring {
+public:
+	Ring(RingControl& control, char* data, uint32_t size) noexcept
+		:m_control(control)
+		,m_data(data)
+		,m_size(size)
+	{ }
+
+	uint32_t max_frame() const noexcept
+	{
+		return m_size / 2 - header_size;
+	}
+
+	/* producer: `false` if there is no room for the frame (yet) */
+	bool push(const char* data, uint32_t len) noexcept
+	{
+		return push(len, [&](auto&& copy) {
+			copy(data, len);
+		});
+	}
+
+	/*
+	 * The same, of a frame of `len` bytes in segments, gathered straight
+	 * into the ring: `segments(copy)` calls `copy(data, size)` on each
+	 */
+	template <typename Segments>
+	bool push(uint32_t len, Segments&& segments) noexcept
+	{
+		uint64_t tail = m_control.tail.load(std::memory_order_relaxed);
+		uint64_t head = m_control.head.load(std::memory_order_acquire);
+		uint32_t needed = frame_size(len);
+		uint32_t offset = tail % m_size;
+		uint32_t contiguous = m_size - offset;
+		uint32_t skip = (needed > contiguous) ? contiguous : 0;
+
+		if ((len > max_frame()) || ((tail - head) + skip + needed > m_size))
+			return false;
+
+		if (skip > 0) {
+			store_length(offset, wrap_marker);
+			offset = 0;
+		}
+
+		store_length(offset, len);
+
+		char* dest = m_data + offset + header_size;
+
+		segments([&](const char* data, size_t size) {
+			std::memcpy(dest, data, size);
+			dest += size;
+		});
+
+		m_control.tail.store(tail + skip + needed, std::memory_order_release);
+		return true;
+	}
+
+	/* consumer: the next frame, in place, or `nullptr` */
+	const char* front(uint32_t& len) noexcept
+	{
+		uint64_t head = m_control.head.load(std::memory_order_relaxed);
+
+		for (;;) {
+			if (head == m_control.tail.load(std::memory_order_acquire))
+				return nullptr;
+
+			uint32_t offset = head % m_size;
+			std::memcpy(&len, m_data + offset, sizeof(len));
+
+			if (len != wrap_marker)
+				return m_data + offset + header_size;
+
+			head += m_size - offset;
+			m_control.head.store(head, std::memory_order_release);
+		}
+	}
+
+	/* consumer: done with the frame `front()` returned */
+	void pop(uint32_t len) noexcept
+	{
+		uint64_t head = m_control.head.load(std::memory_order_relaxed);
+
+		m_control.head.store(head + frame_size(len), std::memory_order_release);
+	}
+
+	bool empty() const noexcept
+	{
+		return m_control.head.load(std::memory_order_acquire) == m_control.tail.load(std::memory_order_acquire);
+	}
+
+	/* neither side may be using the ring */
+	void reset() noexcept
+	{
+		m_control.head = 0;
+		m_control.tail = 0;
+	}
+
+private:
+	static constexpr uint32_t header_size = 8;
+	static constexpr uint32_t wrap_marker = UINT32_MAX;
+
+	RingControl& m_control;
+	char* m_data;
+	uint32_t m_size;
+
+	static uint32_t frame_size(uint32_t len) noexcept
+	{
+		return (header_size + len + 7) & ~7u;
+	}
+
+	void store_length(uint32_t offset, uint32_t len) noexcept
+	{
+		std::memcpy(m_data + offset, &len, sizeof(len));
+	}
+};
+
+enum SlotState : uint32_t {
+	Free = 0,
+	Attached,
+	Dropped,	/* by the server, on a bad request */
+	Detached,	/* by the client, for the server to reclaim */
+};
+
+struct SlotControl {
+	alignas(cache_line) std::atomic<uint32_t> state;
+	std::atomic<int32_t> pid;
+	std::atomic<uint32_t> serverBlocked;	/* the response ring is full */
+	alignas(cache_line) Bell responses;		/* rung by the server */
+	alignas(cache_line) Bell space;		/* rung by the server, on room in the request ring */
+	RingControl request;
+	RingControl response;
+};
+
+struct Header {
+	uint32_t magic;
+	uint32_t slots;
+	uint32_t ringSize;
+	int32_t serverPid;
+	std::atomic<uint32_t> closed;
+	alignas(cache_line) Bell bell;		/* rung by the clients */
+};
+
+/*
+ * The mapping: [Header][SlotControl x slots][request ring, response ring x slots]
+ *
+ * The server creates (and eventually removes) the segment, clients open it.
+ */
+class Segment {
+public:
+	static constexpr uint32_t magic = 0x52504331;	/* "RPC1" */
+
+	/* create, replacing a stale segment of the same name; `ringSize` must be a power of 2 */
+	Segment(const std::string& name, uint32_t slots, uint32_t ringSize)
+		:m_name(name)
+		,m_owner(true)
+	{
+		if ((ringSize < 4096) || (ringSize & (ringSize - 1)))
+			throw std::invalid_argument("shm ring size must be a power of 2, 4K at least");
+
+		shm_unlink(name.c_str());
+
+		int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+		if (fd < 0)
+			throw std::runtime_error("shm_open() failed: " + name);
+
+		m_size = layout_size(slots, ringSize);
+
+		if (ftruncate(fd, m_size) < 0) {
+			close(fd);
+			shm_unlink(name.c_str());
+			throw std::runtime_error("ftruncate() failed: " + name);
+		}
+
+		map(fd);
+
+		/* fresh pages are zeroed: all slots free, all rings empty */
+		auto header = new (m_base) Header{};
+		header->slots = slots;
+		header->ringSize = ringSize;
+		header->serverPid = getpid();
+
+		for (uint32_t i = 0; i < slots; ++i)
+			new (&slot(i)) SlotControl{};
+
+		std::atomic_thread_fence(std::memory_order_release);
+		header->magic = magic;
+	}
+
+	/* open an existing segment */
+	explicit Segment(const std::string& name)
+		:m_name(name)
+		,m_owner(false)
+	{
+		int fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+		if (fd < 0)
+			throw std::runtime_error("client: no shared-memory server: " + name);
+
+		struct stat st;
+		if ((fstat(fd, &st) < 0) || (size_t(st.st_size) < sizeof(Header))) {
+			close(fd);
+			throw std::runtime_error("client: bad shared-memory segment: " + name);
+		}
+
+		m_size = st.st_size;
+		map(fd);
+
+		if ((header().magic != magic) || (layout_size(header().slots, header().ringSize) != m_size)) {
+			munmap(m_base, m_size);
+			throw std::runtime_error("client: bad shared-memory segment: " + name);
+		}
+	}
+
+	~Segment()
+	{
+		munmap(m_base, m_size);
+
+		if (m_owner)
+			shm_unlink(m_name.c_str());
+	}
+
+	Segment(const Segment&) = delete;
+	Segment& operator=(const Segment&) = delete;
+
+	Header& header() const noexcept
+	{
+		return *static_cast<Header*>(m_base);
+	}
+
+	uint32_t slots() const noexcept
+	{
+		return header().slots;
+	}
+
+	SlotControl& slot(uint32_t index) const noexcept
+	{
+		return reinterpret_cast<SlotControl*>(static_cast<char*>(m_base) + header_size())[index];
+	}
+
+	Ring requests(uint32_t index) const noexcept
+	{
+		return Ring(slot(index).request, ring_data(index), header().ringSize);
+	}
+
+	Ring responses(uint32_t index) const noexcept
+	{
+		return Ring(slot(index).response, ring_data(index) + header().ringSize, header().ringSize);
+	}
+
+private:
+	std::string m_name;
+	bool m_owner;
+	void* m_base = nullptr;
+	size_t m_size = 0;
+
+	static constexpr size_t header_size() noexcept
+	{
+		return (sizeof(Header) + cache_line - 1) & ~(cache_line - 1);
+	}
+
+	static size_t layout_size(uint32_t slots, uint32_t ringSize) noexcept
+	{
+		return header_size() + size_t(slots) * sizeof(SlotControl) + size_t(slots) * 2 * ringSize;
+	}
+
+	char* ring_data(uint32_t index) const noexcept
+	{
+		return static_cast<char*>(m_base) + header_size() + size_t(slots()) * sizeof(SlotControl) +
+		       size_t(index) * 2 * header().ringSize;
+	}
+
+	void map(int fd)
+	{
+		m_base = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (m_base == MAP_FAILED) {
+			if (m_owner)
+				shm_unlink(m_name.c_str());
+
+			throw std::runtime_error("shared-memory mmap() failed: " + m_name);
+		}
+	}
+};
+
+/* whether the process that attached is still there */
+inline bool alive(int32_t pid) noexcept
+{
+	return (pid <= 0) || (kill(pid, 0) == 0) || (errno != ESRCH);
+}
+
+}
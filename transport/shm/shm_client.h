@@ -0,0 +1,291 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Shared-memory transport implementation for RPC client
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "rpc/client.h"
+#include "rpc/awaitable.h"
+#include "segment.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+
+namespace rpc {
+
+/*
+ * A client of a same-host `ShmServer`: the calling threads write their
+ * frames into the request ring of the client's slot, a reader thread
+ * ingests the responses straight out of the response ring.
+ */
+class ShmClient {
+public:
+	struct Options {
+		std::chrono::microseconds busyPoll{0};	/* the reader spins that long before going to sleep */
+	};
+
+	ShmClient(const std::string& name)
+		:ShmClient(name, Options())
+	{ }
+
+	ShmClient(const std::string& name, const Options& options)
+		:m_segment(name)
+		,m_options(options)
+		,m_index(attach())
+		,m_requests(m_segment.requests(m_index))
+		,m_responses(m_segment.responses(m_index))
+	{
+		m_reader = std::thread([this] {
+			receive_loop();
+		});
+	}
+
+	~ShmClient()
+	{
+		auto& slot = m_segment.slot(m_index);
+
+		m_stop = true;
+		slot.responses.ring();
+		m_reader.join();
+
+		/* the server reclaims the slot */
+		slot.state = shm::Detached;
+		m_segment.header().bell.ring();
+	}
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	R call(const FuncID& funcID, Args&&... args)
+	{
+		return async_call<R>(funcID, std::forward<Args>(args)...).get();
+	}
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	std::future<R> async_call(const FuncID& funcID, Args&&... args)
+	{
+		auto [future, buffer, id] = m_client.call<R>(funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), id);
+		return std::move(future);
+	}
+
+	/*
+	 * The callback is invoked on the reader thread (see `Client::call()`)
+	 */
+	template <typename R, typename Callback, typename FuncID, typename... Args,
+		  std::enable_if_t<!is_func_id_v<Callback>, int> = 0>
+	uint32_t async_call(Callback&& callback, const FuncID& funcID, Args&&... args)
+	{
+		auto [buffer, id] = m_client.call<R>(std::forward<Callback>(callback), funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), id);
+		return id;
+	}
+
+	/*
+	 * Batch calls (see `Client::Batch`): the calls go out in a single frame
+	 * upon `call_batch()`, their futures/callbacks complete on the reader thread
+	 */
+	Client::Batch batch()
+	{
+		return m_client.batch();
+	}
+
+	void call_batch(Client::Batch&& batch)
+	{
+		auto [buffer, ids] = m_client.call_batch(std::move(batch));
+		if (ids.empty())
+			return;
+
+		send(std::move(buffer), ids.data(), ids.size());
+	}
+
+	/*
+	 * Streaming call (see `Client::stream_call()`): the chunks are delivered
+	 * on the reader thread as they arrive
+	 */
+	template <typename T, typename OnChunk, typename OnDone, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	uint32_t stream_call(OnChunk&& onChunk, OnDone&& onDone, const FuncID& funcID, Args&&... args)
+	{
+		auto [buffer, id] = m_client.stream_call<T>(std::forward<OnChunk>(onChunk), std::forward<OnDone>(onDone), funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), id);
+		return id;
+	}
+
+#ifdef RPC_HAS_COROUTINES
+	/*
+	 * The coroutine is resumed on the reader thread
+	 */
+	template <typename R, typename FuncID, typename... Args>
+	auto co_call(const FuncID& funcID, Args&&... args)
+	{
+		return make_awaitable<R>([this, funcID, args = std::make_tuple(std::forward<Args>(args)...)](auto&& callback) mutable {
+			std::apply([&](auto&... args) {
+				async_call<R>(std::move(callback), funcID, std::move(args)...);
+			}, args);
+		});
+	}
+#endif
+
+private:
+	rpc::Client m_client;
+	shm::Segment m_segment;
+	Options m_options;
+	uint32_t m_index;
+
+	/* the calling threads take turns producing requests */
+	shm::Ring m_requests;
+	std::mutex m_sendMutex;
+
+	/* reader thread only */
+	shm::Ring m_responses;
+
+	std::atomic<bool> m_stop{false};
+	std::atomic<bool> m_closed{false};
+	std::thread m_reader;
+
+	/* take a free slot */
+	uint32_t attach()
+	{
+		if (m_segment.header().closed)
+			throw ConnectionError("client: connection closed");
+
+		for (uint32_t i = 0; i < m_segment.slots(); ++i) {
+			auto& slot = m_segment.slot(i);
+			uint32_t state = shm::Free;
+
+			if (slot.state.compare_exchange_strong(state, shm::Attached)) {
+				slot.pid = getpid();
+				return i;
+			}
+		}
+
+		throw std::runtime_error("client: no free slot on the server");
+	}
+
+	/* `Buffer`: `msgpack::sbuffer`, or `IoBuffer` for a call with view arguments */
+	template <typename Buffer>
+	void send(Buffer&& buffer, uint32_t id)
+	{
+		/* a call that joined one in flight (see `SingleFlight`): nothing to send */
+		if (buffer.size() == 0)
+			return;
+
+		send(std::move(buffer), &id, 1);
+	}
+
+	template <typename Buffer>
+	void send(Buffer&& buffer, const uint32_t* ids, size_t count)
+	{
+		auto& slot = m_segment.slot(m_index);
+		bool sent = false;
+
+		if (buffer.size() > m_requests.max_frame()) {
+			pool::recycle(std::move(buffer));
+
+			for (size_t i = 0; i < count; ++i)
+				m_client.cancel(ids[i], std::runtime_error("client: frame too large"));
+
+			return;
+		}
+
+		{
+			std::lock_guard lock(m_sendMutex);
+
+			while (!m_closed) {
+				uint32_t seq = slot.space.sequence();
+
+				bool pushed = m_requests.push(buffer.size(), [&](auto&& copy) {
+					for_each_segment(buffer, copy);
+				});
+
+				if (pushed) {
+					sent = true;
+					break;
+				}
+
+				/* the server is behind: wait for room */
+				slot.space.wait(seq, std::chrono::milliseconds(100));
+			}
+		}
+
+		pool::recycle(std::move(buffer));
+
+		if (sent)
+			m_segment.header().bell.ring();
+
+		/*
+		 * The reader sets `m_closed` before failing the outstanding calls,
+		 * so a call registered after that is failed here.
+		 */
+		if (!sent || m_closed) {
+			for (size_t i = 0; i < count; ++i)
+				m_client.cancel(ids[i], ConnectionError("client: connection closed"));
+		}
+	}
+
+	void receive_loop() noexcept
+	{
+		auto& header = m_segment.header();
+		auto& slot = m_segment.slot(m_index);
+		auto idleSince = std::chrono::steady_clock::now();
+
+		while (!m_stop) {
+			uint32_t seq = slot.responses.sequence();
+			bool received = false;
+
+			const char* data;
+			uint32_t len;
+
+			while ((data = m_responses.front(len)) != nullptr) {
+				try {
+					m_client.ingest_resp(data, len);
+				} catch (...) {
+					/* response to a cancelled call, or a malformed one: drop it */
+				}
+
+				m_responses.pop(len);
+				received = true;
+			}
+
+			if (received) {
+				/* made room for the responses the server holds (see `ShmServer`) */
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (slot.serverBlocked.load())
+					header.bell.ring();
+
+				idleSince = std::chrono::steady_clock::now();
+				continue;
+			}
+
+			if (header.closed || (slot.state.load() != shm::Attached))
+				break;
+
+			if (std::chrono::steady_clock::now() - idleSince < m_options.busyPoll)
+				continue;
+
+			/* the timeout is for noticing a server that died */
+			slot.responses.wait(seq, std::chrono::milliseconds(100));
+
+			if ((slot.responses.sequence() == seq) && !shm::alive(header.serverPid))
+				break;
+		}
+
+		m_closed = true;
+		m_client.cancel_all(std::make_exception_ptr(ConnectionError("client: connection closed")));
+
+		/* a sender may be waiting for room */
+		slot.space.ring();
+	}
+};
+
+}
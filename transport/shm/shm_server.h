@@ -0,0 +1,222 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Shared-memory transport implementation for RPC server
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "rpc/server.h"
+#include "segment.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <vector>
+
+
+namespace rpc {
+
+/*
+ * Same-host clients (see `ShmClient`) attach to a slot of a shared-memory
+ * segment; a single thread takes the requests straight out of the request
+ * rings, handles them inline, and writes the responses into the response
+ * rings. No system call on the way unless a side is asleep.
+ *
+ * A client whose response ring is full is not served until it makes room,
+ * the responses that did not fit wait on the side.
+ */
+class ShmServer : public rpc::Server {
+public:
+	struct Options {
+		uint32_t slots = 16;				/* clients at a time */
+		uint32_t ringSize = 1024 * 1024;		/* per direction, a power of 2 */
+		std::chrono::microseconds busyPoll{0};		/* spin that long before going to sleep */
+	};
+
+	ShmServer(const std::string& name)
+		:ShmServer(name, Options())
+	{ }
+
+	ShmServer(const std::string& name, const Options& options)
+		:m_segment(name, options.slots, options.ringSize)
+		,m_options(options)
+		,m_backlog(options.slots)
+	{ }
+
+	~ShmServer()
+	{
+		close_segment();
+	}
+
+	void run(Server& server)
+	{
+		auto& header = m_segment.header();
+		auto idleSince = std::chrono::steady_clock::now();
+
+		while (!m_stop) {
+			uint32_t seq = header.bell.sequence();
+			bool busy = false;
+
+			for (uint32_t i = 0; i < m_segment.slots(); ++i)
+				busy |= serve(i);
+
+			if (busy) {
+				idleSince = std::chrono::steady_clock::now();
+				continue;
+			}
+
+			if (std::chrono::steady_clock::now() - idleSince < m_options.busyPoll)
+				continue;
+
+			/* the timeout is for reaping the slots of clients that died */
+			header.bell.wait(seq, std::chrono::milliseconds(100));
+
+			if (header.bell.sequence() == seq)
+				reap();
+		}
+
+		close_segment();
+	}
+
+	/*
+	 * Make `run()` return; callable from any thread
+	 */
+	void stop() noexcept
+	{
+		m_stop = true;
+		m_segment.header().bell.ring();
+	}
+
+private:
+	shm::Segment m_segment;
+	Options m_options;
+	std::atomic<bool> m_stop{false};
+
+	/* per slot: the responses that did not fit in the response ring */
+	std::vector<std::deque<std::vector<char>>> m_backlog;
+
+	/* handle whatever the client of slot `index` sent; returns `false` if there was nothing to do */
+	bool serve(uint32_t index) noexcept
+	{
+		auto& slot = m_segment.slot(index);
+
+		switch (slot.state.load(std::memory_order_acquire)) {
+		case shm::Attached:
+			break;
+
+		case shm::Detached:
+			release(index);
+			return true;
+
+		default:
+			return false;
+		}
+
+		auto requests = m_segment.requests(index);
+		auto responses = m_segment.responses(index);
+		auto& backlog = m_backlog[index];
+		bool responded = drain(responses, backlog);
+		bool consumed = false;
+
+		const char* data;
+		uint32_t len;
+
+		while (backlog.empty() && ((data = requests.front(len)) != nullptr)) {
+			try {
+				handle_call(data, len, [&](msgpack::sbuffer&& resp) {
+					if (resp.size() > responses.max_frame())
+						throw ServerError("response too large for the ring");
+
+					if (backlog.empty() && responses.push(resp.data(), resp.size()))
+						responded = true;
+					else
+						backlog.emplace_back(resp.data(), resp.data() + resp.size());
+
+					pool::recycle(std::move(resp));
+				});
+			} catch (...) {
+				/* same as a dying connection thread: drop the client */
+				slot.state = shm::Dropped;
+				slot.responses.ring();
+				return true;
+			}
+
+			requests.pop(len);
+			consumed = true;
+		}
+
+		if (!backlog.empty()) {
+			/* the client rings the bell once it makes room, unless it did meanwhile */
+			slot.serverBlocked.store(1);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			responded |= drain(responses, backlog);
+		} else {
+			slot.serverBlocked.store(0);
+		}
+
+		if (consumed)
+			slot.space.ring();
+
+		if (responded)
+			slot.responses.ring();
+
+		return consumed || responded;
+	}
+
+	static bool drain(shm::Ring& responses, std::deque<std::vector<char>>& backlog) noexcept
+	{
+		bool drained = false;
+
+		while (!backlog.empty() && responses.push(backlog.front().data(), backlog.front().size())) {
+			backlog.pop_front();
+			drained = true;
+		}
+
+		return drained;
+	}
+
+	/* a detached slot is free to attach to again */
+	void release(uint32_t index) noexcept
+	{
+		auto& slot = m_segment.slot(index);
+
+		m_backlog[index].clear();
+		m_segment.requests(index).reset();
+		m_segment.responses(index).reset();
+
+		slot.serverBlocked = 0;
+		slot.pid = 0;
+		slot.state.store(shm::Free, std::memory_order_release);
+	}
+
+	/* detach the clients that are gone without a word */
+	void reap() noexcept
+	{
+		for (uint32_t i = 0; i < m_segment.slots(); ++i) {
+			auto& slot = m_segment.slot(i);
+
+			auto state = slot.state.load();
+
+			if (((state == shm::Attached) || (state == shm::Dropped)) && !shm::alive(slot.pid.load()))
+				release(i);
+		}
+	}
+
+	/* let the clients know: their outstanding calls would never complete */
+	void close_segment() noexcept
+	{
+		auto& header = m_segment.header();
+
+		if (header.closed.exchange(1) != 0)
+			return;
+
+		for (uint32_t i = 0; i < m_segment.slots(); ++i) {
+			m_segment.slot(i).responses.ring();
+			m_segment.slot(i).space.ring();
+		}
+	}
+};
+
+}
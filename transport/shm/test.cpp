@@ -0,0 +1,196 @@
+#include "shm_client.h"
+#include "shm_server.h"
+
+#include <sys/wait.h>
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+static bool rpc_client(const std::string& name, bool verbose)
+{
+	try {
+		rpc::ShmClient client(name);
+
+		int result = client.call<int>("add", 3, 4);
+		if (verbose)
+			std::cout << "Result: " << result << "\n";
+
+		/* many threads share one slot */
+		std::vector<std::thread> threads;
+		std::atomic<int> failed{0};
+
+		for (int t = 0; t < 4; ++t) {
+			threads.emplace_back([&client, &failed, t] {
+				for (int i = 0; i < 1000; ++i) {
+					if (client.call<int>("add", t, i) != (t + i))
+						++failed;
+				}
+			});
+		}
+
+		for (auto& thread : threads)
+			thread.join();
+
+		if (verbose)
+			std::cout << "Pipelined: " << ((failed == 0) ? "OK" : "FAILED") << "\n";
+
+		/* many calls, one frame */
+		auto batch = client.batch();
+		std::vector<std::future<int>> futures;
+
+		for (int i = 0; i < 100; ++i)
+			futures.push_back(batch.call<int>("add", i, 1));
+
+		client.call_batch(std::move(batch));
+
+		int sum = 0;
+		for (auto& future : futures)
+			sum += future.get();
+
+		if (verbose)
+			std::cout << "Batch sum: " << sum << "\n";
+
+		/* more than the response ring holds: the server waits for room */
+		std::promise<void> streamed;
+		long streamSum = 0;
+
+		client.stream_call<int>([&](int chunk) {
+			streamSum += chunk;
+		}, [&](std::exception_ptr exp) {
+			if (exp != nullptr)
+				streamed.set_exception(exp);
+			else
+				streamed.set_value();
+		}, "range", 200000);
+
+		streamed.get_future().get();
+
+		if (verbose)
+			std::cout << "Stream sum: " << streamSum << "\n";
+
+		std::string big(200 * 1000, 'x');
+		bool echoed = (client.call<std::string>("echo", big) == big);
+
+		if (verbose)
+			std::cout << "Large echo: " << (echoed ? "OK" : "FAILED") << "\n";
+
+		return (result == 7) && (failed == 0) && (sum == 5050) && (streamSum == 19999900000L) && echoed;
+	} catch (const std::exception& ex) {
+		std::cerr << "RPC call failed: " << ex.what() << "\n";
+	} catch (...) {
+		std::cerr << "RPC call failed\n";
+	}
+
+	return false;
+}
+
+static void bind_functions(rpc::Server& server)
+{
+	server.bind("add", [](int a, int b) {
+		return a + b;
+	});
+
+	server.bind("echo", [](std::string msg) {
+		return msg;
+	});
+
+	server.bind("range", [](rpc::Writer<int>& out, int n) {
+		for (int i = 0; i < n; ++i)
+			out.write(i);
+	});
+}
+
+/*
+ * The server in this process, `clients` client processes at once
+ */
+static int multi_process(const std::string& name, int clients)
+{
+	rpc::ShmServer server(name);
+	bind_functions(server);
+
+	std::vector<pid_t> children;
+
+	/* fork before any thread is started */
+	for (int i = 0; i < clients; ++i) {
+		pid_t pid = fork();
+
+		if (pid == 0)
+			_exit(rpc_client(name, false) ? 0 : 1);
+
+		if (pid > 0)
+			children.push_back(pid);
+	}
+
+	std::thread serverThread([&server] {
+		server.run(server);
+	});
+
+	int passed = 0;
+
+	for (auto pid : children) {
+		int status;
+
+		if ((waitpid(pid, &status, 0) == pid) && WIFEXITED(status) && (WEXITSTATUS(status) == 0))
+			++passed;
+	}
+
+	server.stop();
+	serverThread.join();
+
+	std::cout << "Multi-process: " << passed << "/" << clients << " clients OK\n";
+	return (passed == clients) ? 0 : 1;
+}
+
+static std::string parse_name(int argc, char* argv[])
+{
+	return (argc > 2) ? argv[2] : "/rpc_for_dummies";
+}
+
+int main(int argc, char* argv[])
+{
+	if ((argc > 1) && (std::string(argv[1]) == "--server")) {
+		try {
+			rpc::ShmServer server(parse_name(argc, argv));
+
+			bind_functions(server);
+			server.run(server);
+		} catch (const std::exception& ex) {
+			std::cerr << "RPC server failed: " << ex.what() << "\n";
+		}
+
+		return 0;
+	}
+
+	if ((argc > 1) && (std::string(argv[1]) == "--client")) {
+		return rpc_client(parse_name(argc, argv), true) ? 0 : 1;
+	}
+
+	if ((argc > 1) && (std::string(argv[1]) == "--multi")) {
+		int clients = 4;
+
+		if (argc > 3) {
+			try {
+				clients = std::stoi(argv[3]);
+			} catch (const std::exception& ex) {
+				std::cerr << "Invalid number of clients: " << argv[3] << "\n";
+				return 1;
+			}
+		}
+
+		try {
+			return multi_process(parse_name(argc, argv), clients);
+		} catch (const std::exception& ex) {
+			std::cerr << "RPC server failed: " << ex.what() << "\n";
+			return 1;
+		}
+	}
+
+	std::cerr << "Shared-memory RPC test\n";
+	std::cerr << "Command line options:\n";
+	std::cerr << "  --server [name]             invoke RPC server\n";
+	std::cerr << "  --client [name]             invoke RPC client\n";
+	std::cerr << "  --multi [name [clients]]    invoke the server, and client processes\n";
+	return 1;
+}
@@ -8,61 +8,270 @@
 #pragma once
 
 #include "rpc/client.h"
+#include "rpc/awaitable.h"
 #include "utils.h"
 
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include <thread>
+#include <mutex>
+#include <atomic>
 
 
 namespace rpc {
 
 class TcpClient {
 public:
-	TcpClient(const std::string& host, uint16_t port)
+	enum class Mode {
+		/* one call in flight at a time, each on its own transaction thread */
+		Synchronous,
+		/* any number of calls in flight, responses collected by a single reader thread */
+		Pipelined,
+	};
+
+	/*
+	 * A synchronous client switches to pipelined mode upon the first `async_call()`,
+	 * or the first call with a deadline
+	 */
+	TcpClient(const std::string& host, uint16_t port, Mode mode = Mode::Synchronous, uint32_t maxFrameSize = tcp::max_frame_size)
 		:m_sock(tcp::client_socket(host, port))
-	{ }
+		,m_maxFrameSize(maxFrameSize)
+		,m_client(CallTable::default_capacity, TimerWheel::shared(), tcp::framing)
+	{
+		if (mode == Mode::Pipelined)
+			start_reader();
+	}
 
 	~TcpClient()
 	{
+		if (m_reader.joinable()) {
+			/* wake up the reader */
+			shutdown(m_sock, SHUT_RDWR);
+			m_reader.join();
+		}
+
 		close(m_sock);
 	}
 
-	template <typename R, typename... Args>
-	R call(const std::string& funcID, Args&&... args)
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	R call(const FuncID& funcID, Args&&... args)
+	{
+		/* a call with a deadline (see `Deadline`) must not wait on the socket: it goes pipelined */
+		if (!m_pipelined && !is_deadline_v<FuncID>) {
+			std::unique_lock lock(m_syncMutex);
+
+			if (!m_pipelined)
+				return sync_call<R>(funcID, std::forward<Args>(args)...);
+		}
+
+		return async_call<R>(funcID, std::forward<Args>(args)...).get();
+	}
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	std::future<R> async_call(const FuncID& funcID, Args&&... args)
+	{
+		start_reader();
+
+		auto [future, buffer, id] = m_client.call<R>(funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), id);
+		return std::move(future);
+	}
+
+	/*
+	 * The callback is invoked on the reader thread (see `Client::call()`)
+	 */
+	template <typename R, typename Callback, typename FuncID, typename... Args,
+		  std::enable_if_t<!is_func_id_v<Callback>, int> = 0>
+	uint32_t async_call(Callback&& callback, const FuncID& funcID, Args&&... args)
+	{
+		start_reader();
+
+		auto [buffer, id] = m_client.call<R>(std::forward<Callback>(callback), funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), id);
+		return id;
+	}
+
+	/*
+	 * Batch calls (see `Client::Batch`): the calls go out in a single frame
+	 * upon `call_batch()`, their futures/callbacks complete on the reader thread
+	 */
+	Client::Batch batch()
+	{
+		return m_client.batch();
+	}
+
+	void call_batch(Client::Batch&& batch)
+	{
+		start_reader();
+
+		auto [buffer, ids] = m_client.call_batch(std::move(batch));
+		if (ids.empty())
+			return;
+
+		send(std::move(buffer), ids.data(), ids.size());
+	}
+
+	/*
+	 * Streaming call (see `Client::stream_call()`): the chunks are delivered
+	 * on the reader thread as they arrive
+	 */
+	template <typename T, typename OnChunk, typename OnDone, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	uint32_t stream_call(OnChunk&& onChunk, OnDone&& onDone, const FuncID& funcID, Args&&... args)
+	{
+		start_reader();
+
+		auto [buffer, id] = m_client.stream_call<T>(std::forward<OnChunk>(onChunk), std::forward<OnDone>(onDone), funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), id);
+		return id;
+	}
+
+	/* a call made with the callback flavour of `async_call()`, see `Client::cancel()` */
+	bool cancel(uint32_t id) noexcept
+	{
+		return m_client.cancel(id, ClientError("call cancelled"));
+	}
+
+	/* pipelined mode: the connection is gone, and so are the calls that were on it */
+	bool closed() const noexcept
+	{
+		return m_closed;
+	}
+
+#ifdef RPC_HAS_COROUTINES
+	/*
+	 * The coroutine is resumed on the reader thread
+	 */
+	template <typename R, typename FuncID, typename... Args>
+	auto co_call(const FuncID& funcID, Args&&... args)
+	{
+		return make_awaitable<R>([this, funcID, args = std::make_tuple(std::forward<Args>(args)...)](auto&& callback) mutable {
+			std::apply([&](auto&... args) {
+				async_call<R>(std::move(callback), funcID, std::move(args)...);
+			}, args);
+		});
+	}
+#endif
+
+private:
+	int m_sock;
+	uint32_t m_maxFrameSize;
+	rpc::Client m_client;
+	std::mutex m_syncMutex;
+	std::vector<char> m_syncBuffer;
+
+	/* pipelined mode */
+	std::atomic<bool> m_pipelined{false};
+	std::thread m_reader;
+	std::mutex m_sendMutex;
+	std::atomic<bool> m_closed{false};
+
+	template <typename R, typename FuncID, typename... Args>
+	R sync_call(const FuncID& funcID, Args&&... args)
 	{
 		auto [future, buffer, id] = m_client.call<R>(funcID, std::forward<Args>(args)...);
 
 		auto transaction = std::async(std::launch::async, [&] {
-			tcp::send_buffer(m_sock, buffer.data(), buffer.size());
+			if (!tcp::send_frame(m_sock, buffer)) {
+				m_client.cancel(id, ConnectionError("client: connection closed"));
+				return;
+			}
 
 			if constexpr (std::is_same_v<R, void>) {
 				/* no return value, do not wait */
 				return;
 			}
 
-			auto respBuffer = tcp::recv_buffer(m_sock);
-			if (respBuffer.empty()) {
-				m_client.cancel(id, std::runtime_error("client: no response"));
+			if (!tcp::recv_buffer(m_sock, m_syncBuffer, m_maxFrameSize)) {
+				m_client.cancel(id, ConnectionError("client: no response"));
 				return;
 			}
 
 			try {
-				msgpack::sbuffer resp;
-				resp.write(respBuffer.data(), respBuffer.size());
-				m_client.ingest_resp(resp, true/*last*/);
+				m_client.ingest_resp(m_syncBuffer.data(), m_syncBuffer.size(), true/*last*/);
 			} catch (...) {
 				m_client.cancel(id, std::move(std::current_exception()));
 			}
 		});
 
+		transaction.wait();
+		pool::recycle(std::move(buffer));
+
 		return future.get();
 	}
 
-private:
-	int m_sock;
-	rpc::Client m_client;
+	void start_reader()
+	{
+		if (m_pipelined)
+			return;
+
+		/* wait for a synchronous call in progress, if any */
+		std::lock_guard lock(m_syncMutex);
+
+		if (m_pipelined)
+			return;
+
+		m_reader = std::thread([this] {
+			receive_loop();
+		});
+
+		m_pipelined = true;
+	}
+
+	/* `Buffer`: `msgpack::sbuffer`, or `IoBuffer` for a call with view arguments */
+	template <typename Buffer>
+	void send(Buffer&& buffer, uint32_t id)
+	{
+		/* a call that joined one in flight (see `SingleFlight`): nothing to send */
+		if (buffer.size() == 0)
+			return;
+
+		send(std::move(buffer), &id, 1);
+	}
+
+	template <typename Buffer>
+	void send(Buffer&& buffer, const uint32_t* ids, size_t count)
+	{
+		bool sent;
+
+		{
+			std::lock_guard lock(m_sendMutex);
+			sent = tcp::send_frame(m_sock, buffer);
+		}
+
+		pool::recycle(std::move(buffer));
+
+		/*
+		 * The reader sets `m_closed` before failing the outstanding calls,
+		 * so a call registered after that is failed here.
+		 */
+		if (!sent || m_closed) {
+			for (size_t i = 0; i < count; ++i)
+				m_client.cancel(ids[i], ConnectionError("client: connection closed"));
+		}
+	}
+
+	void receive_loop() noexcept
+	{
+		std::vector<char> respBuffer;
+
+		while (tcp::recv_buffer(m_sock, respBuffer, m_maxFrameSize)) {
+			try {
+				m_client.ingest_resp(respBuffer.data(), respBuffer.size(), true/*last*/);
+			} catch (...) {
+				/* response to a cancelled call, or a malformed one: drop it */
+			}
+		}
+
+		m_closed = true;
+		m_client.cancel_all(std::make_exception_ptr(ConnectionError("client: connection closed")));
+	}
 };
 
 }
-
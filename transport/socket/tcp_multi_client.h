@@ -9,71 +9,478 @@
 #pragma once
 
 #include "rpc/client.h"
+#include "rpc/awaitable.h"
 #include "utils.h"
 
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstring>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
+#include <map>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <set>
+#include <tuple>
+#include <unordered_map>
 
 
 namespace rpc {
 
+/*
+ * A call goes out to all the servers at once; a reader thread waits on all
+ * of them, and ingests the responses in their arrival order. The call
+ * completes according to its `Completion` (all the servers by default).
+ *
+ * A server that does not respond in time (see `Options::timeout`, and the
+ * `Deadline` of the call, if any), or is gone, counts as a failed response
+ * of that server (see `Client::ingest_error()`).
+ */
 class TcpMultiClient {
 public:
+	struct Options {
+		std::chrono::milliseconds timeout{0};	/* per server response; 0 for none */
+		uint32_t maxFrameSize = tcp::max_frame_size;	/* a longer response drops the server */
+	};
+
 	TcpMultiClient(const std::string& host, const std::vector<uint16_t>& ports)
+		:TcpMultiClient(host, ports, Options())
+	{ }
+
+	TcpMultiClient(const std::string& host, const std::vector<uint16_t>& ports, const Options& options)
+		:m_options(options)
+		,m_client(CallTable::default_capacity, TimerWheel::shared(), tcp::framing)
+		,m_wake(eventfd(0, EFD_CLOEXEC))
 	{
+		if (m_wake < 0)
+			throw std::runtime_error("eventfd() failed");
+
 		for (auto port : ports) {
 			int new_sock = tcp::client_socket(host, port);
 			if (new_sock != -1) {
-				m_socks.insert(new_sock);
+				m_socks.push_back(new_sock);
+				m_live.insert(new_sock);
 			}
 		}
+
+		m_reader = std::thread([this] {
+			receive_loop();
+		});
 	}
 
 	~TcpMultiClient()
 	{
+		m_stop = true;
+		wake();
+
+		m_reader.join();
+
 		for (auto sock : m_socks) {
 			close(sock);
 		}
+
+		close(m_wake);
+	}
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	auto call(const FuncID& funcID, Args&&... args)
+	{
+		return async_call<R>(funcID, std::forward<Args>(args)...).get();
+	}
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	auto call(Completion completion, const FuncID& funcID, Args&&... args)
+	{
+		return async_call<R>(completion, funcID, std::forward<Args>(args)...).get();
+	}
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	auto async_call(const FuncID& funcID, Args&&... args)
+	{
+		return async_call<R>(Completion::all(), funcID, std::forward<Args>(args)...);
 	}
 
-	template <typename R, typename... Args>
-	auto call(const std::string& funcID, Args&&... args)
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	auto async_call(Completion completion, const FuncID& funcID, Args&&... args)
 	{
-		auto [future, buffer, id] = m_client.multi_call<R>(funcID, std::forward<Args>(args)...);
+		auto [future, buffer, id] = m_client.multi_call<R>(completion, funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), id, !std::is_same_v<R, void>, expiry_of(funcID));
+		return std::move(future);
+	}
+
+	/*
+	 * The callback is invoked on the reader thread (see `Client::multi_call()`)
+	 */
+	template <typename R, typename Callback, typename FuncID, typename... Args,
+		  std::enable_if_t<!is_func_id_v<Callback> && !is_completion_v<Callback>, int> = 0>
+	uint32_t async_call(Callback&& callback, const FuncID& funcID, Args&&... args)
+	{
+		return async_call<R>(Completion::all(), std::forward<Callback>(callback), funcID, std::forward<Args>(args)...);
+	}
+
+	template <typename R, typename Callback, typename FuncID, typename... Args,
+		  std::enable_if_t<!is_func_id_v<Callback>, int> = 0>
+	uint32_t async_call(Completion completion, Callback&& callback, const FuncID& funcID, Args&&... args)
+	{
+		auto [buffer, id] = m_client.multi_call<R>(completion, std::forward<Callback>(callback), funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), id, !std::is_same_v<R, void>, expiry_of(funcID));
+		return id;
+	}
+
+#ifdef RPC_HAS_COROUTINES
+	template <typename R, typename FuncID, typename... Args>
+	auto co_call(const FuncID& funcID, Args&&... args)
+	{
+		using Result = std::conditional_t<std::is_same_v<R, void>, void, std::vector<R>>;
+
+		return make_awaitable<Result>([this, funcID, args = std::make_tuple(std::forward<Args>(args)...)](auto&& callback) mutable {
+			std::apply([&](auto&... args) {
+				async_call<R>(std::move(callback), funcID, std::move(args)...);
+			}, args);
+		});
+	}
+#endif
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	Options m_options;
+	std::vector<int> m_socks;
+	rpc::Client m_client;
+
+	int m_wake;
+	std::atomic<bool> m_stop{false};
+	std::thread m_reader;
+	std::mutex m_sendMutex;
 
-		auto transaction = std::async(std::launch::async, [&] {
-			for (auto sock : m_socks) {
-				tcp::send_buffer(sock, buffer.data(), buffer.size());
+	/*
+	 * The servers still connected, and those yet to respond to each call.
+	 * Only the reader thread settles a call with a server, hence
+	 * a response is never counted twice.
+	 */
+	struct Pending {
+		std::vector<int> socks;
+		Clock::time_point expiry;
+	};
+
+	std::mutex m_mutex;
+	std::set<int> m_live;
+	std::unordered_map<uint32_t, Pending> m_pending;
+
+	/* the calls, by when they time out; `true`: by their `Deadline` */
+	std::multimap<Clock::time_point, std::pair<uint32_t, bool>> m_deadlines;
+
+	/* a server shedding the call past its deadline does not respond at all */
+	template <typename FuncID>
+	static Clock::time_point expiry_of([[maybe_unused]] const FuncID& funcID) noexcept
+	{
+		if constexpr (is_deadline_v<FuncID>)
+			return funcID.expiry();
+		else
+			return Clock::time_point::max();
+	}
+
+	template <typename Buffer>
+	void send(Buffer&& buffer, uint32_t id, bool expectResp, Clock::time_point expiry)
+	{
+		std::vector<int> socks;
+		bool wakeReader = false;
+		bool byDeadline = (expiry != Clock::time_point::max());
+
+		if (m_options.timeout.count() > 0) {
+			auto timeout = Clock::now() + m_options.timeout;
+
+			if (timeout < expiry) {
+				expiry = timeout;
+				byDeadline = false;
 			}
+		}
+
+		{
+			std::lock_guard lock(m_mutex);
+			socks.assign(m_live.begin(), m_live.end());
+
+			if (expectResp && !socks.empty()) {
+				/* complete upon a response from every server */
+				m_client.expect(id, socks.size());
+				m_pending.emplace(id, Pending{socks, expiry});
+
+				if (expiry != Clock::time_point::max()) {
+					/* the reader sleeps until the earliest deadline */
+					wakeReader = m_deadlines.empty() || (expiry < m_deadlines.begin()->first);
+					m_deadlines.emplace(expiry, std::make_pair(id, byDeadline));
+				}
+			}
+		}
+
+		if (socks.empty()) {
+			pool::recycle(std::move(buffer));
+			m_client.cancel(id, std::runtime_error("client: no servers"));
+			return;
+		}
+
+		if (wakeReader)
+			wake();
 
-			if constexpr (std::is_same_v<R, void>) {
-				/* no return value, do not wait */
-				return;
+		{
+			std::lock_guard lock(m_sendMutex);
+
+			for (auto sock : socks) {
+				/* the reader sees the socket go, and fails the calls it owes */
+				if (!tcp::send_frame(sock, buffer))
+					shutdown(sock, SHUT_RDWR);
 			}
+		}
+
+		pool::recycle(std::move(buffer));
+	}
+
+	void wake() noexcept
+	{
+		uint64_t one = 1;
+		[[maybe_unused]] auto ret = write(m_wake, &one, sizeof(one));
+	}
+
+	/* milliseconds to the earliest deadline, for `poll()` */
+	int next_timeout()
+	{
+		std::lock_guard lock(m_mutex);
+
+		if (m_deadlines.empty())
+			return -1;
 
-			size_t currentSock = 0;
-			size_t lastSock = m_socks.size() - 1;
-			for (auto sock : m_socks) {
-				auto respBuffer = tcp::recv_buffer(sock);
-
-				try {
-					msgpack::sbuffer resp;
-					resp.write(respBuffer.data(), respBuffer.size());
-					m_client.ingest_resp(resp, (currentSock++ == lastSock)/*last*/);
-				} catch (...) {
-					m_client.cancel(id, std::move(std::current_exception()));
+		auto left = std::chrono::ceil<std::chrono::milliseconds>(m_deadlines.begin()->first - Clock::now());
+		return std::max<int>(left.count(), 0);
+	}
+
+	/* with `m_mutex` held */
+	auto forget(std::unordered_map<uint32_t, Pending>::iterator it)
+	{
+		if (it->second.expiry != Clock::time_point::max()) {
+			auto [first, last] = m_deadlines.equal_range(it->second.expiry);
+			auto pos = std::find_if(first, last, [id = it->first](const auto& entry) {
+				return entry.second.first == id;
+			});
+
+			if (pos != last)
+				m_deadlines.erase(pos);
+		}
+
+		return m_pending.erase(it);
+	}
+
+	/*
+	 * The server `sock` responded to `callID`. A call that completes upon
+	 * the first responses (see `Completion`) is not waited for any more.
+	 */
+	void settle(uint32_t callID, int sock)
+	{
+		std::lock_guard lock(m_mutex);
+		auto it = m_pending.find(callID);
+
+		if (it == m_pending.end())
+			return;
+
+		auto& socks = it->second.socks;
+		socks.erase(std::remove(socks.begin(), socks.end(), sock), socks.end());
+
+		if (socks.empty() || !m_client.pending(callID))
+			forget(it);
+	}
+
+	/* fail the responses the server `sock` owes */
+	void lose(int sock)
+	{
+		std::vector<uint32_t> failed;
+
+		{
+			std::lock_guard lock(m_mutex);
+			m_live.erase(sock);
+
+			for (auto it = m_pending.begin(); it != m_pending.end(); ) {
+				auto& socks = it->second.socks;
+				auto pos = std::find(socks.begin(), socks.end(), sock);
+
+				if (pos != socks.end()) {
+					socks.erase(pos);
+					failed.push_back(it->first);
 				}
+
+				it = socks.empty() ? forget(it) : std::next(it);
 			}
-		});
+		}
+
+		/* outside the lock: a callback may issue another call */
+		auto exp = std::make_exception_ptr(ConnectionError("client: connection closed"));
+
+		for (auto id : failed) {
+			m_client.ingest_error(id, exp);
+		}
 
-		return future.get();
+		/* the failures may have settled some */
+		std::lock_guard lock(m_mutex);
+
+		for (auto id : failed) {
+			auto it = m_pending.find(id);
+
+			if ((it != m_pending.end()) && !m_client.pending(id))
+				forget(it);
+		}
 	}
 
-private:
-	std::set<int> m_socks;
-	rpc::Client m_client;
+	/* fail the responses still owed to the calls past their deadline */
+	void expire()
+	{
+		std::vector<std::tuple<uint32_t, size_t, bool>> failed;
+		auto now = Clock::now();
+
+		{
+			std::lock_guard lock(m_mutex);
+
+			while (!m_deadlines.empty() && (m_deadlines.begin()->first <= now)) {
+				auto [id, byDeadline] = m_deadlines.begin()->second;
+				auto it = m_pending.find(id);
+
+				if (it != m_pending.end()) {
+					failed.emplace_back(id, it->second.socks.size(), byDeadline);
+					m_pending.erase(it);
+				}
+
+				m_deadlines.erase(m_deadlines.begin());
+			}
+		}
+
+		auto timeout = std::make_exception_ptr(std::runtime_error("client: server timeout"));
+		auto exceeded = std::make_exception_ptr(DeadlineExceeded());
+
+		for (auto [id, missing, byDeadline] : failed) {
+			for (size_t i = 0; i < missing; ++i) {
+				m_client.ingest_error(id, byDeadline ? exceeded : timeout);
+			}
+		}
+	}
+
+	/*
+	 * Whatever the server `sock` has sent so far, without blocking (the socket
+	 * itself blocks, for the senders): a server that stalls in the middle of
+	 * a frame holds back no other. Returns `false` once the server is gone.
+	 */
+	bool receive(int sock, std::vector<char>& rx) noexcept
+	{
+		constexpr size_t chunk = 64 * 1024;
+		size_t size = rx.size();
+		ssize_t len;
+
+		try {
+			rx.resize(size + chunk);
+		} catch (...) {
+			return false;
+		}
+
+		do {
+			len = recv(sock, rx.data() + size, chunk, MSG_DONTWAIT);
+		} while ((len < 0) && (errno == EINTR));
+
+		if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+			len = 0;
+		else if (len <= 0)
+			return false;	/* server closed, or error */
+
+		rx.resize(size + len);
+
+		/* ingest complete frames: [length (network order)][body] */
+		size_t offset = 0;
+		bool alive = true;
+
+		while (rx.size() - offset >= sizeof(uint32_t)) {
+			uint32_t frame;
+
+			std::memcpy(&frame, rx.data() + offset, sizeof(frame));
+			frame = ntohl(frame);
+
+			if (frame > m_options.maxFrameSize) {
+				alive = false;
+				break;
+			}
+
+			if (rx.size() - offset - sizeof(frame) < frame)
+				break;
+
+			try {
+				settle(m_client.ingest_resp(rx.data() + offset + sizeof(frame), frame), sock);
+			} catch (...) {
+				/* response to a cancelled call, or a malformed one: drop it */
+			}
+
+			offset += sizeof(frame) + frame;
+		}
+
+		rx.erase(rx.begin(), rx.begin() + offset);
+		return alive;
+	}
+
+	void receive_loop() noexcept
+	{
+		std::vector<pollfd> fds;
+
+		/* the frames in the making, by server */
+		std::unordered_map<int, std::vector<char>> rxBuffers;
+
+		while (!m_stop) {
+			fds.clear();
+			fds.push_back({m_wake, POLLIN, 0});
+
+			{
+				std::lock_guard lock(m_mutex);
+
+				for (auto sock : m_live) {
+					fds.push_back({sock, POLLIN, 0});
+				}
+			}
+
+			int ret = poll(fds.data(), fds.size(), next_timeout());
+
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+
+				break;
+			}
+
+			if (fds[0].revents != 0) {
+				uint64_t value;
+				[[maybe_unused]] auto len = read(m_wake, &value, sizeof(value));
+			}
+
+			for (size_t i = 1; i < fds.size(); ++i) {
+				if (fds[i].revents == 0)
+					continue;
+
+				auto& rx = rxBuffers[fds[i].fd];
+
+				if (!receive(fds[i].fd, rx)) {
+					lose(fds[i].fd);
+					rxBuffers.erase(fds[i].fd);
+				}
+			}
+
+			expire();
+		}
+
+		m_client.cancel_all(std::make_exception_ptr(ConnectionError("client: connection closed")));
+	}
 };
 
 }
-
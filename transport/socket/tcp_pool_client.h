@@ -0,0 +1,858 @@
+// SPDX-License-Identifier: MIT
+/*
+ * TCP transport implementation for RPC client.
+ * A pool of connections to the replicas of a server.
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "tcp_client.h"
+#include "rpc/metrics.h"
+#include "rpc/timer_wheel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+
+namespace rpc {
+
+/*
+ * Keeps `Options::connections` pipelined connections (see `TcpClient`) to each
+ * of the endpoints, and routes a call to the connection with the fewest calls
+ * outstanding: a replica that falls behind gets fewer. Ties go round, so that
+ * an idle pool spreads the calls too.
+ *
+ * A connection that fails fails the calls it carries, and is re-established
+ * in the background, backing off while its endpoint is down; meanwhile the
+ * calls go to the others. With none up, a call fails with "no connection".
+ *
+ * With `Options::hedging`, a call that a replica has not answered within
+ * a percentile of the latencies so far goes to another replica as well:
+ * the first reply wins, the other call is cancelled. A call that fails with
+ * its connection (`ConnectionError`) goes to another replica right away;
+ * one that fails otherwise is not made again: past its deadline (its retry
+ * would be, too, and is to be shed rather than doubled), or e.g. its result
+ * does not convert. Either way a call may run twice, so hedge idempotent
+ * functions only.
+ *
+ * A `SingleFlight` call joins an identical one in flight through the pool,
+ * whichever connection carries that one, rather than on one connection only.
+ */
+class TcpPoolClient {
+public:
+	struct Endpoint {
+		std::string host;
+		uint16_t port;
+	};
+
+	struct Hedging {
+		double percentile = 0;				/* e.g. 0.95; 0 for no hedging */
+		std::chrono::milliseconds min{1};		/* bounds of the delay */
+		std::chrono::milliseconds max{1000};		/* the delay until there are latencies to go by */
+
+		/*
+		 * A replica that many hedged calls in a row is unhealthy: skipped while
+		 * there are others, until it answers `probe` within `probeTimeout`
+		 * (the built-in `__ping`, which every server has)
+		 */
+		uint32_t unhealthyAfter = 3;
+		std::string probe = ping_func_id;
+		std::chrono::milliseconds probeTimeout{1000};
+	};
+
+	struct Options {
+		size_t connections = 2;				/* per endpoint */
+		std::chrono::milliseconds reconnect{100};	/* the first retry; doubles up to `reconnectMax` */
+		std::chrono::milliseconds reconnectMax{5000};
+		uint32_t maxFrameSize = tcp::max_frame_size;
+		Hedging hedging;
+	};
+
+	explicit TcpPoolClient(const std::vector<Endpoint>& endpoints)
+		:TcpPoolClient(endpoints, Options())
+	{ }
+
+	/* the endpoints that are up are connected to by the time it returns */
+	TcpPoolClient(const std::vector<Endpoint>& endpoints, const Options& options, TimerWheel& timers = TimerWheel::shared())
+		:m_options(options)
+		,m_timers(timers)
+	{
+		m_options.reconnect = std::max(m_options.reconnect, std::chrono::milliseconds(1));
+		m_options.reconnectMax = std::max(m_options.reconnectMax, m_options.reconnect);
+
+		auto& hedging = m_options.hedging;
+
+		if (hedging.percentile > 0) {
+			hedging.max = std::max(hedging.max, hedging.min);
+			m_permille = static_cast<uint64_t>(std::min(hedging.percentile, 1.0) * 1000 + 0.5);
+			m_hedgeDelay = std::chrono::nanoseconds(hedging.max).count();
+			m_latency.reset(new std::atomic<uint64_t>[metrics::buckets]());
+		}
+
+		for (const auto& endpoint : endpoints) {
+			m_replicas.push_back(std::make_unique<Replica>(endpoint));
+
+			for (size_t i = 0; i < std::max<size_t>(m_options.connections, 1); ++i)
+				m_conns.push_back(std::make_unique<Connection>(*m_replicas.back()));
+		}
+
+		for (auto& conn : m_conns)
+			connect(*conn, Clock::now());
+
+		m_maintainer = std::thread([this] {
+			maintain();
+		});
+	}
+
+	~TcpPoolClient()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_stop = true;
+		}
+
+		m_wakeup.notify_all();
+		m_maintainer.join();
+
+		if (m_latency != nullptr) {
+			m_timers.cancel(this);
+			cancel_hedges();
+		}
+
+		/*
+		 * The connections go before the pool: their calls fail, counted off
+		 * them, and do not fail over
+		 */
+		for (auto& conn : m_conns)
+			conn->up = false;
+
+		for (auto& conn : m_conns)
+			conn->swap(nullptr);
+
+		m_retired.clear();
+		m_hedges.clear();
+	}
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	R call(const FuncID& funcID, Args&&... args)
+	{
+		return async_call<R>(funcID, std::forward<Args>(args)...).get();
+	}
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	std::future<R> async_call(const FuncID& funcID, Args&&... args)
+	{
+		std::promise<R> prom;
+		auto future = prom.get_future();
+
+		async_call<R>(Client::fulfil(std::move(prom)), funcID, std::forward<Args>(args)...);
+		return future;
+	}
+
+	/*
+	 * The callback is invoked on the reader thread of the connection
+	 * (see `Client::call()`). A hedged call copies its arguments, to send
+	 * them again: one with view arguments (see `is_view_v`) is not hedged.
+	 */
+	template <typename R, typename Callback, typename FuncID, typename... Args,
+		  std::enable_if_t<!is_func_id_v<Callback>, int> = 0>
+	void async_call(Callback&& callback, const FuncID& funcID, Args&&... args)
+	{
+		if constexpr (is_single_flight_v<FuncID> && !std::is_same_v<R, void>) {
+			coalesce<R>(std::forward<Callback>(callback), funcID.func_id(), std::forward<Args>(args)...);
+			return;
+		}
+
+		if constexpr (!std::is_same_v<R, void> && !has_views_v<Args...> && !is_single_flight_v<FuncID>) {
+			if (m_latency != nullptr) {
+				hedged_call<R>(std::forward<Callback>(callback), funcID, std::forward<Args>(args)...);
+				return;
+			}
+		}
+
+		Connection* conn;
+		auto client = pick(conn);
+
+		conn->outstanding.fetch_add(1, std::memory_order_relaxed);
+
+		try {
+			client->async_call<R>([conn, callback = std::forward<Callback>(callback)](std::exception_ptr exp, auto&&... resp) mutable noexcept {
+				conn->outstanding.fetch_sub(1, std::memory_order_relaxed);
+				callback(std::move(exp), std::forward<decltype(resp)>(resp)...);
+			}, funcID, std::forward<Args>(args)...);
+		} catch (...) {
+			conn->outstanding.fetch_sub(1, std::memory_order_relaxed);
+			throw;
+		}
+	}
+
+	/*
+	 * Streaming call (see `Client::stream_call()`): outstanding until `onDone()`,
+	 * never hedged
+	 */
+	template <typename T, typename OnChunk, typename OnDone, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	void stream_call(OnChunk&& onChunk, OnDone&& onDone, const FuncID& funcID, Args&&... args)
+	{
+		Connection* conn;
+		auto client = pick(conn);
+
+		conn->outstanding.fetch_add(1, std::memory_order_relaxed);
+
+		try {
+			client->stream_call<T>(std::forward<OnChunk>(onChunk), [conn, onDone = std::forward<OnDone>(onDone)](std::exception_ptr exp) mutable noexcept {
+				conn->outstanding.fetch_sub(1, std::memory_order_relaxed);
+				onDone(std::move(exp));
+			}, funcID, std::forward<Args>(args)...);
+		} catch (...) {
+			conn->outstanding.fetch_sub(1, std::memory_order_relaxed);
+			throw;
+		}
+	}
+
+#ifdef RPC_HAS_COROUTINES
+	/*
+	 * The coroutine is resumed on the reader thread of the connection
+	 */
+	template <typename R, typename FuncID, typename... Args>
+	auto co_call(const FuncID& funcID, Args&&... args)
+	{
+		return make_awaitable<R>([this, funcID, args = std::make_tuple(std::forward<Args>(args)...)](auto&& callback) mutable {
+			std::apply([&](auto&... args) {
+				async_call<R>(std::move(callback), funcID, std::move(args)...);
+			}, args);
+		});
+	}
+#endif
+
+	/* of all `size()` */
+	size_t connected() const noexcept
+	{
+		return std::count_if(m_conns.begin(), m_conns.end(), [](const auto& conn) {
+			return conn->up.load(std::memory_order_relaxed);
+		});
+	}
+
+	size_t size() const noexcept
+	{
+		return m_conns.size();
+	}
+
+	/* of all the endpoints */
+	size_t healthy() const noexcept
+	{
+		return std::count_if(m_replicas.begin(), m_replicas.end(), [](const auto& replica) {
+			return replica->healthy.load(std::memory_order_relaxed);
+		});
+	}
+
+	/* how long a call waits for a reply before it is hedged */
+	std::chrono::nanoseconds hedge_delay() const noexcept
+	{
+		return std::chrono::nanoseconds(m_hedgeDelay.load(std::memory_order_relaxed));
+	}
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	/* hedging goes by the percentile once there are as many latencies recorded */
+	static constexpr uint64_t hedge_samples = 100;
+
+	struct Replica {
+		explicit Replica(const Endpoint& endpoint)
+			:endpoint(endpoint)
+		{ }
+
+		const Endpoint endpoint;
+		std::atomic<bool> healthy{true};
+		std::atomic<uint32_t> timeouts{0};	/* calls hedged in a row */
+		std::atomic<bool> probing{false};
+	};
+
+	struct Connection {
+		explicit Connection(Replica& replica)
+			:replica(replica)
+		{ }
+
+		Replica& replica;
+		std::atomic<uint32_t> outstanding{0};
+		std::atomic<bool> up{false};
+
+		/* the maintainer thread's */
+		std::chrono::milliseconds backoff{0};
+		Clock::time_point retry;
+
+		std::shared_ptr<TcpClient> get()
+		{
+			std::lock_guard lock(mutex);
+			return client;
+		}
+
+		/* the one it was */
+		std::shared_ptr<TcpClient> swap(std::shared_ptr<TcpClient>&& other)
+		{
+			std::lock_guard lock(mutex);
+			client.swap(other);
+			return std::move(other);
+		}
+
+	private:
+		std::mutex mutex;
+		std::shared_ptr<TcpClient> client;
+	};
+
+	/*
+	 * A call on a replica, and maybe on another: the first reply wins.
+	 * It is held by the callbacks of its attempts (and `m_hedges`) until it
+	 * is settled; it does not hold their connections in turn.
+	 */
+	struct HedgeBase {
+		struct Attempt {
+			Connection* conn;
+			std::weak_ptr<TcpClient> client;
+			uint32_t callID;
+			bool sent;
+			Clock::time_point started;
+		};
+
+		uint32_t id = 0;
+		std::mutex mutex;
+		Attempt attempts[2];
+		size_t count = 0;
+		size_t pending = 0;
+		bool done = false;
+
+		virtual ~HedgeBase() = default;
+
+		/* the call, once more, to a replica other than `exclude` */
+		virtual void send(TcpPoolClient& pool, const Replica* exclude) = 0;
+	};
+
+	template <typename R, typename Callback, typename FuncID, typename... Args>
+	struct Hedge : HedgeBase, std::enable_shared_from_this<Hedge<R, Callback, FuncID, Args...>> {
+		Callback callback;
+		FuncID funcID;
+		std::tuple<Args...> args;
+
+		template <typename C, typename... A>
+		Hedge(C&& callback, const FuncID& funcID, A&&... args)
+			:callback(std::forward<C>(callback))
+			,funcID(funcID)
+			,args(std::forward<A>(args)...)
+		{ }
+
+		void send(TcpPoolClient& pool, const Replica* exclude) override
+		{
+			pool.attempt<R>(this->shared_from_this(), exclude);
+		}
+	};
+
+	Options m_options;
+	TimerWheel& m_timers;
+	std::vector<std::unique_ptr<Replica>> m_replicas;
+	std::vector<std::unique_ptr<Connection>> m_conns;
+	std::atomic<size_t> m_next{0};
+
+	std::mutex m_mutex;
+	std::condition_variable m_wakeup;
+	bool m_stop = false;
+	bool m_lost = false;
+	std::thread m_maintainer;
+
+	/* replaced, still held by a caller that picked them: the maintainer thread's */
+	std::vector<std::shared_ptr<TcpClient>> m_retired;
+
+	/* `SingleFlight` calls in flight on any of the connections, see `coalesce()` */
+	FlightTable m_flights;
+
+	/* hedging: the latencies of the replies (see `update_delay()`), and the calls not settled yet */
+	uint64_t m_permille = 0;
+	std::unique_ptr<std::atomic<uint64_t>[]> m_latency;
+	std::atomic<uint64_t> m_hedgeDelay{0};
+	std::atomic<uint32_t> m_nextHedge{0};
+	std::mutex m_hedgeMutex;
+	std::unordered_map<uint32_t, std::shared_ptr<HedgeBase>> m_hedges;
+
+	/*
+	 * The connection up with the fewest calls outstanding, on a healthy
+	 * replica but `exclude` if there is one
+	 */
+	std::shared_ptr<TcpClient> pick(Connection*& chosen, const Replica* exclude = nullptr)
+	{
+		size_t start = m_next.fetch_add(1, std::memory_order_relaxed);
+
+		for (size_t tries = 0; tries < m_conns.size(); ++tries) {
+			Connection* best = nullptr;
+			bool bestHealthy = false;
+			uint32_t fewest = 0;
+
+			for (size_t i = 0; i < m_conns.size(); ++i) {
+				auto* conn = m_conns[(start + i) % m_conns.size()].get();
+
+				if (!conn->up.load(std::memory_order_relaxed) || (&conn->replica == exclude))
+					continue;
+
+				bool healthy = conn->replica.healthy.load(std::memory_order_relaxed);
+				uint32_t outstanding = conn->outstanding.load(std::memory_order_relaxed);
+
+				if ((best == nullptr) || (healthy && !bestHealthy) || ((healthy == bestHealthy) && (outstanding < fewest))) {
+					best = conn;
+					bestHealthy = healthy;
+					fewest = outstanding;
+				}
+			}
+
+			if (best == nullptr)
+				break;
+
+			auto client = best->get();
+
+			if ((client != nullptr) && !client->closed()) {
+				chosen = best;
+				return client;
+			}
+
+			/* gone since the maintainer last looked */
+			lose(*best);
+		}
+
+		throw ConnectionError("client: no connection");
+	}
+
+	void lose(Connection& conn)
+	{
+		conn.up = false;
+
+		{
+			std::lock_guard lock(m_mutex);
+			m_lost = true;
+		}
+
+		m_wakeup.notify_all();
+	}
+
+	/*
+	 * A call of `SingleFlight` joins an identical one in flight on any of
+	 * the connections, keyed as `Client` keys them. The one made is a plain
+	 * call (hedged, if so): its response, taken as it is, completes them all.
+	 */
+	template <typename R, typename Callback, typename FuncID, typename... Args>
+	void coalesce(Callback&& callback, const FuncID& funcID, Args&&... args)
+	{
+		auto key = Client::flight_key(funcID, args...);
+		auto handler = Client::resp_handler<R>(std::forward<Callback>(callback));
+		uint32_t unused = 0;
+
+		if (m_flights.join(key, unused, std::move(handler)))
+			return;
+
+		try {
+			async_call<msgpack::object>([this, key, handler = std::move(handler)](std::exception_ptr exp, const msgpack::object& obj) mutable noexcept {
+				for (auto& follower : m_flights.land(key))
+					follower(obj, true/*last*/, std::exception_ptr(exp));
+
+				handler(obj, true/*last*/, std::move(exp));
+			}, funcID, std::forward<Args>(args)...);
+		} catch (...) {
+			/* those that joined meanwhile fail along */
+			for (auto& follower : m_flights.land(key))
+				follower(msgpack::object(), true/*last*/, std::current_exception());
+
+			throw;
+		}
+	}
+
+	template <typename R, typename Callback, typename FuncID, typename... Args>
+	void hedged_call(Callback&& callback, const FuncID& funcID, Args&&... args)
+	{
+		/* the funcID is kept for a second attempt: a name by value */
+		using Kept = std::conditional_t<std::is_same_v<FuncID, FuncHash> || is_deadline_v<FuncID> || is_stub_v<FuncID>, FuncID, std::string>;
+		using HedgeT = Hedge<R, std::decay_t<Callback>, Kept, std::decay_t<Args>...>;
+
+		auto hedge = std::make_shared<HedgeT>(std::forward<Callback>(callback), funcID, std::forward<Args>(args)...);
+
+		/* the timer finds the call gone if it is answered first */
+		hedge->id = m_nextHedge.fetch_add(1, std::memory_order_relaxed);
+
+		{
+			std::lock_guard lock(m_hedgeMutex);
+			m_hedges.emplace(hedge->id, hedge);
+		}
+
+		try {
+			attempt<R>(hedge, nullptr);
+		} catch (...) {
+			forget(*hedge);
+			throw;
+		}
+
+		try {
+			m_timers.schedule(Clock::now() + hedge_delay(), this, hedge->id, [](void* pool, uint32_t id) noexcept {
+				static_cast<TcpPoolClient*>(pool)->on_hedge_timer(id);
+			});
+		} catch (...) {
+			/* not hedged, then */
+		}
+	}
+
+	/* settled: `m_hedges` lets go of it */
+	void forget(const HedgeBase& hedge) noexcept
+	{
+		std::lock_guard lock(m_hedgeMutex);
+		m_hedges.erase(hedge.id);
+	}
+
+	/* the calls not settled yet fail as cancelled, rather than with their connections */
+	void cancel_hedges() noexcept
+	{
+		decltype(m_hedges) hedges;
+
+		{
+			std::lock_guard lock(m_hedgeMutex);
+			hedges.swap(m_hedges);
+		}
+
+		for (auto& [id, hedge] : hedges) {
+			HedgeBase::Attempt sent[2];
+			size_t count = 0;
+
+			{
+				std::lock_guard lock(hedge->mutex);
+
+				for (size_t i = 0; i < hedge->count; ++i) {
+					if (hedge->attempts[i].sent)
+						sent[count++] = hedge->attempts[i];
+				}
+			}
+
+			for (size_t i = 0; i < count; ++i) {
+				if (auto client = sent[i].client.lock())
+					client->cancel(sent[i].callID);
+			}
+		}
+	}
+
+	/* throws if there is no replica to send it to */
+	template <typename R, typename HedgeT>
+	void attempt(const std::shared_ptr<HedgeT>& hedge, const Replica* exclude)
+	{
+		Connection* conn;
+		auto client = pick(conn, exclude);
+		size_t index;
+
+		{
+			std::lock_guard lock(hedge->mutex);
+
+			/* answered, or hedged by another thread meanwhile */
+			if (hedge->done || (hedge->count == 2))
+				return;
+
+			index = hedge->count++;
+			hedge->attempts[index] = {conn, client, 0, false, Clock::now()};
+			++hedge->pending;
+		}
+
+		conn->outstanding.fetch_add(1, std::memory_order_relaxed);
+
+		uint32_t callID;
+
+		try {
+			callID = std::apply([&](const auto&... args) {
+				return client->async_call<R>([this, hedge, conn, index](std::exception_ptr exp, auto&&... resp) mutable noexcept {
+					conn->outstanding.fetch_sub(1, std::memory_order_relaxed);
+					complete(*hedge, index, std::move(exp), std::forward<decltype(resp)>(resp)...);
+				}, hedge->funcID, args...);
+			}, hedge->args);
+		} catch (...) {
+			conn->outstanding.fetch_sub(1, std::memory_order_relaxed);
+
+			std::lock_guard lock(hedge->mutex);
+			--hedge->pending;
+			throw;
+		}
+
+		bool lost;
+
+		{
+			std::lock_guard lock(hedge->mutex);
+			hedge->attempts[index].callID = callID;
+			hedge->attempts[index].sent = true;
+			lost = hedge->done;
+		}
+
+		/* the other one was answered while this was sent */
+		if (lost)
+			client->cancel(callID);
+	}
+
+	template <typename HedgeT, typename... Resp>
+	void complete(HedgeT& hedge, size_t index, std::exception_ptr&& exp, Resp&&... resp) noexcept
+	{
+		auto& replica = hedge.attempts[index].conn->replica;
+		typename HedgeT::Attempt loser{};
+		bool failover = false;
+
+		{
+			std::lock_guard lock(hedge.mutex);
+			--hedge.pending;
+
+			/* lost: late, or cancelled */
+			if (hedge.done)
+				return;
+
+			if (exp != nullptr) {
+				/* the other one may yet make it */
+				if (hedge.pending > 0)
+					return;
+
+				failover = (hedge.count < 2) && transient(exp);
+			}
+
+			if (!failover) {
+				hedge.done = true;
+
+				if (hedge.count == 2)
+					loser = hedge.attempts[1 - index];
+			}
+
+			if (exp == nullptr) {
+				auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - hedge.attempts[index].started).count();
+
+				m_latency[metrics::bucket_of(latency)].fetch_add(1, std::memory_order_relaxed);
+
+				/* it did not keep the call waiting for a hedge */
+				if ((index == 1) || (hedge.count == 1))
+					replica.timeouts = 0;
+			}
+		}
+
+		if (failover) {
+			try {
+				hedge.send(*this, &replica);
+				return;
+			} catch (...) {
+				/* nowhere else to go */
+			}
+
+			std::lock_guard lock(hedge.mutex);
+
+			if (hedge.done || (hedge.pending > 0))
+				return;
+
+			hedge.done = true;
+		}
+
+		forget(hedge);
+
+		if (loser.sent) {
+			if (auto client = loser.client.lock())
+				client->cancel(loser.callID);
+		}
+
+		hedge.callback(std::move(exp), std::forward<Resp>(resp)...);
+	}
+
+	/* the hedging timer of a call */
+	void on_hedge_timer(uint32_t id) noexcept
+	{
+		std::shared_ptr<HedgeBase> hedge;
+
+		{
+			std::lock_guard lock(m_hedgeMutex);
+			auto it = m_hedges.find(id);
+
+			if (it == m_hedges.end())
+				return;
+
+			hedge = it->second;
+		}
+
+		Replica* first;
+
+		{
+			std::lock_guard lock(hedge->mutex);
+
+			if (hedge->done || (hedge->count == 2))
+				return;
+
+			first = &hedge->attempts[0].conn->replica;
+		}
+
+		/* until it answers a probe, see `maintain()` */
+		if (first->timeouts.fetch_add(1, std::memory_order_relaxed) + 1 >= m_options.hedging.unhealthyAfter)
+			first->healthy = false;
+
+		try {
+			hedge->send(*this, first);
+		} catch (...) {
+			/* no other replica: the first one goes on */
+		}
+	}
+
+	/* the connection failed the call: not the server, nor its result, nor its deadline */
+	static bool transient(const std::exception_ptr& exp) noexcept
+	{
+		try {
+			std::rethrow_exception(exp);
+		} catch (const ConnectionError&) {
+			return true;
+		} catch (...) {
+			return false;
+		}
+	}
+
+	/* (re-)establish `conn`; if its endpoint is down, try again later, backing off */
+	void connect(Connection& conn, Clock::time_point now) noexcept
+	{
+		const auto& endpoint = conn.replica.endpoint;
+		std::shared_ptr<TcpClient> client;
+
+		try {
+			client = std::make_shared<TcpClient>(endpoint.host, endpoint.port, TcpClient::Mode::Pipelined, m_options.maxFrameSize);
+		} catch (...) {
+			conn.backoff = std::clamp(conn.backoff * 2, m_options.reconnect, m_options.reconnectMax);
+			conn.retry = now + conn.backoff;
+			return;
+		}
+
+		conn.backoff = std::chrono::milliseconds(0);
+		retire(conn.swap(std::move(client)));
+		conn.up = true;
+	}
+
+	void retire(std::shared_ptr<TcpClient>&& client) noexcept
+	{
+		if (client == nullptr)
+			return;
+
+		/* no one else can pick it now, so the last one to let go is this thread */
+		try {
+			m_retired.push_back(std::move(client));
+		} catch (...) {
+			/* then whichever thread lets go last */
+		}
+	}
+
+	/* an unhealthy replica is back once it answers in time */
+	void probe(Replica& replica) noexcept
+	{
+		if (replica.probing.exchange(true))
+			return;
+
+		for (auto& conn : m_conns) {
+			if ((&conn->replica != &replica) || !conn->up)
+				continue;
+
+			auto client = conn->get();
+
+			if ((client == nullptr) || client->closed())
+				continue;
+
+			try {
+				client->async_call<msgpack::object>([&replica](std::exception_ptr exp, const msgpack::object&) noexcept {
+					if (exp == nullptr) {
+						replica.timeouts = 0;
+						replica.healthy = true;
+					}
+
+					replica.probing = false;
+				}, with_deadline(m_options.hedging.probe, m_options.hedging.probeTimeout));
+
+				return;
+			} catch (...) {
+				break;
+			}
+		}
+
+		replica.probing = false;
+	}
+
+	/*
+	 * The hedging delay: the percentile of the latencies recorded, which are
+	 * then halved, so that the ones of the past fade
+	 */
+	void update_delay() noexcept
+	{
+		uint64_t histogram[metrics::buckets];
+		uint64_t count = 0;
+
+		for (size_t b = 0; b < metrics::buckets; ++b) {
+			histogram[b] = m_latency[b].load(std::memory_order_relaxed);
+			count += histogram[b];
+		}
+
+		if (count < hedge_samples)
+			return;
+
+		for (size_t b = 0; b < metrics::buckets; ++b)
+			m_latency[b].fetch_sub(histogram[b] / 2, std::memory_order_relaxed);
+
+		std::chrono::nanoseconds delay(metrics::percentile(histogram, count, m_permille, UINT64_MAX));
+
+		delay = std::clamp<std::chrono::nanoseconds>(delay, m_options.hedging.min, m_options.hedging.max);
+		m_hedgeDelay.store(delay.count(), std::memory_order_relaxed);
+	}
+
+	void maintain() noexcept
+	{
+		std::unique_lock lock(m_mutex);
+
+		while (!m_stop) {
+			m_wakeup.wait_for(lock, m_options.reconnect, [this] {
+				return m_stop || m_lost;
+			});
+
+			if (m_stop)
+				break;
+
+			m_lost = false;
+			lock.unlock();
+
+			auto now = Clock::now();
+
+			for (auto& conn : m_conns) {
+				if (conn->up) {
+					auto client = conn->get();
+
+					if ((client != nullptr) && !client->closed())
+						continue;
+
+					conn->up = false;
+				}
+
+				if (now >= conn->retry)
+					connect(*conn, now);
+			}
+
+			m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(), [](const auto& client) {
+				return client.use_count() == 1;
+			}), m_retired.end());
+
+			if (m_latency != nullptr) {
+				update_delay();
+
+				for (auto& replica : m_replicas) {
+					if (!replica->healthy)
+						probe(*replica);
+				}
+			}
+
+			lock.lock();
+		}
+	}
+};
+
+}
@@ -9,18 +9,67 @@
 
 #include "rpc/server.h"
 #include "utils.h"
+#include "thread_pool.h"
 
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
 
 
 namespace rpc {
 
 class TcpServer : public rpc::Server {
 public:
+	enum class Model {
+		/* a blocking thread per accepted connection */
+		ThreadPerConnection,
+		/* non-blocking sockets driven by an epoll reactor, calls handled by a worker pool */
+		Reactor,
+	};
+
+	struct Options {
+		Model model = Model::ThreadPerConnection;
+		int backlog = SOMAXCONN;
+		size_t workers = std::thread::hardware_concurrency();
+		uint32_t maxFrameSize = tcp::max_frame_size;	/* a longer request drops the connection */
+		bool streamBatches = false;	/* answer each call of a batch as it completes, rather than all at once */
+
+		/*
+		 * Calls of one connection handled at the same time, on the worker pool
+		 * (of `workers` threads, shared by all connections). Above 1, responses
+		 * go out as the calls complete, in any order.
+		 */
+		size_t connectionConcurrency = 1;
+
+		/*
+		 * Reactor: a connection is not read from while it has more requests
+		 * queued, or more bytes of responses the socket has not taken yet,
+		 * than these; the client waits, rather than the server's memory growing.
+		 */
+		size_t maxQueuedRequests = 1024;
+		size_t maxUnsentBytes = 16 * 1024 * 1024;
+	};
+
 	TcpServer(uint16_t port)
-		:listen_sock(tcp::server_socket(port))
+		:TcpServer(port, Options())
+	{ }
+
+	TcpServer(uint16_t port, const Options& options)
+		:Server(tcp::framing)
+		,listen_sock(tcp::server_socket(port, options.backlog))
+		,m_options(options)
 	{ }
 
 	~TcpServer()
@@ -30,35 +79,565 @@ public:
 
 	void run(Server& server)
 	{
+		if (m_options.model == Model::Reactor)
+			run_reactor();
+		else
+			run_threads();
+	}
+
+private:
+	int listen_sock;
+	Options m_options;
+
+	std::unique_ptr<ThreadPool> m_pool;
+
+	void run_threads()
+	{
+		if (m_options.connectionConcurrency > 1)
+			m_pool = std::make_unique<ThreadPool>(m_options.workers);
+
 		while (true) {
 			int client_sock = accept(listen_sock, nullptr, nullptr);
 			if (client_sock < 0)
 				continue;
 
 			std::thread([this, client_sock]() {
-				try {
-					while (true) {
-						auto reqBuffer = tcp::recv_buffer(client_sock);
+				tcp::set_nodelay(client_sock);
+
+				if (m_options.connectionConcurrency > 1)
+					serve_concurrent(client_sock);
+				else
+					serve(client_sock);
+
+				close(client_sock);
+			}).detach();
+		}
+	}
+
+	/*
+	 * Handle a request, `send(const char*, size_t)` the response(s): each
+	 * a whole frame, packed behind its length (see `tcp::framing`).
+	 * Returns `false` if a send failed. `received`: when the request was read,
+	 * if it waited to be handled (see `Server::handle_call()`).
+	 */
+	template <typename Send>
+	bool respond(const char* data, size_t size, Send&& send, deadline::Clock::time_point received = {})
+	{
+		bool sent = true;
 
-						msgpack::sbuffer buffer;
-						buffer.write(reqBuffer.data(), reqBuffer.size());
+		if (m_options.streamBatches) {
+			handle_batch(data, size, [&](msgpack::sbuffer&& resp) {
+				sent = sent && tcp::patch_length(resp) && send(resp.data(), resp.size());
+				pool::recycle(std::move(resp));
+			}, received);
+		} else {
+			/* a stream goes out chunk by chunk */
+			handle_call(data, size, [&](msgpack::sbuffer&& resp) {
+				sent = sent && tcp::patch_length(resp) && send(resp.data(), resp.size());
+				pool::recycle(std::move(resp));
+			}, received);
+		}
 
-						auto resp = handle_call(buffer);
+		return sent;
+	}
 
-						if (resp.size() > 0) {
-							tcp::send_buffer(client_sock, resp.data(), resp.size());
-						}
+	void serve(int client_sock) noexcept
+	{
+		std::vector<char> reqBuffer;
+
+		auto send = [client_sock](const char* data, size_t size) {
+			return tcp::send_all(client_sock, data, size);
+		};
+
+		try {
+			while (tcp::recv_buffer(client_sock, reqBuffer, m_options.maxFrameSize)) {
+				if (!respond(reqBuffer.data(), reqBuffer.size(), send))
+					break;
+			}
+		} catch (...) {
+		}
+	}
+
+	/*
+	 * The connection thread only reads: each request goes to the worker pool,
+	 * up to `connectionConcurrency` at a time, and the workers write the
+	 * responses, one frame at a time.
+	 */
+	void serve_concurrent(int client_sock) noexcept
+	{
+		std::mutex mutex;
+		std::condition_variable idle;
+		size_t inFlight = 0;
+		bool failed = false;
+		std::mutex sendMutex;
+
+		auto send = [client_sock, &sendMutex](const char* data, size_t size) {
+			std::lock_guard lock(sendMutex);
+			return tcp::send_all(client_sock, data, size);
+		};
+
+		auto complete = [&](bool ok) {
+			std::lock_guard lock(mutex);
+
+			if (!ok) {
+				/* same as a dying connection thread: drop the connection */
+				failed = true;
+				shutdown(client_sock, SHUT_RDWR);
+			}
+
+			--inFlight;
+			idle.notify_all();
+		};
+
+		std::vector<char> reqBuffer;
+
+		while (tcp::recv_buffer(client_sock, reqBuffer, m_options.maxFrameSize)) {
+			auto received = deadline::Clock::now();
+
+			{
+				std::unique_lock lock(mutex);
+
+				idle.wait(lock, [&] {
+					return failed || (inFlight < m_options.connectionConcurrency);
+				});
+
+				if (failed)
+					break;
+
+				++inFlight;
+			}
+
+			try {
+				m_pool->submit([this, request = std::move(reqBuffer), received, &send, &complete]() mutable {
+					bool ok;
+
+					try {
+						ok = respond(request.data(), request.size(), send, received);
+					} catch (...) {
+						ok = false;
 					}
-				} catch (...) {
-					close(client_sock);
+
+					pool::recycle(std::move(request));
+					complete(ok);
+				});
+			} catch (...) {
+				complete(false);
+			}
+
+			reqBuffer = pool::bytes();
+		}
+
+		/* the workers refer to this frame */
+		std::unique_lock lock(mutex);
+
+		idle.wait(lock, [&] {
+			return (inFlight == 0);
+		});
+	}
+
+	/*
+	 * Reactor model.
+	 *
+	 * The reactor thread accepts connections, reads whatever is available
+	 * and cuts it into frames. Complete frames are queued on their connection,
+	 * and handed to the worker pool, up to `connectionConcurrency` calls of
+	 * a connection at a time. Workers write the response straight away; whatever
+	 * the socket does not take is flushed by the reactor upon EPOLLOUT.
+	 * A connection with too much queued either way is not read from until
+	 * it drains (see `Options::maxQueuedRequests`). A peer that is done
+	 * sending (EOF, e.g. a half-close) is answered all it sent before the
+	 * connection is closed.
+	 */
+	struct Request {
+		std::vector<char> frame;
+		deadline::Clock::time_point received;
+	};
+
+	struct Connection {
+		int sock;
+
+		/* reactor thread only */
+		std::vector<char> rxBuffer;
+
+		std::mutex mutex;
+		std::deque<Request> requests;
+		std::vector<char> txBuffer;
+		size_t txSent = 0;
+		size_t inFlight = 0;	/* calls being handled */
+		bool writing = false;	/* waiting for EPOLLOUT */
+		bool paused = false;	/* not waiting for EPOLLIN */
+		bool eof = false;	/* nothing more to read: closed once answered, see `finished()` */
+		bool closed = false;
+
+		explicit Connection(int sock)
+			: sock(sock)
+		{ }
+
+		~Connection()
+		{
+			close(sock);
+		}
+	};
+
+	int m_epoll = -1;
+
+	void run_reactor()
+	{
+		m_epoll = epoll_create1(EPOLL_CLOEXEC);
+		if (m_epoll < 0)
+			throw std::runtime_error("epoll_create1() failed");
+
+		m_pool = std::make_unique<ThreadPool>(m_options.workers);
+
+		tcp::set_nonblocking(listen_sock);
+		watch(listen_sock, EPOLL_CTL_ADD, EPOLLIN);
+
+		std::unordered_map<int, std::shared_ptr<Connection>> connections;
+		std::array<epoll_event, 64> events;
+
+		while (true) {
+			int count = epoll_wait(m_epoll, events.data(), events.size(), -1);
+			if (count < 0) {
+				if (errno == EINTR)
+					continue;
+
+				throw std::runtime_error("epoll_wait() failed");
+			}
+
+			for (int i = 0; i < count; ++i) {
+				int fd = events[i].data.fd;
+
+				if (fd == listen_sock) {
+					accept_all(connections);
+					continue;
 				}
-			}).detach();
+
+				auto it = connections.find(fd);
+				if (it == connections.end())
+					continue;
+
+				bool alive = true;
+
+				if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+					alive = receive(it->second);
+
+				if (alive && (events[i].events & EPOLLOUT))
+					alive = resume_flush(it->second);
+
+				if (!alive) {
+					epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+					connections.erase(it);
+				}
+			}
 		}
 	}
 
-private:
-	int listen_sock;
+	void watch(int sock, int op, uint32_t events)
+	{
+		epoll_event ev{};
+
+		ev.events = events;
+		ev.data.fd = sock;
+
+		if (epoll_ctl(m_epoll, op, sock, &ev) < 0)
+			throw std::runtime_error("epoll_ctl() failed");
+	}
+
+	void accept_all(std::unordered_map<int, std::shared_ptr<Connection>>& connections)
+	{
+		while (true) {
+			int client_sock = accept4(listen_sock, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (client_sock < 0) {
+				if (errno == EINTR)
+					continue;
+
+				/* EAGAIN, or out of resources: retry upon the next event */
+				return;
+			}
+
+			tcp::set_nodelay(client_sock);
+
+			try {
+				watch(client_sock, EPOLL_CTL_ADD, EPOLLIN | EPOLLRDHUP);
+				connections.emplace(client_sock, std::make_shared<Connection>(client_sock));
+			} catch (...) {
+				close(client_sock);
+			}
+		}
+	}
+
+	/* returns `false` once the connection is done with */
+	bool receive(const std::shared_ptr<Connection>& conn)
+	{
+		char chunk[64 * 1024];
+		size_t budget = 16 * sizeof(chunk);	/* the rest upon the next event, after the other connections */
+		bool alive = true;
+		bool eof = false;
+
+		while (budget > 0) {
+			ssize_t len = recv(conn->sock, chunk, sizeof(chunk), 0);
+
+			if (len > 0) {
+				conn->rxBuffer.insert(conn->rxBuffer.end(), chunk, chunk + len);
+				budget -= std::min<size_t>(budget, len);
+				continue;
+			}
+
+			if ((len < 0) && (errno == EINTR))
+				continue;
+
+			if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+				break;
+
+			/* the peer is done sending: the frames it sent are still answered */
+			if (len == 0) {
+				eof = true;
+				break;
+			}
+
+			alive = false;
+			break;
+		}
+
+		/* cut complete frames: [length (network order)][body] */
+		auto& rx = conn->rxBuffer;
+		size_t offset = 0;
+		auto received = deadline::Clock::now();
+		std::deque<std::vector<char>> frames;
+
+		while (rx.size() - offset >= sizeof(uint32_t)) {
+			uint32_t len;
+
+			std::memcpy(&len, rx.data() + offset, sizeof(len));
+			len = ntohl(len);
+
+			if (len > m_options.maxFrameSize) {
+				alive = false;
+				break;
+			}
+
+			if (rx.size() - offset - sizeof(len) < len)
+				break;
+
+			auto body = rx.begin() + offset + sizeof(len);
+			auto frame = pool::bytes();
+
+			frame.assign(body, body + len);
+			frames.push_back(std::move(frame));
+			offset += sizeof(len) + len;
+		}
+
+		rx.erase(rx.begin(), rx.begin() + offset);
+
+		std::lock_guard lock(conn->mutex);
+
+		if (!alive) {
+			conn->closed = true;
+			return false;
+		}
+
+		for (auto& frame : frames) {
+			conn->requests.push_back({std::move(frame), received});
+		}
+
+		while ((conn->inFlight < m_options.connectionConcurrency) && !conn->requests.empty()) {
+			++conn->inFlight;
+			schedule(conn);
+		}
+
+		if (eof && !conn->eof) {
+			/* no more EPOLLIN: the connection goes upon EPOLLHUP, or as it is answered */
+			conn->eof = true;
+			regulate(*conn, true/*rearm*/);
+		} else {
+			regulate(*conn);
+		}
+
+		return !conn->closed && !finished(*conn);
+	}
+
+	/*
+	 * Connection lock held: the peer is done sending, and all it sent is
+	 * answered, responses out to the socket
+	 */
+	static bool finished(const Connection& conn) noexcept
+	{
+		return conn.eof && conn.requests.empty() && (conn.inFlight == 0) && conn.txBuffer.empty();
+	}
+
+	/* connection lock held */
+	void schedule(const std::shared_ptr<Connection>& conn)
+	{
+		auto request = std::move(conn->requests.front());
+		conn->requests.pop_front();
+		regulate(*conn);
+
+		m_pool->submit([this, conn, request = std::move(request)]() mutable {
+			process(conn, request);
+			pool::recycle(std::move(request.frame));
+		});
+	}
+
+	/* worker thread */
+	void process(const std::shared_ptr<Connection>& conn, const Request& request) noexcept
+	{
+		bool ok;
+
+		try {
+			ok = respond(request.frame.data(), request.frame.size(), [&](const char* data, size_t size) {
+				send_resp(conn, data, size);
+				return true;
+			}, request.received);
+		} catch (...) {
+			ok = false;
+		}
+
+		std::lock_guard lock(conn->mutex);
+
+		if (!ok) {
+			/* same as a dying connection thread: drop the connection */
+			conn->closed = true;
+			shutdown(conn->sock, SHUT_RDWR);
+		}
+
+		if (conn->closed || conn->requests.empty()) {
+			--conn->inFlight;
+
+			/* the reactor drops it upon EPOLLHUP */
+			if (finished(*conn))
+				shutdown(conn->sock, SHUT_RDWR);
+
+			return;
+		}
+
+		/* next call of this connection, behind the other connections' calls */
+		schedule(conn);
+	}
+
+	/* a whole frame: straight from the response, unless there is a backlog to keep behind */
+	void send_resp(const std::shared_ptr<Connection>& conn, const char* data, size_t len)
+	{
+		std::lock_guard lock(conn->mutex);
+
+		if (conn->closed)
+			return;
+
+		auto& tx = conn->txBuffer;
+
+		if (!conn->writing && tx.empty()) {
+			while (len > 0) {
+				ssize_t sent = ::send(conn->sock, data, len, MSG_NOSIGNAL);
+
+				if (sent >= 0) {
+					data += sent;
+					len -= sent;
+					continue;
+				}
+
+				if (errno == EINTR)
+					continue;
+
+				if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+					break;
+
+				conn->closed = true;
+				shutdown(conn->sock, SHUT_RDWR);
+				return;
+			}
+
+			if (len == 0)
+				return;
+		}
+
+		/* whatever the socket does not take */
+		tx.insert(tx.end(), data, data + len);
+
+		if (conn->writing) {
+			regulate(*conn);
+			return;
+		}
+
+		if (!flush(*conn)) {
+			conn->closed = true;
+			shutdown(conn->sock, SHUT_RDWR);
+			return;
+		}
+
+		conn->writing = !tx.empty();
+		regulate(*conn, conn->writing);
+	}
+
+	/* reactor thread, upon EPOLLOUT */
+	bool resume_flush(const std::shared_ptr<Connection>& conn)
+	{
+		std::lock_guard lock(conn->mutex);
+
+		if (!flush(*conn)) {
+			conn->closed = true;
+			return false;
+		}
+
+		bool writing = !conn->txBuffer.empty();
+		bool rearm = (writing != conn->writing);
+
+		conn->writing = writing;
+		regulate(*conn, rearm);
+		return !conn->closed && !finished(*conn);
+	}
+
+	/*
+	 * Connection lock held: pause reading while the connection has too much
+	 * queued, resume once it has not; `rearm` the events anyway, e.g. as
+	 * `writing` changes
+	 */
+	void regulate(Connection& conn, bool rearm = false) noexcept
+	{
+		bool paused = (conn.requests.size() >= m_options.maxQueuedRequests) ||
+			      (conn.txBuffer.size() - conn.txSent >= m_options.maxUnsentBytes);
+
+		if ((paused == conn.paused) && !rearm)
+			return;
+
+		conn.paused = paused;
+
+		epoll_event ev{};
+
+		ev.events = ((paused || conn.eof) ? 0 : (EPOLLIN | EPOLLRDHUP)) | (!conn.txBuffer.empty() ? EPOLLOUT : 0);
+		ev.data.fd = conn.sock;
+
+		/* the reactor tells a dropped connection by EPOLLHUP */
+		if ((epoll_ctl(m_epoll, EPOLL_CTL_MOD, conn.sock, &ev) < 0) && (errno != ENOENT)) {
+			conn.closed = true;
+			shutdown(conn.sock, SHUT_RDWR);
+		}
+	}
+
+	/* connection lock held; returns `false` on a socket error */
+	static bool flush(Connection& conn)
+	{
+		auto& tx = conn.txBuffer;
+
+		while (conn.txSent < tx.size()) {
+			ssize_t len = ::send(conn.sock, tx.data() + conn.txSent, tx.size() - conn.txSent, MSG_NOSIGNAL);
+
+			if (len >= 0) {
+				conn.txSent += len;
+				continue;
+			}
+
+			if (errno == EINTR)
+				continue;
+
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return true;
+
+			return false;
+		}
+
+		tx.clear();
+		conn.txSent = 0;
+		return true;
+	}
 };
 
 }
-
@@ -1,8 +1,11 @@
 #include "tcp_client.h"
 #include "tcp_multi_client.h"
+#include "tcp_pool_client.h"
 #include "tcp_server.h"
 
 #include <iostream>
+#include <atomic>
+#include <chrono>
 
 
 static void rpc_client(int argc, char* argv[])
@@ -25,11 +28,140 @@ static void rpc_client(int argc, char* argv[])
 		std::cout << "Result: " << result << "\n";
 
 		client.call<void>("print", "Hello, world !");
+
+		/* a stalled server does not hold the caller beyond its deadline */
+		try {
+			client.call<int>(rpc::with_deadline("delay", std::chrono::milliseconds(50)), 300);
+			std::cout << "Deadline: FAILED\n";
+		} catch (const rpc::DeadlineExceeded&) {
+			std::cout << "Deadline: OK\n";
+		}
 	} catch (const std::exception& ex) {
 		std::cerr << "RPC call failed: " << ex.what() << "\n";
 	} catch (...) {
 		std::cerr << "RPC call failed\n";
 	}
+
+	try {
+		/* many threads share one connection */
+		rpc::TcpClient client("127.0.0.1", port, rpc::TcpClient::Mode::Pipelined);
+		std::vector<std::thread> threads;
+		std::atomic<int> failed{0};
+
+		for (int t = 0; t < 4; ++t) {
+			threads.emplace_back([&client, &failed, t] {
+				for (int i = 0; i < 1000; ++i) {
+					if (client.call<int>("add", t, i) != (t + i))
+						++failed;
+				}
+			});
+		}
+
+		for (auto& thread : threads)
+			thread.join();
+
+		std::cout << "Pipelined: " << ((failed == 0) ? "OK" : "FAILED") << "\n";
+
+		/* fan out without blocking a thread per call */
+		std::vector<std::future<int>> futures;
+
+		for (int i = 0; i < 10; ++i)
+			futures.push_back(client.async_call<int>("add", i, i));
+
+		int sum = 0;
+		for (auto& future : futures)
+			sum += future.get();
+
+		std::cout << "Async sum: " << sum << "\n";
+
+		/* many calls, one frame */
+		auto batch = client.batch();
+		futures.clear();
+
+		for (int i = 0; i < 100; ++i)
+			futures.push_back(batch.call<int>("add", i, 1));
+
+		client.call_batch(std::move(batch));
+
+		sum = 0;
+		for (auto& future : futures)
+			sum += future.get();
+
+		std::cout << "Batch sum: " << sum << "\n";
+
+		/* a slow call does not hold up the calls behind it */
+		auto slow = client.async_call<int>("delay", 200);
+		auto fast = client.async_call<int>("add", 1, 1);
+
+		fast.get();
+		bool overtaken = (slow.wait_for(std::chrono::seconds(0)) == std::future_status::timeout);
+		slow.get();
+
+		std::cout << "Out of order: " << (overtaken ? "OK" : "FAILED") << "\n";
+
+		/* the chunks come in while the server produces them */
+		std::promise<void> streamed;
+		long streamSum = 0;
+
+		client.stream_call<int>([&](int chunk) {
+			streamSum += chunk;
+		}, [&](std::exception_ptr exp) {
+			if (exp != nullptr)
+				streamed.set_exception(exp);
+			else
+				streamed.set_value();
+		}, "range", 1000);
+
+		streamed.get_future().get();
+		std::cout << "Stream sum: " << streamSum << "\n";
+
+		/* a large payload goes out from where it is, with vectored I/O */
+		std::vector<char> payload(1 << 20, 1);
+		long checksum = client.call<long>("checksum", rpc::BinRef(payload));
+
+		std::cout << "Zero-copy: " << ((checksum == long(payload.size())) ? "OK" : "FAILED") << "\n";
+	} catch (const std::exception& ex) {
+		std::cerr << "RPC call failed: " << ex.what() << "\n";
+	}
+
+	try {
+		/* calls written, then the sending side shut down: they are answered all the same */
+		rpc::Client client(rpc::CallTable::default_capacity, rpc::TimerWheel::shared(), tcp::framing);
+		int sock = tcp::client_socket("127.0.0.1", port);
+		std::vector<std::future<int>> futures;
+		bool sent = true;
+
+		auto [slow, slowBuffer, slowID] = client.call<int>("delay", 100);
+		sent = tcp::send_frame(sock, slowBuffer);
+
+		for (int i = 0; i < 10; ++i) {
+			auto [future, buffer, id] = client.call<int>("add", i, 1);
+			sent = sent && tcp::send_frame(sock, buffer);
+			futures.push_back(std::move(future));
+		}
+
+		shutdown(sock, SHUT_WR);
+
+		std::vector<char> resp;
+		while (tcp::recv_buffer(sock, resp))
+			client.ingest_resp(resp.data(), resp.size(), true/*last*/);
+
+		close(sock);
+
+		bool answered = sent && (slow.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+		int sum = 0;
+
+		for (auto& future : futures) {
+			if (future.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+				sum += future.get();
+			else
+				answered = false;
+		}
+
+		std::cout << "Half-close: " << ((answered && (sum == 55)) ? "OK" : "FAILED") << "\n";
+	} catch (const std::exception& ex) {
+		std::cerr << "RPC call failed: " << ex.what() << "\n";
+	}
 }
 
 static void rpc_multi_client(int argc, char* argv[])
@@ -58,7 +190,27 @@ static void rpc_multi_client(int argc, char* argv[])
 		for (const auto& res : result)
 			std::cout << "  " << res << "\n";
 
+		auto future = client.async_call<int>("add", 5, 6);
+		std::cout << "Async results: " << future.get().size() << "\n";
+
 		client.call<void>("print", "Hello, many worlds !");
+
+		/* the fastest server answers */
+		result = client.call<int>(rpc::Completion::first_success(), "add", 6, 7);
+		std::cout << "First success: " << result.at(0) << "\n";
+
+		/* a slow server counts as a failed one */
+		rpc::TcpMultiClient::Options options;
+		options.timeout = std::chrono::milliseconds(100);
+
+		rpc::TcpMultiClient impatient("127.0.0.1", port, options);
+
+		try {
+			impatient.call<int>("delay", 300);
+			std::cout << "Timeout: FAILED\n";
+		} catch (const std::runtime_error&) {
+			std::cout << "Timeout: OK\n";
+		}
 	} catch (const std::exception& ex) {
 		std::cerr << "RPC call failed: " << ex.what() << "\n";
 	} catch (...) {
@@ -66,7 +218,70 @@ static void rpc_multi_client(int argc, char* argv[])
 	}
 }
 
-static void rpc_server(int argc, char* argv[])
+static void rpc_pool_client(int argc, char* argv[])
+{
+	std::vector<rpc::TcpPoolClient::Endpoint> endpoints;
+
+	try {
+		for (int i = 2; i < argc; ++i) {
+			endpoints.push_back({"127.0.0.1", static_cast<uint16_t>(std::stoi(argv[i]))});
+		}
+	} catch (const std::exception& ex) {
+		std::cerr << "Invalid port number\n";
+		return;
+	}
+
+	if (endpoints.empty())
+		endpoints.push_back({"127.0.0.1", 5555});
+
+	try {
+		rpc::TcpPoolClient client(endpoints);
+
+		std::cout << "Connected: " << client.connected() << "/" << client.size() << "\n";
+
+		/* the calls spread over the connections and the servers */
+		std::vector<std::future<int>> futures;
+
+		for (int i = 0; i < 100; ++i)
+			futures.push_back(client.async_call<int>("add", i, 1));
+
+		int sum = 0;
+		for (auto& future : futures)
+			sum += future.get();
+
+		std::cout << "Pool sum: " << sum << "\n";
+
+		/* identical calls in flight make one, whichever connections they would go to */
+		std::vector<std::future<int>> flights;
+
+		for (int i = 0; i < 8; ++i)
+			flights.push_back(client.async_call<int>(rpc::single_flight("made"), 100));
+
+		bool coalesced = true;
+		int made = flights[0].get();
+
+		for (size_t i = 1; i < flights.size(); ++i)
+			coalesced = coalesced && (flights[i].get() == made);
+
+		std::cout << "Pool single flight: " << (coalesced ? "OK" : "FAILED") << "\n";
+
+		/* a call a replica is slow to answer goes to another one as well */
+		rpc::TcpPoolClient::Options options;
+		options.hedging.percentile = 0.95;
+
+		rpc::TcpPoolClient hedged(endpoints, options);
+		sum = 0;
+
+		for (int i = 0; i < 100; ++i)
+			sum += hedged.call<int>("add", i, 1);
+
+		std::cout << "Hedged sum: " << sum << "\n";
+	} catch (const std::exception& ex) {
+		std::cerr << "RPC call failed: " << ex.what() << "\n";
+	}
+}
+
+static void rpc_server(int argc, char* argv[], rpc::TcpServer::Model model)
 {
 	uint16_t port = 5555;
 
@@ -80,7 +295,12 @@ static void rpc_server(int argc, char* argv[])
 	}
 
 	try {
-		rpc::TcpServer server(port);
+		rpc::TcpServer::Options options;
+		options.model = model;
+		options.connectionConcurrency = 4;
+		options.workers = 8;	/* calls may block (see "delay") */
+
+		rpc::TcpServer server(port, options);
 
 		server.bind("add", [](int a, int b) {
 			return a + b;
@@ -90,6 +310,33 @@ static void rpc_server(int argc, char* argv[])
 			std::cout << ">> " << msg << "\n";
 		});
 
+		server.bind("delay", [](int ms) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+			return ms;
+		});
+
+		/* how many calls were made, as they complete */
+		static std::atomic<int> made{0};
+
+		server.bind("made", [](int ms) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+			return ++made;
+		});
+
+		server.bind("checksum", [](rpc::BinRef bytes) {
+			long sum = 0;
+
+			for (size_t i = 0; i < bytes.size; ++i)
+				sum += static_cast<unsigned char>(bytes.ptr[i]);
+
+			return sum;
+		});
+
+		server.bind("range", [](rpc::Writer<int>& out, int n) {
+			for (int i = 0; i < n; ++i)
+				out.write(i);
+		});
+
 		server.run(server);
 	} catch (const std::exception& ex) {
 		std::cerr << "RPC server failed: " << ex.what() << "\n";
@@ -101,7 +348,12 @@ static void rpc_server(int argc, char* argv[])
 int main(int argc, char* argv[])
 {
 	if ((argc > 1) && (std::string(argv[1]) == "--server")) {
-		rpc_server(argc, argv);
+		rpc_server(argc, argv, rpc::TcpServer::Model::ThreadPerConnection);
+		return 0;
+	}
+
+	if ((argc > 1) && (std::string(argv[1]) == "--reactor")) {
+		rpc_server(argc, argv, rpc::TcpServer::Model::Reactor);
 		return 0;
 	}
 
@@ -117,9 +369,16 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 
+	if ((argc > 1) && (std::string(argv[1]) == "--pool")) {
+		rpc_pool_client(argc, argv);
+		return 0;
+	}
+
 	std::cerr << "TCP RPC test\n";
 	std::cerr << "Command line options:\n";
 	std::cerr << "  --server [port]                      invoke RPC server\n";
+	std::cerr << "  --reactor [port]                     invoke RPC server (epoll reactor + worker pool)\n";
 	std::cerr << "  --client [port [port [port [...]]]]  invoke RPC client\n";
+	std::cerr << "  --pool [port [port [...]]]           invoke RPC client, pooled connections\n";
 	return 1;
 }
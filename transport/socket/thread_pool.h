@@ -0,0 +1,89 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Fixed-size worker pool
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <vector>
+
+
+namespace rpc {
+
+class ThreadPool {
+public:
+	explicit ThreadPool(size_t size)
+	{
+		for (size_t i = 0; i < std::max<size_t>(size, 1); ++i) {
+			m_threads.emplace_back([this] {
+				worker();
+			});
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_stop = true;
+		}
+
+		m_cond.notify_all();
+
+		for (auto& thread : m_threads) {
+			thread.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void submit(std::function<void()>&& job)
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_jobs.push_back(std::move(job));
+		}
+
+		m_cond.notify_one();
+	}
+
+private:
+	std::vector<std::thread> m_threads;
+	std::deque<std::function<void()>> m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	bool m_stop = false;
+
+	void worker() noexcept
+	{
+		while (true) {
+			std::function<void()> job;
+
+			{
+				std::unique_lock lock(m_mutex);
+				m_cond.wait(lock, [this] {
+					return m_stop || !m_jobs.empty();
+				});
+
+				/* drain the queue before stopping */
+				if (m_jobs.empty())
+					return;
+
+				job = std::move(m_jobs.front());
+				m_jobs.pop_front();
+			}
+
+			job();
+		}
+	}
+};
+
+}
@@ -1,9 +1,18 @@
 #include "utils.h"
 
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
 
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <algorithm>
 #include <stdexcept>
 
 
@@ -18,16 +27,21 @@ int client_socket(const std::string& host, uint16_t port)
 	sockaddr_in addr{};
 	addr.sin_family = AF_INET;
 	addr.sin_port = htons(port);
-	if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0)
+	if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0) {
+		close(sock);
 		throw std::runtime_error("inet_pton failed");
+	}
 
-	if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0)
+	if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+		close(sock);
 		throw std::runtime_error("connect() failed");
+	}
 
+	set_nodelay(sock);
 	return sock;
 }
 
-int server_socket(uint16_t port)
+int server_socket(uint16_t port, int backlog)
 {
 	int sock = socket(AF_INET, SOCK_STREAM, 0);
 	if (sock < 0)
@@ -44,30 +58,153 @@ int server_socket(uint16_t port)
 	if (bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0)
 		throw std::runtime_error("bind() failed");
 
-	if (listen(sock, 5) < 0)
+	if (listen(sock, backlog) < 0)
 		throw std::runtime_error("listen() failed");
 
 	return sock;
 }
 
-void send_buffer(int sock, const char* buffer, uint32_t len) noexcept
+void set_nonblocking(int sock)
+{
+	int flags = fcntl(sock, F_GETFL, 0);
+
+	if ((flags < 0) || (fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0))
+		throw std::runtime_error("fcntl() failed");
+}
+
+void set_nodelay(int sock) noexcept
+{
+	/* each frame goes out in one write: nothing to gain from coalescing, but delayed-ACK stalls */
+	int opt = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+}
+
+bool send_buffer(int sock, const char* buffer, uint32_t len) noexcept
 {
-	uint32_t net_len = htonl(len);
+	iovec iov[2] = {
+		{ nullptr, 0 },
+		{ const_cast<char*>(buffer), len },
+	};
+
+	return send_buffers(sock, iov, 2);
+}
+
+bool send_buffers(int sock, iovec* iov, size_t count) noexcept
+{
+	size_t len = 0;
+
+	for (size_t i = 1; i < count; ++i)
+		len += iov[i].iov_len;
+
+	if (len > UINT32_MAX)
+		return false;
+
+	uint32_t net_len = htonl(static_cast<uint32_t>(len));
+	iov[0] = { &net_len, sizeof(net_len) };
+
+	msghdr msg{};
+	msg.msg_iov = iov;
+
+	while (count > 0) {
+		msg.msg_iovlen = std::min<size_t>(count, IOV_MAX);
+
+		ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		/* partial write: skip what went out */
+		while ((count > 0) && (static_cast<size_t>(sent) >= msg.msg_iov->iov_len)) {
+			sent -= msg.msg_iov->iov_len;
+			++msg.msg_iov;
+			--count;
+		}
+
+		if (count > 0) {
+			msg.msg_iov->iov_base = static_cast<char*>(msg.msg_iov->iov_base) + sent;
+			msg.msg_iov->iov_len -= sent;
+		}
+	}
 
-	send(sock, &net_len, sizeof(net_len), 0);
-	send(sock, buffer, len, 0);
+	return true;
 }
 
-std::vector<char> recv_buffer(int sock) noexcept
+bool send_all(int sock, const char* data, size_t len) noexcept
+{
+	while (len > 0) {
+		ssize_t sent = send(sock, data, len, MSG_NOSIGNAL);
+
+		if (sent >= 0) {
+			data += sent;
+			len -= sent;
+			continue;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		return false;
+	}
+
+	return true;
+}
+
+bool patch_length(msgpack::sbuffer& buffer) noexcept
+{
+	size_t len = framing.body_size(buffer);
+
+	if ((buffer.size() < sizeof(uint32_t)) || (len > UINT32_MAX))
+		return false;
+
+	uint32_t net_len = htonl(static_cast<uint32_t>(len));
+
+	std::memcpy(buffer.data(), &net_len, sizeof(net_len));
+	return true;
+}
+
+static bool recv_all(int sock, char* data, size_t len) noexcept
+{
+	while (len > 0) {
+		ssize_t received = recv(sock, data, len, MSG_WAITALL);
+
+		if (received > 0) {
+			data += received;
+			len -= received;
+			continue;
+		}
+
+		if ((received < 0) && (errno == EINTR))
+			continue;
+
+		return false;
+	}
+
+	return true;
+}
+
+bool recv_buffer(int sock, std::vector<char>& buffer, uint32_t maxFrame) noexcept
 {
 	uint32_t net_len = 0;
-	recv(sock, &net_len, sizeof(net_len), MSG_WAITALL);
+
+	if (!recv_all(sock, reinterpret_cast<char*>(&net_len), sizeof(net_len)))
+		return false;
 
 	uint32_t len = ntohl(net_len);
-	std::vector<char> buffer(len);
+	if (len > maxFrame)
+		return false;
+
+	try {
+		/* no reallocation once the buffer has grown to the usual frame size */
+		buffer.resize(len);
+	} catch (...) {
+		return false;
+	}
 
-	recv(sock, buffer.data(), len, MSG_WAITALL);
-	return buffer;
+	return recv_all(sock, buffer.data(), len);
 }
 
 }
@@ -1,5 +1,10 @@
 #pragma once
 
+#include "rpc/iobuffer.h"
+#include "rpc/framing.h"
+
+#include <sys/uio.h>
+
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -7,9 +12,65 @@
 
 namespace tcp {
 
+/* frames are [length (network order)][body]; longer bodies are refused */
+constexpr uint32_t max_frame_size = 64 * 1024 * 1024;
+
+/* room for the length: the client and server pack their frames behind it */
+inline const rpc::Framing framing{sizeof(uint32_t)};
+
 int client_socket(const std::string& host, uint16_t port);
-int server_socket(uint16_t port);
-void send_buffer(int sock, const char* buffer, uint32_t len) noexcept;
-std::vector<char> recv_buffer(int sock) noexcept;
+int server_socket(uint16_t port, int backlog = 5);
+void set_nonblocking(int sock);
+void set_nodelay(int sock) noexcept;
+
+/*
+ * Both return `false` on a socket error (or EOF). `recv_buffer()` reuses
+ * `buffer` from frame to frame, and fails on a frame over `maxFrame`.
+ */
+bool send_buffer(int sock, const char* buffer, uint32_t len) noexcept;
+bool recv_buffer(int sock, std::vector<char>& buffer, uint32_t maxFrame = max_frame_size) noexcept;
+
+/*
+ * A frame of `count - 1` segments in `iov[1..]`, with vectored I/O:
+ * `iov[0]` is left for the length, and `iov` is consumed as it goes out
+ */
+bool send_buffers(int sock, iovec* iov, size_t count) noexcept;
+
+/* `len` bytes as they are, e.g. a frame whose length is patched in */
+bool send_all(int sock, const char* data, size_t len) noexcept;
+
+/*
+ * The length of a frame packed behind room for it (see `framing`), into that
+ * room. Returns `false` on a frame too long to tell.
+ */
+bool patch_length(msgpack::sbuffer& buffer) noexcept;
+
+/*
+ * A client's frame: in one piece, packed behind room for the length, or in
+ * segments (see `rpc::IoBuffer`)
+ */
+inline bool send_frame(int sock, msgpack::sbuffer& buffer) noexcept
+{
+	return patch_length(buffer) && send_all(sock, buffer.data(), buffer.size());
+}
+
+inline bool send_frame(int sock, const rpc::IoBuffer& buffer) noexcept
+{
+	std::vector<iovec> iov;
+
+	try {
+		iov.reserve(1 + buffer.count());
+	} catch (...) {
+		return false;
+	}
+
+	iov.push_back({ nullptr, 0 });
+
+	buffer.for_each([&](const char* data, size_t size) {
+		iov.push_back({ const_cast<char*>(data), size });
+	});
+
+	return send_buffers(sock, iov.data(), iov.size());
+}
 
 }
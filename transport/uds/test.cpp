@@ -0,0 +1,182 @@
+#include "uds_client.h"
+#include "uds_server.h"
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+
+static void rpc_client(const std::string& path)
+{
+	try {
+		rpc::UdsClient client(path);
+
+		int result = client.call<int>("add", 3, 4);
+		std::cout << "Result: " << result << "\n";
+
+		client.call<void>("print", "Hello, world !");
+
+		/* many threads share one connection */
+		std::vector<std::thread> threads;
+		std::atomic<int> failed{0};
+
+		for (int t = 0; t < 4; ++t) {
+			threads.emplace_back([&client, &failed, t] {
+				for (int i = 0; i < 1000; ++i) {
+					if (client.call<int>("add", t, i) != (t + i))
+						++failed;
+				}
+			});
+		}
+
+		for (auto& thread : threads)
+			thread.join();
+
+		std::cout << "Pipelined: " << ((failed == 0) ? "OK" : "FAILED") << "\n";
+
+		/* written once, in place: the frame carries a handle, the memfd goes along */
+		rpc::Blob blob(16 * 1024 * 1024);
+		std::iota(blob.data(), blob.data() + blob.size(), 0);
+
+		uint64_t expected = std::accumulate(blob.data(), blob.data() + blob.size(), uint64_t(0), [](uint64_t sum, char c) {
+			return sum + static_cast<uint8_t>(c);
+		});
+
+		bool attached = client.call<bool>("attached", blob);
+		uint64_t sum = client.call<uint64_t>("checksum", blob);
+
+		std::cout << "Blob argument: " << ((attached && (sum == expected)) ? "OK" : "FAILED") << "\n";
+
+		/* and back: mapped, not copied */
+		auto filled = client.call<rpc::Blob>("fill", 8 * 1024 * 1024, 'x');
+		bool ok = (filled.fd() >= 0) && (filled.size() == 8 * 1024 * 1024) &&
+			  std::all_of(filled.data(), filled.data() + filled.size(), [](char c) {
+				return c == 'x';
+			  });
+
+		std::cout << "Blob result: " << (ok ? "OK" : "FAILED") << "\n";
+
+		/* small ones are not worth a memfd */
+		auto small = client.call<rpc::Blob>("fill", 100, 'y');
+		std::cout << "Small blob: " << (((small.fd() < 0) && (small.size() == 100)) ? "OK" : "FAILED") << "\n";
+
+		/* a cached function is called anyway for blobs that go out-of-band, either way */
+		rpc::Blob other(blob.size());
+		std::fill(other.data(), other.data() + other.size(), 1);
+
+		ok = (client.call<uint64_t>("cached_checksum", blob) == expected) &&
+		     (client.call<uint64_t>("cached_checksum", other) == other.size());
+
+		for (int i = 0; i < 2; ++i) {
+			auto cached = client.call<rpc::Blob>("cached_fill", 1024 * 1024, 'z');
+			ok = ok && (cached.size() == 1024 * 1024) && (cached.data()[0] == 'z');
+		}
+
+		std::cout << "Cached blobs: " << (ok ? "OK" : "FAILED") << "\n";
+	} catch (const std::exception& ex) {
+		std::cerr << "RPC call failed: " << ex.what() << "\n";
+	} catch (...) {
+		std::cerr << "RPC call failed\n";
+	}
+}
+
+static void bind_functions(rpc::Server& server)
+{
+	server.bind("add", [](int a, int b) {
+		return a + b;
+	});
+
+	server.bind("print", [](std::string msg) {
+		std::cout << ">> " << msg << "\n";
+	});
+
+	server.bind("attached", [](rpc::Blob blob) {
+		return blob.fd() >= 0;
+	});
+
+	server.bind("checksum", [](rpc::Blob blob) {
+		uint64_t sum = 0;
+
+		for (size_t i = 0; i < blob.size(); ++i)
+			sum += static_cast<uint8_t>(blob.data()[i]);
+
+		return sum;
+	});
+
+	server.bind("fill", [](size_t size, char c) {
+		rpc::Blob blob(size);
+
+		std::fill(blob.data(), blob.data() + size, c);
+		return blob;
+	});
+
+	server.bind("cached_checksum", rpc::CachePolicy{}, [](rpc::Blob blob) {
+		uint64_t sum = 0;
+
+		for (size_t i = 0; i < blob.size(); ++i)
+			sum += static_cast<uint8_t>(blob.data()[i]);
+
+		return sum;
+	});
+
+	server.bind("cached_fill", rpc::CachePolicy{}, [](size_t size, char c) {
+		rpc::Blob blob(size);
+
+		std::fill(blob.data(), blob.data() + size, c);
+		return blob;
+	});
+}
+
+static std::string parse_path(int argc, char* argv[])
+{
+	return (argc > 2) ? argv[2] : "/tmp/rpc_for_dummies.sock";
+}
+
+int main(int argc, char* argv[])
+{
+	if ((argc > 1) && (std::string(argv[1]) == "--server")) {
+		try {
+			rpc::UdsServer server(parse_path(argc, argv));
+
+			bind_functions(server);
+			server.run(server);
+		} catch (const std::exception& ex) {
+			std::cerr << "RPC server failed: " << ex.what() << "\n";
+		}
+
+		return 0;
+	}
+
+	if ((argc > 1) && (std::string(argv[1]) == "--client")) {
+		rpc_client(parse_path(argc, argv));
+		return 0;
+	}
+
+	if ((argc > 1) && (std::string(argv[1]) == "--loopback")) {
+		try {
+			/* never returns: left running until exit */
+			auto server = new rpc::UdsServer(parse_path(argc, argv));
+			bind_functions(*server);
+
+			std::thread([server] {
+				server->run(*server);
+			}).detach();
+
+			rpc_client(parse_path(argc, argv));
+		} catch (const std::exception& ex) {
+			std::cerr << "RPC server failed: " << ex.what() << "\n";
+			return 1;
+		}
+
+		return 0;
+	}
+
+	std::cerr << "Unix domain socket RPC test\n";
+	std::cerr << "Command line options:\n";
+	std::cerr << "  --server [path]    invoke RPC server\n";
+	std::cerr << "  --client [path]    invoke RPC client\n";
+	std::cerr << "  --loopback [path]  invoke both, in one process\n";
+	return 1;
+}
@@ -0,0 +1,187 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Unix domain socket transport implementation for RPC client
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "rpc/client.h"
+#include "rpc/awaitable.h"
+#include "rpc/blob.h"
+#include "utils.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+
+namespace rpc {
+
+/*
+ * Any number of calls in flight on one connection, the responses collected
+ * by a reader thread. `Blob` arguments from `blob::memfd_min` up go out as
+ * memfds (see `UdsServer`), except in a batch, which is packed before the
+ * transport gets to see it.
+ */
+class UdsClient {
+public:
+	UdsClient(const std::string& path, uint32_t maxFrameSize = uds::max_frame_size)
+		:m_sock(uds::client_socket(path))
+		,m_maxFrameSize(maxFrameSize)
+	{
+		m_reader = std::thread([this] {
+			receive_loop();
+		});
+	}
+
+	~UdsClient()
+	{
+		/* wake up the reader */
+		shutdown(m_sock, SHUT_RDWR);
+		m_reader.join();
+
+		close(m_sock);
+	}
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	R call(const FuncID& funcID, Args&&... args)
+	{
+		return async_call<R>(funcID, std::forward<Args>(args)...).get();
+	}
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	std::future<R> async_call(const FuncID& funcID, Args&&... args)
+	{
+		blob::Outgoing outgoing;
+		auto [future, buffer, id] = m_client.call<R>(funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), outgoing.fds(), &id, 1);
+		return std::move(future);
+	}
+
+	/*
+	 * The callback is invoked on the reader thread (see `Client::call()`)
+	 */
+	template <typename R, typename Callback, typename FuncID, typename... Args,
+		  std::enable_if_t<!is_func_id_v<Callback>, int> = 0>
+	uint32_t async_call(Callback&& callback, const FuncID& funcID, Args&&... args)
+	{
+		blob::Outgoing outgoing;
+		auto [buffer, id] = m_client.call<R>(std::forward<Callback>(callback), funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), outgoing.fds(), &id, 1);
+		return id;
+	}
+
+	/*
+	 * Batch calls (see `Client::Batch`): the calls go out in a single frame
+	 * upon `call_batch()`, their futures/callbacks complete on the reader thread
+	 */
+	Client::Batch batch()
+	{
+		return m_client.batch();
+	}
+
+	void call_batch(Client::Batch&& batch)
+	{
+		auto [buffer, ids] = m_client.call_batch(std::move(batch));
+		if (ids.empty())
+			return;
+
+		send(std::move(buffer), {}, ids.data(), ids.size());
+	}
+
+	/*
+	 * Streaming call (see `Client::stream_call()`): the chunks are delivered
+	 * on the reader thread as they arrive
+	 */
+	template <typename T, typename OnChunk, typename OnDone, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	uint32_t stream_call(OnChunk&& onChunk, OnDone&& onDone, const FuncID& funcID, Args&&... args)
+	{
+		blob::Outgoing outgoing;
+		auto [buffer, id] = m_client.stream_call<T>(std::forward<OnChunk>(onChunk), std::forward<OnDone>(onDone), funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), outgoing.fds(), &id, 1);
+		return id;
+	}
+
+#ifdef RPC_HAS_COROUTINES
+	/*
+	 * The coroutine is resumed on the reader thread
+	 */
+	template <typename R, typename FuncID, typename... Args>
+	auto co_call(const FuncID& funcID, Args&&... args)
+	{
+		return make_awaitable<R>([this, funcID, args = std::make_tuple(std::forward<Args>(args)...)](auto&& callback) mutable {
+			std::apply([&](auto&... args) {
+				async_call<R>(std::move(callback), funcID, std::move(args)...);
+			}, args);
+		});
+	}
+#endif
+
+private:
+	int m_sock;
+	uint32_t m_maxFrameSize;
+	rpc::Client m_client;
+
+	std::thread m_reader;
+	std::mutex m_sendMutex;
+	std::atomic<bool> m_closed{false};
+
+	/* `fds`: of the blobs attached to the frame */
+	template <typename Buffer>
+	void send(Buffer&& buffer, const std::vector<int>& fds, const uint32_t* ids, size_t count)
+	{
+		/* a call that joined one in flight (see `SingleFlight`): nothing to send */
+		if (buffer.size() == 0)
+			return;
+
+		bool sent;
+
+		{
+			std::lock_guard lock(m_sendMutex);
+			sent = uds::send_frame(m_sock, buffer, fds.data(), fds.size());
+		}
+
+		pool::recycle(std::move(buffer));
+
+		/*
+		 * The reader sets `m_closed` before failing the outstanding calls,
+		 * so a call registered after that is failed here.
+		 */
+		if (!sent || m_closed) {
+			for (size_t i = 0; i < count; ++i)
+				m_client.cancel(ids[i], ConnectionError("client: connection closed"));
+		}
+	}
+
+	void receive_loop() noexcept
+	{
+		std::vector<char> respBuffer;
+		std::vector<int> fds;
+
+		while (uds::recv_buffer(m_sock, respBuffer, fds, m_maxFrameSize)) {
+			blob::Incoming incoming(std::move(fds));
+
+			try {
+				m_client.ingest_resp(respBuffer.data(), respBuffer.size(), true/*last*/);
+			} catch (...) {
+				/* response to a cancelled call, or a malformed one: drop it */
+			}
+		}
+
+		m_closed = true;
+		m_client.cancel_all(std::make_exception_ptr(ConnectionError("client: connection closed")));
+	}
+};
+
+}
@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Unix domain socket transport implementation for RPC server
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "rpc/server.h"
+#include "rpc/blob.h"
+#include "utils.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <thread>
+
+
+namespace rpc {
+
+/*
+ * Same as `TcpServer` (thread per connection) for local peers: `Blob`
+ * arguments and results from `blob::memfd_min` up travel out-of-band,
+ * as memfds passed along the frame, and are mapped instead of copied.
+ */
+class UdsServer : public rpc::Server {
+public:
+	struct Options {
+		int backlog = SOMAXCONN;
+		uint32_t maxFrameSize = uds::max_frame_size;
+	};
+
+	UdsServer(const std::string& path)
+		:UdsServer(path, Options())
+	{ }
+
+	UdsServer(const std::string& path, const Options& options)
+		:listen_sock(uds::server_socket(path, options.backlog))
+		,m_path(path)
+		,m_options(options)
+	{ }
+
+	~UdsServer()
+	{
+		close(listen_sock);
+		unlink(m_path.c_str());
+	}
+
+	void run(Server& server)
+	{
+		while (true) {
+			int client_sock = accept4(listen_sock, nullptr, nullptr, SOCK_CLOEXEC);
+			if (client_sock < 0)
+				continue;
+
+			std::thread([this, client_sock]() {
+				serve(client_sock);
+
+				close(client_sock);
+			}).detach();
+		}
+	}
+
+private:
+	int listen_sock;
+	std::string m_path;
+	Options m_options;
+
+	void serve(int client_sock) noexcept
+	{
+		std::vector<char> reqBuffer;
+		std::vector<int> fds;
+
+		try {
+			while (uds::recv_buffer(client_sock, reqBuffer, fds, m_options.maxFrameSize)) {
+				blob::Incoming incoming(std::move(fds));
+				blob::Outgoing outgoing;
+				bool sent = true;
+
+				handle_call(reqBuffer.data(), reqBuffer.size(), [&](msgpack::sbuffer&& resp) {
+					auto attached = outgoing.fds();
+
+					sent = sent && uds::send_buffer(client_sock, resp.data(), resp.size(), attached.data(), attached.size());
+					outgoing.clear();
+					pool::recycle(std::move(resp));
+				});
+
+				if (!sent)
+					break;
+			}
+		} catch (...) {
+		}
+	}
+};
+
+}
@@ -0,0 +1,229 @@
+#include "utils.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <algorithm>
+#include <stdexcept>
+
+
+namespace uds {
+
+static sockaddr_un address(const std::string& path)
+{
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof(addr.sun_path))
+		throw std::runtime_error("socket path too long: " + path);
+
+	std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+	return addr;
+}
+
+int client_socket(const std::string& path)
+{
+	auto addr = address(path);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		throw std::runtime_error("socket() failed");
+
+	if (connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+		close(sock);
+		throw std::runtime_error("connect() failed: " + path);
+	}
+
+	return sock;
+}
+
+int server_socket(const std::string& path, int backlog)
+{
+	auto addr = address(path);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		throw std::runtime_error("socket() failed");
+
+	/* a stale socket file of a previous server */
+	unlink(path.c_str());
+
+	if (bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+		close(sock);
+		throw std::runtime_error("bind() failed: " + path);
+	}
+
+	if (listen(sock, backlog) < 0) {
+		close(sock);
+		throw std::runtime_error("listen() failed");
+	}
+
+	return sock;
+}
+
+bool send_buffer(int sock, const char* buffer, uint32_t len, const int* fds, size_t count) noexcept
+{
+	iovec iov[2] = {
+		{ nullptr, 0 },
+		{ const_cast<char*>(buffer), len },
+	};
+
+	return send_buffers(sock, iov, 2, fds, count);
+}
+
+bool send_buffers(int sock, iovec* iov, size_t count, const int* fds, size_t fdCount) noexcept
+{
+	size_t len = 0;
+
+	for (size_t i = 1; i < count; ++i)
+		len += iov[i].iov_len;
+
+	if ((len > UINT32_MAX) || (fdCount > max_fds))
+		return false;
+
+	uint32_t net_len = htonl(static_cast<uint32_t>(len));
+	iov[0] = { &net_len, sizeof(net_len) };
+
+	msghdr msg{};
+	msg.msg_iov = iov;
+
+	alignas(cmsghdr) char control[CMSG_SPACE(max_fds * sizeof(int))];
+
+	if (fdCount > 0) {
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE(fdCount * sizeof(int));
+
+		cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(fdCount * sizeof(int));
+		std::memcpy(CMSG_DATA(cmsg), fds, fdCount * sizeof(int));
+	}
+
+	while (count > 0) {
+		msg.msg_iovlen = std::min<size_t>(count, IOV_MAX);
+
+		ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return false;
+		}
+
+		/* the fds went out with the first byte */
+		msg.msg_control = nullptr;
+		msg.msg_controllen = 0;
+
+		/* partial write: skip what went out */
+		while ((count > 0) && (static_cast<size_t>(sent) >= msg.msg_iov->iov_len)) {
+			sent -= msg.msg_iov->iov_len;
+			++msg.msg_iov;
+			--count;
+		}
+
+		if (count > 0) {
+			msg.msg_iov->iov_base = static_cast<char*>(msg.msg_iov->iov_base) + sent;
+			msg.msg_iov->iov_len -= sent;
+		}
+	}
+
+	return true;
+}
+
+/* the fds arrive with the first byte of the frame, that is with its length */
+static bool recv_all(int sock, char* data, size_t len, std::vector<int>* fds) noexcept
+{
+	alignas(cmsghdr) char control[CMSG_SPACE(max_fds * sizeof(int))];
+
+	while (len > 0) {
+		iovec iov = { data, len };
+
+		msghdr msg{};
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		if (fds != nullptr) {
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+		}
+
+		ssize_t received = recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+
+		if ((received < 0) && (errno == EINTR))
+			continue;
+
+		if (fds != nullptr) {
+			for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+				if ((cmsg->cmsg_level != SOL_SOCKET) || (cmsg->cmsg_type != SCM_RIGHTS))
+					continue;
+
+				size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				const char* first = reinterpret_cast<const char*>(CMSG_DATA(cmsg));
+
+				for (size_t i = 0; i < count; ++i) {
+					int fd;
+					std::memcpy(&fd, first + i * sizeof(int), sizeof(fd));
+					fds->push_back(fd);
+				}
+			}
+
+			/* fds dropped for lack of room: the frame cannot be made sense of */
+			if (msg.msg_flags & MSG_CTRUNC)
+				return false;
+		}
+
+		if (received <= 0)
+			return false;
+
+		data += received;
+		len -= received;
+	}
+
+	return true;
+}
+
+static bool recv_frame(int sock, std::vector<char>& buffer, std::vector<int>& fds, uint32_t maxFrame) noexcept
+{
+	uint32_t net_len = 0;
+
+	if (!recv_all(sock, reinterpret_cast<char*>(&net_len), sizeof(net_len), &fds))
+		return false;
+
+	uint32_t len = ntohl(net_len);
+	if (len > maxFrame)
+		return false;
+
+	try {
+		/* no reallocation once the buffer has grown to the usual frame size */
+		buffer.resize(len);
+	} catch (...) {
+		return false;
+	}
+
+	return recv_all(sock, buffer.data(), len, nullptr);
+}
+
+bool recv_buffer(int sock, std::vector<char>& buffer, std::vector<int>& fds, uint32_t maxFrame) noexcept
+{
+	fds.clear();
+
+	if (recv_frame(sock, buffer, fds, maxFrame))
+		return true;
+
+	for (int fd : fds)
+		close(fd);
+
+	fds.clear();
+	return false;
+}
+
+}
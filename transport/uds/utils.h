@@ -0,0 +1,62 @@
+#pragma once
+
+#include "rpc/iobuffer.h"
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace uds {
+
+/* frames are [length (network order)][body], the attached fds ride along the length */
+constexpr uint32_t max_frame_size = 64 * 1024 * 1024;
+
+/* fds per frame */
+constexpr size_t max_fds = 64;
+
+int client_socket(const std::string& path);
+int server_socket(const std::string& path, int backlog = 5);
+
+/*
+ * Both return `false` on a socket error (or EOF). `recv_buffer()` reuses
+ * `buffer` from frame to frame, fails on a frame over `maxFrame`, and
+ * returns the fds received with the frame in `fds` (the caller owns them).
+ */
+bool send_buffer(int sock, const char* buffer, uint32_t len, const int* fds = nullptr, size_t count = 0) noexcept;
+bool recv_buffer(int sock, std::vector<char>& buffer, std::vector<int>& fds, uint32_t maxFrame = max_frame_size) noexcept;
+
+/*
+ * A frame of `count - 1` segments in `iov[1..]`, with vectored I/O:
+ * `iov[0]` is left for the length, and `iov` is consumed as it goes out
+ */
+bool send_buffers(int sock, iovec* iov, size_t count, const int* fds = nullptr, size_t fdCount = 0) noexcept;
+
+/* a client's frame: in one piece, or in segments (see `rpc::IoBuffer`) */
+inline bool send_frame(int sock, const msgpack::sbuffer& buffer, const int* fds = nullptr, size_t fdCount = 0) noexcept
+{
+	return send_buffer(sock, buffer.data(), buffer.size(), fds, fdCount);
+}
+
+inline bool send_frame(int sock, const rpc::IoBuffer& buffer, const int* fds = nullptr, size_t fdCount = 0) noexcept
+{
+	std::vector<iovec> iov;
+
+	try {
+		iov.reserve(1 + buffer.count());
+	} catch (...) {
+		return false;
+	}
+
+	iov.push_back({ nullptr, 0 });
+
+	buffer.for_each([&](const char* data, size_t size) {
+		iov.push_back({ const_cast<char*>(data), size });
+	});
+
+	return send_buffers(sock, iov.data(), iov.size(), fds, fdCount);
+}
+
+}
@@ -0,0 +1,389 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Minimal io_uring wrapper: the ring itself, a provided buffer ring
+ * (for multishot receive) and a set of registered (fixed) send buffers.
+ *
+ * Straight on top of the system calls, no liburing required.
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace uring {
+
+/*
+ * Receive buffers handed to the kernel up front: a multishot receive picks
+ * one per completion (IOSQE_BUFFER_SELECT), the application returns it with
+ * `recycle()` once the data is consumed.
+ */
+class BufferRing {
+public:
+	/* `count` must be a power of 2 */
+	BufferRing(uint16_t groupID, unsigned count, unsigned size)
+		:m_groupID(groupID)
+		,m_count(count)
+		,m_size(size)
+		,m_storage(size_t(count) * size)
+	{
+		if ((count == 0) || (count & (count - 1)) || (count > 32768))
+			throw std::invalid_argument("buffer ring size must be a power of 2, up to 32768");
+
+		m_ringSize = count * sizeof(io_uring_buf);
+		m_ring = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (m_ring == MAP_FAILED)
+			throw std::runtime_error("buffer ring mmap() failed");
+
+		for (unsigned i = 0; i < count; ++i)
+			add(i, i);
+
+		publish(count);
+	}
+
+	~BufferRing()
+	{
+		munmap(m_ring, m_ringSize);
+	}
+
+	BufferRing(const BufferRing&) = delete;
+	BufferRing& operator=(const BufferRing&) = delete;
+
+	uint16_t group() const noexcept
+	{
+		return m_groupID;
+	}
+
+	unsigned count() const noexcept
+	{
+		return m_count;
+	}
+
+	void* ring() const noexcept
+	{
+		return m_ring;
+	}
+
+	const char* data(uint16_t bufferID) const noexcept
+	{
+		return m_storage.data() + size_t(bufferID) * m_size;
+	}
+
+	void recycle(uint16_t bufferID) noexcept
+	{
+		add(bufferID, 0);
+		publish(1);
+	}
+
+private:
+	uint16_t m_groupID;
+	unsigned m_count;
+	unsigned m_size;
+	std::vector<char> m_storage;
+	void* m_ring;
+	size_t m_ringSize;
+	uint16_t m_tail = 0;
+
+	void add(uint16_t bufferID, unsigned offset) noexcept
+	{
+		/* not `io_uring_buf_ring::bufs`: its empty struct header is not empty in C++ */
+		auto bufs = static_cast<io_uring_buf*>(m_ring);
+		auto& buf = bufs[(m_tail + offset) & (m_count - 1)];
+
+		buf.addr = reinterpret_cast<uint64_t>(data(bufferID));
+		buf.len = m_size;
+		buf.bid = bufferID;
+	}
+
+	void publish(unsigned count) noexcept
+	{
+		m_tail += count;
+		__atomic_store_n(&static_cast<io_uring_buf_ring*>(m_ring)->tail, m_tail, __ATOMIC_RELEASE);
+	}
+};
+
+
+/*
+ * Send buffers registered with the kernel once, for zero-copy sends
+ * (IORING_OP_SEND_ZC) without per-call page pinning. A buffer is referenced
+ * by its sender and by every pending zero-copy notification.
+ */
+class FixedBuffers {
+public:
+	static constexpr int none = -1;
+
+	/* sends shorter than `minSend` are not worth the zero-copy path */
+	FixedBuffers(unsigned count, unsigned size, unsigned minSend)
+		:m_size(size)
+		,m_minSend(minSend)
+		,m_storage(size_t(count) * size)
+		,m_refs(count, 0)
+	{
+		for (unsigned i = 0; i < count; ++i)
+			m_free.push_back(i);
+	}
+
+	std::vector<iovec> iovecs() const
+	{
+		std::vector<iovec> iov(m_refs.size());
+
+		for (size_t i = 0; i < iov.size(); ++i) {
+			iov[i].iov_base = const_cast<char*>(m_storage.data()) + i * m_size;
+			iov[i].iov_len = m_size;
+		}
+
+		return iov;
+	}
+
+	bool fits(size_t len) const noexcept
+	{
+		return m_enabled && (len >= m_minSend) && (len <= m_size);
+	}
+
+	/* the socket (or kernel) cannot send zero-copy */
+	void disable() noexcept
+	{
+		m_enabled = false;
+	}
+
+	/* index of a free buffer, or `none` */
+	int acquire() noexcept
+	{
+		if (m_free.empty())
+			return none;
+
+		int index = m_free.back();
+		m_free.pop_back();
+
+		m_refs[index] = 1;
+		return index;
+	}
+
+	void hold(int index) noexcept
+	{
+		++m_refs[index];
+	}
+
+	void release(int index) noexcept
+	{
+		if (--m_refs[index] == 0)
+			m_free.push_back(index);
+	}
+
+	char* data(int index) noexcept
+	{
+		return m_storage.data() + size_t(index) * m_size;
+	}
+
+private:
+	unsigned m_size;
+	unsigned m_minSend;
+	std::vector<char> m_storage;
+	std::vector<unsigned> m_refs;
+	std::vector<int> m_free;
+	bool m_enabled = true;
+};
+
+
+class Ring {
+public:
+	explicit Ring(unsigned entries)
+	{
+		io_uring_params params{};
+
+		m_fd = syscall(__NR_io_uring_setup, entries, &params);
+		if (m_fd < 0)
+			throw std::runtime_error("io_uring_setup() failed: " + std::string(strerror(errno)));
+
+		m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+			m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+		m_sqRing = map(m_sqRingSize, IORING_OFF_SQ_RING);
+		m_cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? m_sqRing : map(m_cqRingSize, IORING_OFF_CQ_RING);
+
+		m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		m_sqes = static_cast<io_uring_sqe*>(map(m_sqesSize, IORING_OFF_SQES));
+
+		auto sq = static_cast<char*>(m_sqRing);
+		m_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+		m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		m_sqEntries = params.sq_entries;
+
+		/* identity mapping: SQE i sits in slot i */
+		auto array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		for (unsigned i = 0; i < m_sqEntries; ++i)
+			array[i] = i;
+
+		auto cq = static_cast<char*>(m_cqRing);
+		m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+		m_tail = *m_sqTail;
+		m_submitted = m_tail;
+	}
+
+	~Ring()
+	{
+		munmap(m_sqes, m_sqesSize);
+
+		if (m_cqRing != m_sqRing)
+			munmap(m_cqRing, m_cqRingSize);
+
+		munmap(m_sqRing, m_sqRingSize);
+		close(m_fd);
+	}
+
+	Ring(const Ring&) = delete;
+	Ring& operator=(const Ring&) = delete;
+
+	int fd() const noexcept
+	{
+		return m_fd;
+	}
+
+	/*
+	 * Zeroed SQE; queued SQEs are submitted in one go by `submit()`,
+	 * or earlier, when the submission queue is full.
+	 */
+	io_uring_sqe* get_sqe()
+	{
+		while (m_tail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+			submit();
+
+		auto sqe = &m_sqes[m_tail & m_sqMask];
+		std::memset(sqe, 0, sizeof(*sqe));
+
+		++m_tail;
+		return sqe;
+	}
+
+	/* submit everything queued, and wait for (at least) `waitFor` completions */
+	void submit(unsigned waitFor = 0)
+	{
+		__atomic_store_n(m_sqTail, m_tail, __ATOMIC_RELEASE);
+
+		unsigned toSubmit = m_tail - m_submitted;
+		unsigned flags = (waitFor > 0) ? IORING_ENTER_GETEVENTS : 0;
+
+		if ((toSubmit == 0) && (waitFor == 0))
+			return;
+
+		while (true) {
+			int ret = syscall(__NR_io_uring_enter, m_fd, toSubmit, waitFor, flags, nullptr, 0);
+
+			if (ret >= 0) {
+				m_submitted += ret;
+				return;
+			}
+
+			if ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)) {
+				/* completions will be reaped by the caller and the rest resubmitted later */
+				if (errno != EINTR)
+					return;
+
+				continue;
+			}
+
+			throw std::runtime_error("io_uring_enter() failed: " + std::string(strerror(errno)));
+		}
+	}
+
+	/* invoke `handler(const io_uring_cqe&)` for every available completion */
+	template <typename Handler>
+	unsigned for_each_cqe(Handler&& handler)
+	{
+		unsigned head = *m_cqHead;
+		unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+		unsigned count = 0;
+
+		while (head != tail) {
+			/* copy, so that the slot is free for reuse while handling */
+			io_uring_cqe cqe = m_cqes[head & m_cqMask];
+
+			++head;
+			++count;
+			__atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+
+			handler(cqe);
+		}
+
+		return count;
+	}
+
+	/*
+	 * The buffers must outlive the ring: the kernel may write into them
+	 * until the ring is closed.
+	 */
+	void register_buffers(const FixedBuffers& buffers)
+	{
+		auto iov = buffers.iovecs();
+
+		if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, iov.data(), iov.size()) < 0)
+			throw std::runtime_error("io_uring_register(BUFFERS) failed: " + std::string(strerror(errno)));
+	}
+
+	void register_buf_ring(const BufferRing& buffers)
+	{
+		io_uring_buf_reg reg{};
+
+		reg.ring_addr = reinterpret_cast<uint64_t>(buffers.ring());
+		reg.ring_entries = buffers.count();
+		reg.bgid = buffers.group();
+
+		if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+			throw std::runtime_error("io_uring_register(PBUF_RING) failed: " + std::string(strerror(errno)));
+	}
+
+private:
+	int m_fd;
+
+	void* m_sqRing;
+	void* m_cqRing;
+	size_t m_sqRingSize;
+	size_t m_cqRingSize;
+	io_uring_sqe* m_sqes;
+	size_t m_sqesSize;
+
+	unsigned* m_sqHead;
+	unsigned* m_sqTail;
+	unsigned m_sqMask;
+	unsigned m_sqEntries;
+	unsigned m_tail;	/* local SQ tail, published on submit */
+	unsigned m_submitted;
+
+	unsigned* m_cqHead;
+	unsigned* m_cqTail;
+	unsigned m_cqMask;
+	io_uring_cqe* m_cqes;
+
+	void* map(size_t size, off_t offset)
+	{
+		void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+		if (ptr == MAP_FAILED)
+			throw std::runtime_error("io_uring mmap() failed");
+
+		return ptr;
+	}
+};
+
+}
@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: MIT
+/*
+ * A framed TCP stream driven by an io_uring
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "ring.h"
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <cstring>
+#include <vector>
+
+
+namespace uring {
+
+/*
+ * Completion routing: user_data = [op:8][index:16][stream:32]
+ */
+enum class Op : uint8_t {
+	Accept = 1,
+	Recv,
+	Send,
+	Wake,
+};
+
+inline uint64_t user_data(Op op, uint32_t stream, uint16_t index = 0) noexcept
+{
+	return (uint64_t(op) << 56) | (uint64_t(index) << 32) | stream;
+}
+
+inline Op op_of(uint64_t userData) noexcept
+{
+	return static_cast<Op>(userData >> 56);
+}
+
+inline uint32_t stream_of(uint64_t userData) noexcept
+{
+	return static_cast<uint32_t>(userData);
+}
+
+inline uint16_t index_of(uint64_t userData) noexcept
+{
+	return static_cast<uint16_t>(userData >> 32);
+}
+
+
+/*
+ * Frames are [length (network order)][body] both ways.
+ *
+ * Receive: a single multishot receive fills provided buffers; frames that
+ * arrive whole are handed out straight from the provided buffer, only
+ * a frame split between buffers is assembled on the side.
+ *
+ * Send: outgoing frames are appended to a queue, and the whole queue goes
+ * out in a single send; a large one goes zero-copy from a registered buffer.
+ * One send is in flight per stream, to keep the byte order.
+ */
+class Stream {
+public:
+	Stream(int sock, uint32_t id) noexcept
+		:m_sock(sock)
+		,m_id(id)
+	{ }
+
+	~Stream()
+	{
+		close(m_sock);
+	}
+
+	Stream(const Stream&) = delete;
+	Stream& operator=(const Stream&) = delete;
+
+	int sock() const noexcept
+	{
+		return m_sock;
+	}
+
+	void arm_recv(Ring& ring, const BufferRing& buffers)
+	{
+		auto sqe = ring.get_sqe();
+
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = m_sock;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = buffers.group();
+		sqe->user_data = user_data(Op::Recv, m_id);
+
+		m_recvArmed = true;
+	}
+
+	/*
+	 * Handle a receive completion: `onFrame(const char*, size_t)` (must not throw)
+	 * for every complete frame. Returns `false` once the stream is done receiving.
+	 */
+	template <typename OnFrame>
+	bool received(Ring& ring, BufferRing& buffers, const io_uring_cqe& cqe, OnFrame&& onFrame)
+	{
+		if (cqe.flags & IORING_CQE_F_BUFFER) {
+			uint16_t bufferID = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+
+			if (cqe.res > 0)
+				feed(buffers.data(bufferID), cqe.res, onFrame);
+
+			buffers.recycle(bufferID);
+		}
+
+		if (cqe.flags & IORING_CQE_F_MORE)
+			return true;
+
+		m_recvArmed = false;
+
+		if ((cqe.res > 0) || (cqe.res == -ENOBUFS)) {
+			/* the kernel ran out of provided buffers: ours are recycled, go on */
+			arm_recv(ring, buffers);
+			return true;
+		}
+
+		/* peer closed, or error */
+		return false;
+	}
+
+	void queue(const char* data, uint32_t len)
+	{
+		uint32_t net_len = htonl(len);
+
+		m_txQueue.insert(m_txQueue.end(), reinterpret_cast<const char*>(&net_len), reinterpret_cast<const char*>(&net_len) + sizeof(net_len));
+		m_txQueue.insert(m_txQueue.end(), data, data + len);
+	}
+
+	/* queue frames framed already by the caller; `frames` is left empty */
+	void queue(std::vector<char>& frames)
+	{
+		if (m_txQueue.empty())
+			m_txQueue.swap(frames);
+		else
+			m_txQueue.insert(m_txQueue.end(), frames.begin(), frames.end());
+
+		frames.clear();
+	}
+
+	/* start sending the queued frames, unless a send is in flight already */
+	void flush(Ring& ring, FixedBuffers& fixed)
+	{
+		if (sending() || m_txQueue.empty())
+			return;
+
+		if (fixed.fits(m_txQueue.size()))
+			m_fixed = fixed.acquire();
+
+		if (m_fixed != FixedBuffers::none) {
+			std::memcpy(fixed.data(m_fixed), m_txQueue.data(), m_txQueue.size());
+			m_txData = fixed.data(m_fixed);
+			m_txLen = m_txQueue.size();
+			m_txQueue.clear();
+		} else {
+			m_txBuffer.swap(m_txQueue);
+			m_txQueue.clear();
+			m_txData = m_txBuffer.data();
+			m_txLen = m_txBuffer.size();
+		}
+
+		m_txDone = 0;
+		submit_send(ring, fixed);
+	}
+
+	/*
+	 * A zero-copy send completes twice: once sent, and once the kernel is done
+	 * with the buffer. The latter may come after the stream is gone, hence
+	 * handled apart: returns `true` if `cqe` is such a notification.
+	 */
+	static bool notified(FixedBuffers& fixed, const io_uring_cqe& cqe) noexcept
+	{
+		if (!(cqe.flags & IORING_CQE_F_NOTIF))
+			return false;
+
+		fixed.release(index_of(cqe.user_data) - 1);
+		return true;
+	}
+
+	/*
+	 * Handle a send completion. Returns `false` on a socket error.
+	 */
+	bool sent(Ring& ring, FixedBuffers& fixed, const io_uring_cqe& cqe)
+	{
+		if ((index_of(cqe.user_data) > 0) && !(cqe.flags & IORING_CQE_F_MORE)) {
+			/* no notification to follow */
+			fixed.release(index_of(cqe.user_data) - 1);
+		}
+
+		if (((cqe.res == -EOPNOTSUPP) || (cqe.res == -EINVAL)) && (m_fixed != FixedBuffers::none) && (m_txDone == 0)) {
+			/* no zero-copy here: copy and stop trying */
+			fixed.disable();
+			m_txBuffer.assign(m_txData, m_txData + m_txLen);
+			fixed.release(m_fixed);
+			m_fixed = FixedBuffers::none;
+			m_txData = m_txBuffer.data();
+
+			submit_send(ring, fixed);
+			return true;
+		}
+
+		if (cqe.res < 0) {
+			finish_send(fixed);
+			return false;
+		}
+
+		m_txDone += cqe.res;
+
+		if (m_txDone < m_txLen) {
+			/* partial send */
+			submit_send(ring, fixed);
+			return true;
+		}
+
+		finish_send(fixed);
+		flush(ring, fixed);
+		return true;
+	}
+
+	/* stop handling input; the receive completes once the socket is down */
+	void shutdown() noexcept
+	{
+		m_shut = true;
+		::shutdown(m_sock, SHUT_RDWR);
+	}
+
+	bool is_shut() const noexcept
+	{
+		return m_shut;
+	}
+
+	bool sending() const noexcept
+	{
+		return (m_txLen > 0);
+	}
+
+	bool receiving() const noexcept
+	{
+		return m_recvArmed;
+	}
+
+private:
+	int m_sock;
+	uint32_t m_id;
+	bool m_recvArmed = false;
+	bool m_shut = false;
+
+	/* partial frame */
+	std::vector<char> m_rxBuffer;
+
+	std::vector<char> m_txQueue;
+	std::vector<char> m_txBuffer;
+	int m_fixed = FixedBuffers::none;
+	const char* m_txData = nullptr;
+	size_t m_txLen = 0;
+	size_t m_txDone = 0;
+
+	template <typename OnFrame>
+	void feed(const char* data, size_t len, OnFrame& onFrame)
+	{
+		if (m_rxBuffer.empty()) {
+			size_t used = cut(data, len, onFrame);
+			m_rxBuffer.assign(data + used, data + len);
+			return;
+		}
+
+		m_rxBuffer.insert(m_rxBuffer.end(), data, data + len);
+
+		size_t used = cut(m_rxBuffer.data(), m_rxBuffer.size(), onFrame);
+		m_rxBuffer.erase(m_rxBuffer.begin(), m_rxBuffer.begin() + used);
+	}
+
+	template <typename OnFrame>
+	static size_t cut(const char* data, size_t len, OnFrame& onFrame)
+	{
+		size_t offset = 0;
+
+		while (len - offset >= sizeof(uint32_t)) {
+			uint32_t frameLen;
+
+			std::memcpy(&frameLen, data + offset, sizeof(frameLen));
+			frameLen = ntohl(frameLen);
+
+			if (len - offset - sizeof(frameLen) < frameLen)
+				break;
+
+			onFrame(data + offset + sizeof(frameLen), frameLen);
+			offset += sizeof(frameLen) + frameLen;
+		}
+
+		return offset;
+	}
+
+	void submit_send(Ring& ring, FixedBuffers& fixed)
+	{
+		auto sqe = ring.get_sqe();
+
+		sqe->fd = m_sock;
+		sqe->addr = reinterpret_cast<uint64_t>(m_txData + m_txDone);
+		sqe->len = m_txLen - m_txDone;
+		sqe->msg_flags = MSG_NOSIGNAL;
+
+		if (m_fixed != FixedBuffers::none) {
+			/* referenced until the notification */
+			fixed.hold(m_fixed);
+
+			sqe->opcode = IORING_OP_SEND_ZC;
+			sqe->ioprio = IORING_RECVSEND_FIXED_BUF;
+			sqe->buf_index = m_fixed;
+			sqe->user_data = user_data(Op::Send, m_id, m_fixed + 1);
+		} else {
+			sqe->opcode = IORING_OP_SEND;
+			sqe->user_data = user_data(Op::Send, m_id);
+		}
+	}
+
+	void finish_send(FixedBuffers& fixed) noexcept
+	{
+		if (m_fixed != FixedBuffers::none) {
+			fixed.release(m_fixed);
+			m_fixed = FixedBuffers::none;
+		}
+
+		m_txData = nullptr;
+		m_txLen = 0;
+		m_txDone = 0;
+	}
+};
+
+}
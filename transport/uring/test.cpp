@@ -0,0 +1,191 @@
+#include "uring_client.h"
+#include "uring_server.h"
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+static void rpc_client(uint16_t port)
+{
+	try {
+		rpc::UringClient client("127.0.0.1", port);
+
+		int result = client.call<int>("add", 3, 4);
+		std::cout << "Result: " << result << "\n";
+
+		client.call<void>("print", "Hello, world !");
+
+		/* many threads share one connection */
+		std::vector<std::thread> threads;
+		std::atomic<int> failed{0};
+
+		for (int t = 0; t < 4; ++t) {
+			threads.emplace_back([&client, &failed, t] {
+				for (int i = 0; i < 1000; ++i) {
+					if (client.call<int>("add", t, i) != (t + i))
+						++failed;
+				}
+			});
+		}
+
+		for (auto& thread : threads)
+			thread.join();
+
+		std::cout << "Pipelined: " << ((failed == 0) ? "OK" : "FAILED") << "\n";
+
+		/* fan out without blocking a thread per call */
+		std::vector<std::future<int>> futures;
+
+		for (int i = 0; i < 10; ++i)
+			futures.push_back(client.async_call<int>("add", i, i));
+
+		int sum = 0;
+		for (auto& future : futures)
+			sum += future.get();
+
+		std::cout << "Async sum: " << sum << "\n";
+
+		/* many calls, one frame */
+		auto batch = client.batch();
+		futures.clear();
+
+		for (int i = 0; i < 100; ++i)
+			futures.push_back(batch.call<int>("add", i, 1));
+
+		client.call_batch(std::move(batch));
+
+		sum = 0;
+		for (auto& future : futures)
+			sum += future.get();
+
+		std::cout << "Batch sum: " << sum << "\n";
+
+		/* larger than a provided receive buffer, both ways; zero-copy, then too large for it */
+		bool echoed = true;
+
+		for (size_t size : {40 * 1000, 200 * 1000}) {
+			std::string big(size, 'x');
+			echoed &= (client.call<std::string>("echo", big) == big);
+		}
+
+		std::cout << "Large echo: " << (echoed ? "OK" : "FAILED") << "\n";
+
+		/* the chunks come in while the server produces them */
+		std::promise<void> streamed;
+		long streamSum = 0;
+
+		client.stream_call<int>([&](int chunk) {
+			streamSum += chunk;
+		}, [&](std::exception_ptr exp) {
+			if (exp != nullptr)
+				streamed.set_exception(exp);
+			else
+				streamed.set_value();
+		}, "range", 1000);
+
+		streamed.get_future().get();
+		std::cout << "Stream sum: " << streamSum << "\n";
+	} catch (const std::exception& ex) {
+		std::cerr << "RPC call failed: " << ex.what() << "\n";
+	} catch (...) {
+		std::cerr << "RPC call failed\n";
+	}
+}
+
+static void bind_functions(rpc::Server& server)
+{
+	server.bind("add", [](int a, int b) {
+		return a + b;
+	});
+
+	server.bind("print", [](std::string msg) {
+		std::cout << ">> " << msg << "\n";
+	});
+
+	server.bind("echo", [](std::string msg) {
+		return msg;
+	});
+
+	server.bind("range", [](rpc::Writer<int>& out, int n) {
+		for (int i = 0; i < n; ++i)
+			out.write(i);
+	});
+}
+
+static uint16_t parse_port(int argc, char* argv[])
+{
+	uint16_t port = 5555;
+
+	if (argc > 2) {
+		try {
+			port = std::stoi(argv[2]);
+		} catch (const std::exception& ex) {
+			std::cerr << "Invalid port number: " << argv[2] << "\n";
+			return 0;
+		}
+	}
+
+	return port;
+}
+
+int main(int argc, char* argv[])
+{
+	if ((argc > 1) && (std::string(argv[1]) == "--server")) {
+		uint16_t port = parse_port(argc, argv);
+		if (port == 0)
+			return 1;
+
+		try {
+			rpc::UringServer server(port);
+
+			bind_functions(server);
+			server.run(server);
+		} catch (const std::exception& ex) {
+			std::cerr << "RPC server failed: " << ex.what() << "\n";
+		}
+
+		return 0;
+	}
+
+	if ((argc > 1) && (std::string(argv[1]) == "--client")) {
+		uint16_t port = parse_port(argc, argv);
+		if (port == 0)
+			return 1;
+
+		rpc_client(port);
+		return 0;
+	}
+
+	if ((argc > 1) && (std::string(argv[1]) == "--loopback")) {
+		uint16_t port = parse_port(argc, argv);
+		if (port == 0)
+			return 1;
+
+		try {
+			rpc::UringServer server(port);
+			bind_functions(server);
+
+			std::thread serverThread([&server] {
+				server.run(server);
+			});
+
+			rpc_client(port);
+
+			server.stop();
+			serverThread.join();
+		} catch (const std::exception& ex) {
+			std::cerr << "RPC server failed: " << ex.what() << "\n";
+			return 1;
+		}
+
+		return 0;
+	}
+
+	std::cerr << "io_uring RPC test\n";
+	std::cerr << "Command line options:\n";
+	std::cerr << "  --server [port]    invoke RPC server\n";
+	std::cerr << "  --client [port]    invoke RPC client\n";
+	std::cerr << "  --loopback [port]  invoke both, in one process\n";
+	return 1;
+}
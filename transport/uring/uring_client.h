@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: MIT
+/*
+ * io_uring transport implementation for RPC client
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "rpc/client.h"
+#include "rpc/awaitable.h"
+#include "transport/socket/utils.h"
+#include "stream.h"
+
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+
+namespace rpc {
+
+/*
+ * Any number of calls in flight on one connection. Calling threads only queue
+ * their frames and kick the ring thread, which sends whatever accumulated
+ * in a single send, and ingests the responses.
+ */
+class UringClient {
+public:
+	UringClient(const std::string& host, uint16_t port)
+		:m_recvBuffers(0, 64, 16 * 1024)
+		,m_sendBuffers(4, 64 * 1024, 16 * 1024)
+		,m_ring(64)
+		,m_stream(tcp::client_socket(host, port), 0)
+		,m_wake(eventfd(0, EFD_CLOEXEC))
+	{
+		if (m_wake < 0)
+			throw std::runtime_error("eventfd() failed");
+
+		m_ring.register_buf_ring(m_recvBuffers);
+		m_ring.register_buffers(m_sendBuffers);
+
+		m_thread = std::thread([this] {
+			loop();
+		});
+	}
+
+	~UringClient()
+	{
+		m_stop = true;
+		wake();
+
+		m_thread.join();
+		close(m_wake);
+	}
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	R call(const FuncID& funcID, Args&&... args)
+	{
+		return async_call<R>(funcID, std::forward<Args>(args)...).get();
+	}
+
+	template <typename R, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	std::future<R> async_call(const FuncID& funcID, Args&&... args)
+	{
+		auto [future, buffer, id] = m_client.call<R>(funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), id);
+		return std::move(future);
+	}
+
+	/*
+	 * The callback is invoked on the ring thread (see `Client::call()`)
+	 */
+	template <typename R, typename Callback, typename FuncID, typename... Args,
+		  std::enable_if_t<!is_func_id_v<Callback>, int> = 0>
+	uint32_t async_call(Callback&& callback, const FuncID& funcID, Args&&... args)
+	{
+		auto [buffer, id] = m_client.call<R>(std::forward<Callback>(callback), funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), id);
+		return id;
+	}
+
+	/*
+	 * Batch calls (see `Client::Batch`): the calls go out in a single frame
+	 * upon `call_batch()`, their futures/callbacks complete on the ring thread
+	 */
+	Client::Batch batch()
+	{
+		return m_client.batch();
+	}
+
+	void call_batch(Client::Batch&& batch)
+	{
+		auto [buffer, ids] = m_client.call_batch(std::move(batch));
+		if (ids.empty())
+			return;
+
+		send(std::move(buffer), ids.data(), ids.size());
+	}
+
+	/*
+	 * Streaming call (see `Client::stream_call()`): the chunks are delivered
+	 * on the ring thread as they arrive
+	 */
+	template <typename T, typename OnChunk, typename OnDone, typename FuncID, typename... Args,
+		  std::enable_if_t<is_func_id_v<FuncID>, int> = 0>
+	uint32_t stream_call(OnChunk&& onChunk, OnDone&& onDone, const FuncID& funcID, Args&&... args)
+	{
+		auto [buffer, id] = m_client.stream_call<T>(std::forward<OnChunk>(onChunk), std::forward<OnDone>(onDone), funcID, std::forward<Args>(args)...);
+
+		send(std::move(buffer), id);
+		return id;
+	}
+
+#ifdef RPC_HAS_COROUTINES
+	/*
+	 * The coroutine is resumed on the ring thread
+	 */
+	template <typename R, typename FuncID, typename... Args>
+	auto co_call(const FuncID& funcID, Args&&... args)
+	{
+		return make_awaitable<R>([this, funcID, args = std::make_tuple(std::forward<Args>(args)...)](auto&& callback) mutable {
+			std::apply([&](auto&... args) {
+				async_call<R>(std::move(callback), funcID, std::move(args)...);
+			}, args);
+		});
+	}
+#endif
+
+private:
+	rpc::Client m_client;
+
+	/* ring thread only, once constructed; the ring goes down before the buffers */
+	uring::BufferRing m_recvBuffers;
+	uring::FixedBuffers m_sendBuffers;
+	uring::Ring m_ring;
+	uring::Stream m_stream;
+
+	int m_wake;
+	std::atomic<bool> m_wakePending{false};
+	std::atomic<bool> m_stop{false};
+	std::atomic<bool> m_closed{false};
+	std::thread m_thread;
+
+	/* frames queued by the calling threads */
+	std::vector<char> m_txQueue;
+	std::mutex m_txMutex;
+
+	/* `Buffer`: `msgpack::sbuffer`, or `IoBuffer` for a call with view arguments */
+	template <typename Buffer>
+	void send(Buffer&& buffer, uint32_t id)
+	{
+		/* a call that joined one in flight (see `SingleFlight`): nothing to send */
+		if (buffer.size() == 0)
+			return;
+
+		send(std::move(buffer), &id, 1);
+	}
+
+	template <typename Buffer>
+	void send(Buffer&& buffer, const uint32_t* ids, size_t count)
+	{
+		{
+			std::lock_guard lock(m_txMutex);
+			uint32_t net_len = htonl(buffer.size());
+
+			m_txQueue.insert(m_txQueue.end(), reinterpret_cast<const char*>(&net_len), reinterpret_cast<const char*>(&net_len) + sizeof(net_len));
+
+			/* the queue is a copy anyway: segments are gathered into it */
+			for_each_segment(buffer, [this](const char* data, size_t size) {
+				m_txQueue.insert(m_txQueue.end(), data, data + size);
+			});
+		}
+
+		pool::recycle(std::move(buffer));
+
+		/* one wakeup for any number of frames queued meanwhile */
+		if (!m_wakePending.exchange(true))
+			wake();
+
+		/*
+		 * The ring thread sets `m_closed` before failing the outstanding calls,
+		 * so a call registered after that is failed here.
+		 */
+		if (m_closed) {
+			for (size_t i = 0; i < count; ++i)
+				m_client.cancel(ids[i], ConnectionError("client: connection closed"));
+		}
+	}
+
+	void wake() noexcept
+	{
+		uint64_t one = 1;
+		[[maybe_unused]] auto ret = write(m_wake, &one, sizeof(one));
+	}
+
+	void arm_wake(uint64_t& value)
+	{
+		auto sqe = m_ring.get_sqe();
+
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = m_wake;
+		sqe->addr = reinterpret_cast<uint64_t>(&value);
+		sqe->len = sizeof(value);
+		sqe->user_data = uring::user_data(uring::Op::Wake, 0);
+	}
+
+	void loop() noexcept
+	{
+		try {
+			std::vector<char> frames;
+			uint64_t wakeValue = 0;
+
+			m_stream.arm_recv(m_ring, m_recvBuffers);
+			arm_wake(wakeValue);
+
+			while (!m_stop && m_stream.receiving()) {
+				m_ring.submit(1);
+
+				m_ring.for_each_cqe([&](const io_uring_cqe& cqe) {
+					switch (uring::op_of(cqe.user_data)) {
+					case uring::Op::Wake:
+						arm_wake(wakeValue);
+						m_wakePending = false;
+
+						{
+							std::lock_guard lock(m_txMutex);
+							frames.swap(m_txQueue);
+						}
+
+						m_stream.queue(frames);
+						m_stream.flush(m_ring, m_sendBuffers);
+						break;
+
+					case uring::Op::Recv:
+						m_stream.received(m_ring, m_recvBuffers, cqe, [this](const char* data, size_t len) noexcept {
+							try {
+								m_client.ingest_resp(data, len, true/*last*/);
+							} catch (...) {
+								/* response to a cancelled call, or a malformed one: drop it */
+							}
+						});
+						break;
+
+					case uring::Op::Send:
+						if (uring::Stream::notified(m_sendBuffers, cqe))
+							break;
+
+						if (!m_stream.sent(m_ring, m_sendBuffers, cqe))
+							m_stream.shutdown();
+						break;
+
+					default:
+						break;
+					}
+				});
+			}
+		} catch (...) {
+			/* the ring failed: same as a lost connection */
+		}
+
+		m_closed = true;
+		m_client.cancel_all(std::make_exception_ptr(ConnectionError("client: connection closed")));
+	}
+};
+
+}
@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: MIT
+/*
+ * io_uring transport implementation for RPC server
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#pragma once
+
+#include "rpc/server.h"
+#include "transport/socket/utils.h"
+#include "stream.h"
+
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+
+
+namespace rpc {
+
+/*
+ * A single thread drives all connections: multishot accept, multishot
+ * receive into provided buffers, zero-copy sends of large responses from
+ * registered buffers, and calls handled inline as their frames complete.
+ * Everything a batch of completions produces goes to the kernel with
+ * a single `io_uring_enter()`.
+ */
+class UringServer : public rpc::Server {
+public:
+	struct Options {
+		int backlog = SOMAXCONN;
+		unsigned entries = 256;			/* submission queue */
+		unsigned recvBuffers = 256;		/* provided receive buffers, a power of 2 */
+		unsigned recvBufferSize = 16 * 1024;
+		unsigned sendBuffers = 64;		/* registered send buffers, for zero-copy */
+		unsigned sendBufferSize = 64 * 1024;
+		unsigned zeroCopyMin = 16 * 1024;	/* smaller sends are copied */
+	};
+
+	UringServer(uint16_t port)
+		:UringServer(port, Options())
+	{ }
+
+	UringServer(uint16_t port, const Options& options)
+		:listen_sock(tcp::server_socket(port, options.backlog))
+		,m_options(options)
+		,m_wake(eventfd(0, EFD_CLOEXEC))
+	{
+		if (m_wake < 0) {
+			close(listen_sock);
+			throw std::runtime_error("eventfd() failed");
+		}
+	}
+
+	~UringServer()
+	{
+		close(m_wake);
+		close(listen_sock);
+	}
+
+	void run(Server& server)
+	{
+		uring::BufferRing recvBuffers(0, m_options.recvBuffers, m_options.recvBufferSize);
+		uring::FixedBuffers sendBuffers(m_options.sendBuffers, m_options.sendBufferSize, m_options.zeroCopyMin);
+		uring::Ring ring(m_options.entries);
+
+		ring.register_buf_ring(recvBuffers);
+		ring.register_buffers(sendBuffers);
+
+		std::unordered_map<uint32_t, std::unique_ptr<uring::Stream>> streams;
+		uint32_t nextID = 0;
+		uint64_t wakeValue = 0;
+
+		arm_accept(ring);
+		arm_wake(ring, wakeValue);
+
+		while (!m_stop) {
+			ring.submit(1);
+
+			ring.for_each_cqe([&](const io_uring_cqe& cqe) {
+				auto op = uring::op_of(cqe.user_data);
+
+				if (op == uring::Op::Accept) {
+					if (cqe.res >= 0) {
+						tcp::set_nodelay(cqe.res);
+
+						do {
+							++nextID;
+						} while (streams.count(nextID) > 0);
+
+						auto& stream = streams.emplace(nextID, std::make_unique<uring::Stream>(cqe.res, nextID)).first->second;
+						stream->arm_recv(ring, recvBuffers);
+					}
+
+					if (!(cqe.flags & IORING_CQE_F_MORE))
+						arm_accept(ring);
+
+					return;
+				}
+
+				if ((op == uring::Op::Send) && uring::Stream::notified(sendBuffers, cqe))
+					return;
+
+				if (op == uring::Op::Wake) {
+					arm_wake(ring, wakeValue);
+					return;
+				}
+
+				auto it = streams.find(uring::stream_of(cqe.user_data));
+				if (it == streams.end())
+					return;
+
+				auto& stream = *it->second;
+
+				if (op == uring::Op::Recv) {
+					auto onFrame = [&](const char* data, size_t len) noexcept {
+						if (stream.is_shut())
+							return;
+
+						try {
+							handle_call(data, len, [&](msgpack::sbuffer&& resp) {
+								stream.queue(resp.data(), resp.size());
+								pool::recycle(std::move(resp));
+							});
+						} catch (...) {
+							/* same as a dying connection thread: drop the connection */
+							stream.shutdown();
+						}
+					};
+
+					stream.received(ring, recvBuffers, cqe, onFrame);
+					stream.flush(ring, sendBuffers);
+				} else if (op == uring::Op::Send) {
+					if (!stream.sent(ring, sendBuffers, cqe))
+						stream.shutdown();
+				}
+
+				if (!stream.receiving() && !stream.sending())
+					streams.erase(it);
+			});
+		}
+	}
+
+	/*
+	 * Make `run()` return; callable from any thread
+	 */
+	void stop() noexcept
+	{
+		uint64_t one = 1;
+
+		m_stop = true;
+		[[maybe_unused]] auto ret = write(m_wake, &one, sizeof(one));
+	}
+
+private:
+	int listen_sock;
+	Options m_options;
+	int m_wake;
+	std::atomic<bool> m_stop{false};
+
+	void arm_accept(uring::Ring& ring)
+	{
+		auto sqe = ring.get_sqe();
+
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = listen_sock;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_CLOEXEC;
+		sqe->user_data = uring::user_data(uring::Op::Accept, 0);
+	}
+
+	void arm_wake(uring::Ring& ring, uint64_t& value)
+	{
+		auto sqe = ring.get_sqe();
+
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = m_wake;
+		sqe->addr = reinterpret_cast<uint64_t>(&value);
+		sqe->len = sizeof(value);
+		sqe->user_data = uring::user_data(uring::Op::Wake, 0);
+	}
+};
+
+}
@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: MIT
+/*
+ * Coroutine (co_call) unittest: needs C++20
+ *
+ * Copyright (c) 2025, Andrey Gelman <andrey.gelman@gmail.com>
+ */
+
+#include <gtest/gtest.h>
+
+#include "transport/null/client.h"
+#include "transport/socket/tcp_client.h"
+#include "transport/socket/tcp_server.h"
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#ifndef RPC_HAS_COROUTINES
+#error "the coroutine unittest needs a compiler with C++20 coroutines"
+#endif
+
+
+using namespace std::chrono_literals;
+
+/* fire-and-forget coroutine, whose end the test waits for */
+struct Task {
+	struct promise_type {
+		std::promise<void> done;
+
+		Task get_return_object()
+		{
+			return Task{done.get_future()};
+		}
+
+		std::suspend_never initial_suspend() noexcept
+		{
+			return {};
+		}
+
+		std::suspend_never final_suspend() noexcept
+		{
+			return {};
+		}
+
+		void return_void()
+		{
+			done.set_value();
+		}
+
+		void unhandled_exception()
+		{
+			done.set_exception(std::current_exception());
+		}
+	};
+
+	std::future<void> done;
+
+	void wait(std::chrono::milliseconds timeout = 2s)
+	{
+		ASSERT_EQ(done.wait_for(timeout), std::future_status::ready);
+		done.get();
+	}
+};
+
+static void bind_functions(rpc::Server& server)
+{
+	server.bind("add", [](int a, int b) {
+		return a + b;
+	});
+
+	server.bind("noop", []() { });
+
+	server.bind("fail", []() -> int {
+		throw std::runtime_error("failed on purpose");
+	});
+
+	server.bind("delay", [](int ms) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+		return ms;
+	});
+}
+
+class NullCoroutineTest : public ::testing::Test {
+protected:
+	rpc::Server server;
+	rpc::NullClient client{server};
+
+	void SetUp() override
+	{
+		bind_functions(server);
+	}
+};
+
+TEST_F(NullCoroutineTest, Success)
+{
+	int sum = 0;
+	bool noop = false;
+
+	auto task = [&]() -> Task {
+		sum = co_await client.co_call<int>("add", 2, 3);
+		co_await client.co_call<void>("noop");
+		noop = true;
+	}();
+
+	task.wait();
+	EXPECT_EQ(sum, 5);
+	EXPECT_TRUE(noop);
+}
+
+TEST_F(NullCoroutineTest, Error)
+{
+	auto task = [&]() -> Task {
+		EXPECT_THROW(co_await client.co_call<int>("nothing"), rpc::ServerError);
+		/* the server is in-process: what the function throws reaches the caller */
+		EXPECT_THROW(co_await client.co_call<int>("fail"), std::runtime_error);
+		/* a response of the wrong type */
+		EXPECT_THROW(co_await client.co_call<std::string>("add", 1, 1), msgpack::type_error);
+		/* the client is still good */
+		EXPECT_EQ(co_await client.co_call<int>("add", 1, 1), 2);
+	}();
+
+	task.wait();
+}
+
+TEST_F(NullCoroutineTest, Timeout)
+{
+	auto task = [&]() -> Task {
+		/* expired before it is made */
+		EXPECT_THROW(co_await client.co_call<int>(rpc::with_deadline("add", 0ms), 1, 1), rpc::DeadlineExceeded);
+		EXPECT_EQ(co_await client.co_call<int>(rpc::with_deadline("add", 1s), 1, 1), 2);
+	}();
+
+	task.wait();
+}
+
+class TcpCoroutineTest : public ::testing::Test {
+protected:
+	static constexpr uint16_t port = 5838;
+
+	std::unique_ptr<rpc::TcpClient> client;
+
+	static void SetUpTestSuite()
+	{
+		/* `run()` does not return: the server lives on for the whole test binary */
+		auto server = new rpc::TcpServer(port);
+		bind_functions(*server);
+
+		std::thread([server]() {
+			server->run(*server);
+		}).detach();
+	}
+
+	void SetUp() override
+	{
+		client = std::make_unique<rpc::TcpClient>("127.0.0.1", port, rpc::TcpClient::Mode::Pipelined);
+	}
+};
+
+TEST_F(TcpCoroutineTest, Success)
+{
+	int sum = 0;
+	bool noop = false;
+
+	auto task = [&]() -> Task {
+		sum = co_await client->co_call<int>("add", 20, 22);
+		co_await client->co_call<void>("noop");
+		noop = true;
+		/* resumed on the reader thread, which is free to make the next call */
+		sum += co_await client->co_call<int>("add", 1, 2);
+	}();
+
+	task.wait();
+	EXPECT_EQ(sum, 45);
+	EXPECT_TRUE(noop);
+}
+
+TEST_F(TcpCoroutineTest, Error)
+{
+	auto task = [&]() -> Task {
+		/* a response of the wrong type fails the call, not the connection */
+		EXPECT_THROW(co_await client->co_call<std::string>("add", 1, 1), msgpack::type_error);
+		EXPECT_EQ(co_await client->co_call<int>("add", 1, 1), 2);
+		EXPECT_FALSE(client->closed());
+
+		/* a call the server fails ends the connection, and the call with it */
+		EXPECT_THROW(co_await client->co_call<int>("fail"), rpc::ConnectionError);
+	}();
+
+	task.wait();
+}
+
+TEST_F(TcpCoroutineTest, Timeout)
+{
+	auto task = [&]() -> Task {
+		EXPECT_THROW(co_await client->co_call<int>(rpc::with_deadline("delay", 50ms), 300), rpc::DeadlineExceeded);
+		/* the late response is dropped, and the connection keeps serving */
+		EXPECT_EQ(co_await client->co_call<int>(rpc::with_deadline("add", 1s), 1, 1), 2);
+	}();
+
+	task.wait();
+}
+
+TEST_F(TcpCoroutineTest, Cancel)
+{
+	/* a call still in flight is failed when its connection goes away */
+	auto task = [&]() -> Task {
+		EXPECT_THROW(co_await client->co_call<int>("delay", 300), rpc::ConnectionError);
+	}();
+
+	std::this_thread::sleep_for(50ms);
+	client.reset();
+	task.wait();
+}
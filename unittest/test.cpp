@@ -9,10 +9,16 @@
 
 #include "client.h"
 #include "server.h"
+#include "blob.h"
+#include "transport/null/client.h"
 
 #include <tuple>
+#include <future>
+#include <memory>
 #include <thread>
 #include <chrono>
+#include <cstring>
+#include <unistd.h>
 
 
 using namespace std::chrono_literals;
@@ -193,3 +199,1024 @@ TEST_F(RPCTest, CancellationTest)
 	EXPECT_THROW(fut1.get(), std::underflow_error);
 	EXPECT_EQ(fut2.get(), 111);
 }
+
+TEST_F(RPCTest, ViewArgumentsTest)
+{
+	const char* strPtr = nullptr;
+	const char* binPtr = nullptr;
+
+	server.bind("length", [&](std::string_view str, msgpack::type::raw_ref bin) -> size_t {
+		strPtr = str.data();
+		binPtr = bin.ptr;
+
+		return str.size() + bin.size;
+	});
+
+	std::vector<char> blob(64, 'x');
+	auto [fut, buff, _] = client.call<size_t>("length", "Hello, world !", blob);
+
+	auto respBuff = server.handle_call(buff.data(), buff.size());
+
+	/* views point straight into the request buffer */
+	EXPECT_GE(strPtr, buff.data());
+	EXPECT_LT(strPtr, buff.data() + buff.size());
+	EXPECT_GE(binPtr, buff.data());
+	EXPECT_LT(binPtr, buff.data() + buff.size());
+
+	client.ingest_resp(respBuff);
+	EXPECT_EQ(fut.get(), 78UL);
+
+	server.unbind("length");
+}
+
+TEST_F(RPCTest, ReferenceArgumentsTest)
+{
+	/* the converted arguments, by reference (even non-const) or by value */
+	server.bind("decorate", [](std::string& str, const std::string& prefix, std::vector<int> counts) {
+		str.insert(0, prefix);
+		str.append(counts.size(), '!');
+
+		return str;
+	});
+
+	auto [fut, buff, _] = client.call<std::string>("decorate", "world", "hello, ", std::vector<int>{1, 2});
+	client.ingest_resp(server.handle_call(buff));
+	EXPECT_EQ(fut.get(), "hello, world!!");
+
+	server.unbind("decorate");
+}
+
+TEST_F(RPCTest, FuncHashTest)
+{
+	constexpr rpc::FuncHash addHash("add");
+
+	auto [fut1, buff1, id1] = client.call<double>(addHash, 90, 21);
+	auto [fut2, buff2, id2] = client.call<double>("add", 90, 21);
+
+	client.ingest_resp(server.handle_call(buff1));
+	client.ingest_resp(server.handle_call(buff2));
+	EXPECT_EQ(fut1.get(), 111);
+	EXPECT_EQ(fut2.get(), 111);
+
+	auto hash = server.bind("mul", [](double a, double b) -> double {
+		return a * b;
+	});
+	EXPECT_EQ(hash, rpc::FuncHash("mul"));
+
+	auto [fut3, buff3, id3] = client.call<double>(hash, 3, 4);
+	client.ingest_resp(server.handle_call(buff3));
+	EXPECT_EQ(fut3.get(), 12);
+
+	server.unbind("mul");
+
+	auto [fut4, buff4, id4] = client.call<double>(hash, 3, 4);
+	EXPECT_THROW(server.handle_call(buff4), rpc::ServerError);
+}
+
+TEST_F(RPCTest, PingTest)
+{
+	/* built in, with or without metrics */
+	auto [fut1, buff1, id1] = client.call<bool>(rpc::ping_func_id);
+	auto [fut2, buff2, id2] = client.call<bool>(rpc::FuncHash(rpc::ping_func_id));
+
+	client.ingest_resp(server.handle_call(buff1));
+	client.ingest_resp(server.handle_call(buff2));
+	EXPECT_TRUE(fut1.get());
+	EXPECT_TRUE(fut2.get());
+}
+
+TEST_F(RPCTest, FuncHashCollisionTest)
+{
+	/* "f6059" and "f264602" share the same FNV-1a hash */
+	ASSERT_EQ(rpc::FuncHash("f6059"), rpc::FuncHash("f264602"));
+
+	server.bind("f6059", []() -> int {
+		return 1;
+	});
+
+	EXPECT_THROW(server.bind("f264602", []() -> int { return 2; }), rpc::ServerError);
+
+	/* the name is verified on lookup */
+	auto [fut, buff, id] = client.call<int>("f264602");
+	EXPECT_THROW(server.handle_call(buff), rpc::ServerError);
+
+	server.unbind("f6059");
+}
+
+TEST_F(RPCTest, UnbindFreesTest)
+{
+	auto token = std::make_shared<int>(0);
+	std::promise<void> entered;
+	std::promise<void> release;
+	auto released = release.get_future().share();
+
+	server.bind("held", [token, &entered, released]() -> int {
+		entered.set_value();
+		released.wait();
+		return 1;
+	});
+
+	server.bind("gone", [token]() -> int {
+		return 2;
+	});
+
+	ASSERT_EQ(token.use_count(), 3);
+
+	/* not being called: freed right away */
+	server.unbind("gone");
+	EXPECT_EQ(token.use_count(), 2);
+
+	auto [fut, buff, id] = client.call<int>("held");
+	std::thread caller([&, buff = std::move(buff)]() {
+		client.ingest_resp(server.handle_call(buff));
+	});
+
+	entered.get_future().wait();
+
+	/* being called: kept until the call is over, and a later bind (or unbind) frees it */
+	server.unbind("held");
+	EXPECT_EQ(token.use_count(), 2);
+
+	release.set_value();
+	caller.join();
+	EXPECT_EQ(fut.get(), 1);
+
+	server.bind("gone", []() -> int {
+		return 2;
+	});
+
+	server.unbind("gone");
+	EXPECT_EQ(token.use_count(), 1);
+}
+
+TEST_F(RPCTest, CallbackTest)
+{
+	std::exception_ptr error;
+	double result = 0.0;
+
+	auto [buff, id] = client.call<double>([&](std::exception_ptr exp, double value) {
+		error = exp;
+		result = value;
+	}, "add", 90, 21);
+
+	client.ingest_resp(server.handle_call(buff));
+	EXPECT_EQ(error, nullptr);
+	EXPECT_EQ(result, 111);
+
+	auto [buff2, id2] = client.call<double>([&](std::exception_ptr exp, double value) {
+		error = exp;
+		result = value;
+	}, "add", 1, 2);
+
+	client.cancel(id2, std::underflow_error("test cancellation"));
+	EXPECT_THROW(std::rethrow_exception(error), std::underflow_error);
+
+	bool sent = false;
+
+	auto [buff3, id3] = client.call<void>([&](std::exception_ptr exp) {
+		sent = (exp == nullptr);
+	}, "trigger", 3);
+
+	EXPECT_TRUE(sent);
+}
+
+TEST_F(RPCTest, MultiCallExpectTest)
+{
+	int count = 0;
+
+	server.bind("trigger", [&](int delta) -> int {
+		count += delta;
+
+		return count;
+	});
+
+	std::vector<int> result;
+
+	auto [buff, id] = client.multi_call<int>([&](std::exception_ptr exp, std::vector<int> value) {
+		result = std::move(value);
+	}, "trigger", 3);
+
+	/* the client counts the responses, `last` is ignored */
+	ASSERT_TRUE(client.expect(id, 2));
+
+	client.ingest_resp(server.handle_call(buff), true);
+	EXPECT_TRUE(result.empty());
+
+	client.ingest_resp(server.handle_call(buff), false);
+	std::vector<int> refVec{3, 6};
+	EXPECT_EQ(result, refVec);
+
+	server.unbind("trigger");
+}
+
+TEST_F(RPCTest, QuorumTest)
+{
+	int count = 0;
+
+	server.bind("trigger", [&](int delta) -> int {
+		count += delta;
+
+		return count;
+	});
+
+	std::vector<int> result;
+	bool failed = false;
+
+	auto onResult = [&](std::exception_ptr exp, std::vector<int> value) {
+		failed = (exp != nullptr);
+		result = std::move(value);
+	};
+
+	/* completes upon 2 out of 3 responses, the third one is not waited for */
+	auto [buff, id] = client.multi_call<int>(rpc::Completion::first(2), onResult, "trigger", 1);
+	ASSERT_TRUE(client.expect(id, 3));
+
+	client.ingest_resp(server.handle_call(buff));
+	EXPECT_TRUE(result.empty());
+	EXPECT_TRUE(client.pending(id));
+
+	client.ingest_resp(server.handle_call(buff));
+	std::vector<int> refVec{1, 2};
+	EXPECT_EQ(result, refVec);
+	EXPECT_FALSE(client.pending(id));
+
+	EXPECT_THROW(client.ingest_resp(server.handle_call(buff)), rpc::ClientError);
+	EXPECT_EQ(result, refVec);
+
+	/* a failed server does not count */
+	auto [buff2, id2] = client.multi_call<int>(rpc::Completion::first_success(), onResult, "trigger", 1);
+	ASSERT_TRUE(client.expect(id2, 2));
+
+	EXPECT_TRUE(client.ingest_error(id2, std::make_exception_ptr(std::runtime_error("timeout"))));
+	EXPECT_EQ(result, refVec);
+	client.ingest_resp(server.handle_call(buff2));
+	EXPECT_FALSE(failed);
+	EXPECT_EQ(result, std::vector<int>{4});
+
+	/* no quorum: all the responses are in */
+	auto [buff3, id3] = client.multi_call<int>(rpc::Completion::first(2), onResult, "trigger", 1);
+	ASSERT_TRUE(client.expect(id3, 2));
+
+	client.ingest_resp(server.handle_call(buff3));
+	client.ingest_error(id3, std::make_exception_ptr(std::runtime_error("timeout")));
+	EXPECT_TRUE(failed);
+
+	/* all: any failure fails the call */
+	auto [fut, buff4, id4] = client.multi_call<int>("trigger", 1);
+	ASSERT_TRUE(client.expect(id4, 2));
+
+	client.ingest_resp(server.handle_call(buff4));
+	client.ingest_error(id4, std::make_exception_ptr(std::runtime_error("timeout")));
+	EXPECT_THROW(fut.get(), std::runtime_error);
+
+	EXPECT_FALSE(client.ingest_error(id4, std::make_exception_ptr(std::runtime_error("timeout"))));
+
+	server.unbind("trigger");
+}
+
+TEST_F(RPCTest, BatchTest)
+{
+	int triggered = 0;
+
+	server.bind("mul", [](double a, double b) {
+		return a * b;
+	});
+
+	server.bind("trigger", [&](int value) {
+		triggered = value;
+	});
+
+	auto batch = client.batch();
+	auto sum = batch.call<double>("add", 1, 2);
+	auto diff = batch.call<double>("sub", 10, 4);
+	batch.call<void>("trigger", 5);
+
+	double product = 0.0;
+	batch.call<double>([&](std::exception_ptr exp, double value) {
+		product = (exp == nullptr) ? value : -1.0;
+	}, "mul", 6, 7);
+
+	EXPECT_EQ(batch.size(), 4);
+
+	auto [buff, ids] = client.call_batch(std::move(batch));
+	EXPECT_EQ(ids.size(), 4);
+
+	/* one frame back */
+	client.ingest_resp(server.handle_call(buff));
+
+	EXPECT_EQ(sum.get(), 3);
+	EXPECT_EQ(diff.get(), 6);
+	EXPECT_EQ(product, 42);
+	EXPECT_EQ(triggered, 5);
+
+	/* streamed back, one response at a time */
+	auto batch2 = client.batch();
+	auto first = batch2.call<double>("add", 2, 2);
+	auto second = batch2.call<double>("add", 3, 3);
+
+	auto [buff2, ids2] = client.call_batch(std::move(batch2));
+	size_t frames = 0;
+
+	server.handle_batch(buff2.data(), buff2.size(), [&](msgpack::sbuffer&& resp) {
+		++frames;
+		client.ingest_resp(resp);
+	});
+
+	EXPECT_EQ(frames, 2);
+	EXPECT_EQ(first.get(), 4);
+	EXPECT_EQ(second.get(), 6);
+
+	/* nothing to send */
+	auto [buff3, ids3] = client.call_batch(client.batch());
+	EXPECT_EQ(buff3.size(), 0);
+	EXPECT_TRUE(ids3.empty());
+
+	/* nothing to answer: no buffer either */
+	auto batch4 = client.batch();
+	batch4.call<void>("trigger", 6);
+	batch4.call<void>("trigger", 7);
+
+	auto [buff4, ids4] = client.call_batch(std::move(batch4));
+	auto resp4 = server.handle_call(buff4);
+	EXPECT_EQ(resp4.size(), 0);
+	EXPECT_EQ(resp4.data(), nullptr);
+	EXPECT_EQ(triggered, 7);
+}
+
+TEST_F(RPCTest, StreamTest)
+{
+	server.bind("count", [](rpc::Writer<int>& out, int n) {
+		for (int i = 0; i < n; ++i)
+			out.write(i);
+	});
+
+	std::vector<int> chunks;
+	bool done = false;
+	bool failed = false;
+
+	auto onChunk = [&](int chunk) {
+		chunks.push_back(chunk);
+	};
+
+	auto onDone = [&](std::exception_ptr exp) {
+		done = true;
+		failed = (exp != nullptr);
+	};
+
+	/* one frame per chunk, each ingested as it is written */
+	auto [buff, id] = client.stream_call<int>(onChunk, onDone, "count", 3);
+	size_t frames = 0;
+
+	server.handle_call(buff.data(), buff.size(), [&](msgpack::sbuffer&& resp) {
+		EXPECT_EQ(chunks.size(), frames);
+		EXPECT_FALSE(done);
+
+		++frames;
+		client.ingest_resp(resp);
+	});
+
+	/* 3 chunks, then the end of the stream */
+	EXPECT_EQ(frames, 4);
+	EXPECT_EQ(chunks, std::vector<int>({0, 1, 2}));
+	EXPECT_TRUE(done);
+	EXPECT_FALSE(failed);
+
+	/* collected into one frame */
+	chunks.clear();
+	done = false;
+
+	auto [buff2, id2] = client.stream_call<int>(onChunk, onDone, "count", 2);
+	client.ingest_resp(server.handle_call(buff2));
+
+	EXPECT_EQ(chunks, std::vector<int>({0, 1}));
+	EXPECT_TRUE(done);
+
+	/* a function that does not stream: a single chunk */
+	std::vector<double> sums;
+	done = false;
+
+	auto [buff3, id3] = client.stream_call<double>([&](double chunk) {
+		sums.push_back(chunk);
+	}, onDone, "add", 2, 3);
+	client.ingest_resp(server.handle_call(buff3));
+
+	EXPECT_EQ(sums, std::vector<double>({5}));
+	EXPECT_TRUE(done);
+
+	server.unbind("count");
+}
+
+TEST_F(RPCTest, BlobTest)
+{
+	server.bind("size", [](rpc::Blob blob) -> uint64_t {
+		return (blob.data()[blob.size() - 1] == 'z') ? blob.size() : 0;
+	});
+
+	rpc::Blob blob(rpc::blob::memfd_min);
+	std::memset(blob.data(), 'z', blob.size());
+	ASSERT_GE(blob.fd(), 0);
+
+	/* no transport to pass it along: inline */
+	auto [fut, buff, id] = client.call<uint64_t>("size", blob);
+	EXPECT_GT(buff.size(), blob.size());
+
+	client.ingest_resp(server.handle_call(buff));
+	EXPECT_EQ(fut.get(), blob.size());
+
+	/* out-of-band: a handle in the frame, the memfd beside it */
+	std::future<uint64_t> fut2;
+	msgpack::sbuffer buff2;
+	std::vector<int> fds;
+
+	{
+		rpc::blob::Outgoing outgoing;
+		uint32_t id2;
+
+		std::tie(fut2, buff2, id2) = client.call<uint64_t>("size", blob);
+		fds = outgoing.fds();
+	}
+
+	EXPECT_LT(buff2.size(), 64);
+	ASSERT_EQ(fds.size(), 1);
+
+	/* what the receiving end of a socket gets */
+	fds[0] = dup(fds[0]);
+
+	{
+		rpc::blob::Incoming incoming(std::move(fds));
+		client.ingest_resp(server.handle_call(buff2));
+	}
+
+	EXPECT_EQ(fut2.get(), blob.size());
+
+	/* a handle with no attachment */
+	msgpack::sbuffer buff3;
+
+	{
+		rpc::blob::Outgoing outgoing;
+		buff3 = std::get<1>(client.call<uint64_t>("size", blob));
+	}
+
+	EXPECT_THROW(server.handle_call(buff3), std::exception);
+
+	server.unbind("size");
+}
+
+TEST_F(RPCTest, PoolTest)
+{
+	rpc::SharedPool pool;
+	rpc::pool::install(&pool);
+
+	auto round_trip = [&](double a, double b) {
+		auto [fut, buff, id] = client.call<double>("add", a, b);
+		auto resp = server.handle_call(buff);
+
+		rpc::pool::recycle(std::move(buff));
+		client.ingest_resp(resp);
+		rpc::pool::recycle(std::move(resp));
+
+		return fut.get();
+	};
+
+	/* the first one fills the pool */
+	EXPECT_DOUBLE_EQ(round_trip(1, 2), 3);
+
+	auto warm = pool.stats();
+	EXPECT_GT(warm.misses, 0);
+
+	for (int i = 0; i < 100; ++i)
+		EXPECT_DOUBLE_EQ(round_trip(i, 1), i + 1);
+
+	/* 2 buffers and 2 zones per call, none allocated anew */
+	auto stats = pool.stats();
+	EXPECT_EQ(stats.misses, warm.misses);
+	EXPECT_EQ(stats.hits - warm.hits, 400);
+
+	rpc::pool::install(nullptr);
+}
+
+TEST_F(RPCTest, PendingTableTest)
+{
+	rpc::Client small(2);
+
+	auto [fut1, buff1, id1] = small.call<double>("add", 1, 2);
+	auto [fut2, buff2, id2] = small.call<double>("add", 3, 4);
+
+	/* as many calls as slots */
+	EXPECT_THROW(small.call<double>("add", 5, 6), rpc::ClientError);
+
+	auto resp1 = server.handle_call(buff1);
+	small.ingest_resp(resp1);
+	EXPECT_DOUBLE_EQ(fut1.get(), 3);
+
+	/* the slot is reused, under a new callID: the stale response does not match it */
+	auto [fut3, buff3, id3] = small.call<double>("add", 5, 6);
+	EXPECT_NE(id3, id1);
+	EXPECT_THROW(small.ingest_resp(resp1), rpc::ClientError);
+
+	small.ingest_resp(server.handle_call(buff3));
+	small.ingest_resp(server.handle_call(buff2));
+	EXPECT_DOUBLE_EQ(fut3.get(), 11);
+	EXPECT_DOUBLE_EQ(fut2.get(), 7);
+
+	/* responses and cancellations race: each call completes exactly once */
+	std::vector<std::thread> threads;
+	std::atomic<int> completed{0};
+
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&] {
+			for (int i = 0; i < 1000; ++i) {
+				auto [buff, id] = client.call<double>([&](std::exception_ptr, double) {
+					++completed;
+				}, "add", i, 1);
+
+				auto resp = server.handle_call(buff);
+
+				std::thread canceller([&, id = id] {
+					client.cancel(id, std::runtime_error("cancelled"));
+				});
+
+				try {
+					client.ingest_resp(resp);
+				} catch (const rpc::ClientError&) {
+					/* cancelled first */
+				}
+
+				canceller.join();
+			}
+		});
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+
+	EXPECT_EQ(completed, 4000);
+}
+
+#ifndef RPC_NO_METRICS
+TEST_F(RPCTest, MetricsTest)
+{
+	server.bind("fail", []() -> double {
+		throw std::runtime_error("failed");
+	});
+
+	for (int i = 0; i < 10; ++i) {
+		auto [fut, buff, id] = client.call<double>("add", i, 1);
+		client.ingest_resp(server.handle_call(buff));
+		EXPECT_DOUBLE_EQ(fut.get(), i + 1);
+	}
+
+	auto [failFut, failBuff, failID] = client.call<double>("fail");
+	EXPECT_THROW(server.handle_call(failBuff), std::runtime_error);
+	client.cancel(failID, std::runtime_error("failed"));
+
+	auto [pendingFut, pendingBuff, pendingID] = client.call<double>("sub", 1, 2);
+
+	/* the server's side, as any client gets it */
+	auto [fut, buff, id] = client.call<rpc::Stats>(rpc::stats_func_id);
+	client.ingest_resp(server.handle_call(buff));
+	auto stats = fut.get();
+
+	ASSERT_EQ(stats.count("add"), 1);
+	EXPECT_EQ(stats["add"].calls, 10);
+	EXPECT_EQ(stats["add"].errors, 0);
+	EXPECT_EQ(stats["add"].inFlight, 0);
+	EXPECT_GT(stats["add"].bytesIn, 0);
+	EXPECT_GT(stats["add"].bytesOut, 0);
+	EXPECT_LE(stats["add"].latencyP50, stats["add"].latencyP99);
+	EXPECT_LE(stats["add"].latencyP99, stats["add"].latencyMax);
+	EXPECT_EQ(stats["fail"].calls, 1);
+	EXPECT_EQ(stats["fail"].errors, 1);
+	EXPECT_EQ(stats["sub"].calls, 0);
+
+	/* the client's side */
+	auto local = client.stats();
+
+	EXPECT_EQ(local["add"].calls, 10);
+	EXPECT_EQ(local["add"].bytesOut, stats["add"].bytesIn);
+	EXPECT_EQ(local["add"].bytesIn, stats["add"].bytesOut);
+	EXPECT_EQ(local["fail"].errors, 1);
+	EXPECT_EQ(local["sub"].calls, 0);
+	EXPECT_EQ(local["sub"].inFlight, 1);
+	EXPECT_EQ(local[rpc::stats_func_id].calls, 1);
+
+	client.cancel(pendingID, std::runtime_error("done"));
+}
+#endif
+
+TEST_F(RPCTest, DeadlineTest)
+{
+	/* in time */
+	auto [fut1, buff1, id1] = client.call<double>(rpc::with_deadline("add", 10s), 1, 2);
+	client.ingest_resp(server.handle_call(buff1));
+	EXPECT_DOUBLE_EQ(fut1.get(), 3);
+
+	/* by hash, in a batch */
+	auto batch = client.batch();
+	auto fut2 = batch.call<double>(rpc::with_deadline(rpc::FuncHash("sub"), 10s), 5, 2);
+	auto [buff2, ids2] = client.call_batch(std::move(batch));
+	client.ingest_resp(server.handle_call(buff2));
+	EXPECT_DOUBLE_EQ(fut2.get(), 3);
+
+	/* the server has had it queued for longer than the budget: not called, no response */
+	int called = 0;
+
+	server.bind("count", [&called]() -> int {
+		return ++called;
+	});
+
+	auto [fut3, buff3, id3] = client.call<int>(rpc::with_deadline("count", 100ms), 0);
+	EXPECT_EQ(server.handle_call(buff3.data(), buff3.size(), std::chrono::steady_clock::now() - 1s).size(), 0);
+	EXPECT_EQ(called, 0);
+
+	/* the client gives up on it by itself */
+	ASSERT_EQ(fut3.wait_for(5s), std::future_status::ready);
+	EXPECT_THROW(fut3.get(), rpc::DeadlineExceeded);
+
+#ifndef RPC_NO_METRICS
+	EXPECT_EQ(server.stats()["count"].expired, 1);
+	EXPECT_EQ(client.stats()["count"].errors, 1);
+#endif
+
+	/* a late response finds no call */
+	auto [fut4, buff4, id4] = client.call<int>(rpc::with_deadline("count", 10ms), 0);
+	auto resp4 = server.handle_call(buff4);
+	EXPECT_EQ(called, 1);
+
+	ASSERT_EQ(fut4.wait_for(5s), std::future_status::ready);
+	EXPECT_THROW(fut4.get(), rpc::DeadlineExceeded);
+	EXPECT_THROW(client.ingest_resp(resp4), rpc::ClientError);
+
+	/* a call that completes, whichever way, takes its timer along */
+	rpc::TimerWheel wheel;
+	rpc::Client timed(rpc::CallTable::default_capacity, wheel);
+
+	auto [fut5, buff5, id5] = timed.call<double>(rpc::with_deadline("add", 10s), 1, 2);
+	EXPECT_EQ(wheel.size(), 1);
+	timed.ingest_resp(server.handle_call(buff5));
+	EXPECT_DOUBLE_EQ(fut5.get(), 3);
+	EXPECT_EQ(wheel.size(), 0);
+
+	auto [fut6, buff6, id6] = timed.call<double>(rpc::with_deadline("add", 10s), 1, 2);
+	EXPECT_TRUE(timed.cancel(id6, std::runtime_error("cancelled")));
+	EXPECT_THROW(fut6.get(), std::runtime_error);
+	EXPECT_EQ(wheel.size(), 0);
+}
+
+TEST_F(RPCTest, ZeroCopyTest)
+{
+	server.bind("length", [](std::string_view str, rpc::BinRef bin, int n) -> size_t {
+		return str.size() + bin.size + n;
+	});
+
+	std::string text(4096, 't');
+	std::vector<char> data(8192, 'd');
+
+	/* the payloads are referred to, where they are */
+	auto [fut1, buff1, id1] = client.call<size_t>("length", std::string_view(text), rpc::BinRef(data), 1);
+	EXPECT_EQ(buff1.count(), 5);
+
+	std::vector<const char*> segments;
+	buff1.for_each([&](const char* ptr, size_t size) {
+		segments.push_back(ptr);
+	});
+	EXPECT_EQ(segments[1], text.data());
+	EXPECT_EQ(segments[3], data.data());
+
+	client.ingest_resp(server.handle_call(buff1.gather()));
+	EXPECT_EQ(fut1.get(), 4096UL + 8192UL + 1);
+
+	/* small ones are copied */
+	auto [fut2, buff2, id2] = client.call<size_t>("length", std::string_view("Hello"), rpc::BinRef("world", 5), 2);
+	EXPECT_EQ(buff2.count(), 1);
+
+	client.ingest_resp(server.handle_call(buff2.gather()));
+	EXPECT_EQ(fut2.get(), 12UL);
+
+	/* in a batch, as any argument */
+	auto batch = client.batch();
+	auto fut3 = batch.call<size_t>("length", std::string_view(text), rpc::BinRef(data), 3);
+	auto [buff3, ids3] = client.call_batch(std::move(batch));
+	client.ingest_resp(server.handle_call(buff3));
+	EXPECT_EQ(fut3.get(), 4096UL + 8192UL + 3);
+
+	server.unbind("length");
+}
+
+TEST_F(RPCTest, CacheTest)
+{
+	int called = 0;
+
+	const rpc::CachePolicy policy{2, 1024, 0ms};
+
+	server.bind("square", policy, [&called](int n) -> int {
+		++called;
+		return n * n;
+	});
+
+	/* the second call with the same arguments is answered from the cache */
+	for (int i = 0; i < 2; ++i) {
+		auto [fut, buff, id] = client.call<int>("square", 3);
+		client.ingest_resp(server.handle_call(buff));
+		EXPECT_EQ(fut.get(), 9);
+	}
+	EXPECT_EQ(called, 1);
+
+	/* by hash too, in a batch: only the callIDs differ */
+	auto batch = client.batch();
+	auto fut1 = batch.call<int>(rpc::FuncHash("square"), 3);
+	auto fut2 = batch.call<int>(rpc::FuncHash("square"), 4);
+	auto [buff1, ids1] = client.call_batch(std::move(batch));
+	client.ingest_resp(server.handle_call(buff1));
+	EXPECT_EQ(fut1.get(), 9);
+	EXPECT_EQ(fut2.get(), 16);
+	EXPECT_EQ(called, 2);
+
+	auto stats = server.cache_stats();
+	ASSERT_EQ(stats.count("square"), 1);
+	EXPECT_EQ(stats["square"].hits, 2);
+	EXPECT_EQ(stats["square"].misses, 2);
+	EXPECT_EQ(stats.count("add"), 0);
+
+	/* past the limit, the least recently used go */
+	for (int n = 0; n < 32; ++n) {
+		auto [fut, buff, id] = client.call<int>("square", 100 + n);
+		client.ingest_resp(server.handle_call(buff));
+		EXPECT_EQ(fut.get(), (100 + n) * (100 + n));
+	}
+
+	stats = server.cache_stats();
+	EXPECT_LE(stats["square"].entries, policy.maxEntries);
+	EXPECT_LE(stats["square"].bytes, policy.maxBytes);
+	EXPECT_GT(stats["square"].evictions, 0);
+
+	/* the limits are of the whole cache, not of each shard */
+	server.bind("pad", rpc::CachePolicy{16, 1024, 0ms}, [](int n) -> std::string {
+		return std::string(n, 'p');
+	});
+
+	for (int i = 0; i < 2; ++i) {
+		auto [fut, buff, id] = client.call<std::string>("pad", 600);
+		client.ingest_resp(server.handle_call(buff));
+		EXPECT_EQ(fut.get().size(), 600UL);
+	}
+
+	stats = server.cache_stats();
+	EXPECT_EQ(stats["pad"].hits, 1);
+
+	for (int n = 1; n <= 2; ++n) {
+		auto [fut, buff, id] = client.call<std::string>("pad", 600 + n);
+		client.ingest_resp(server.handle_call(buff));
+		EXPECT_EQ(fut.get().size(), 600UL + n);
+	}
+
+	stats = server.cache_stats();
+	EXPECT_EQ(stats["pad"].entries, 1);
+	EXPECT_LE(stats["pad"].bytes, 1024UL);
+
+	/* until they expire */
+	server.bind("cube", rpc::CachePolicy{16, 1024, 20ms}, [&called](int n) -> int {
+		++called;
+		return n * n * n;
+	});
+
+	called = 0;
+
+	for (int i = 0; i < 3; ++i) {
+		auto [fut, buff, id] = client.call<int>("cube", 2);
+		client.ingest_resp(server.handle_call(buff));
+		EXPECT_EQ(fut.get(), 8);
+
+		if (i == 1)
+			std::this_thread::sleep_for(50ms);
+	}
+	EXPECT_EQ(called, 2);
+	EXPECT_EQ(server.cache_stats()["cube"].evictions, 1);
+
+	server.unbind("square");
+	server.unbind("pad");
+	server.unbind("cube");
+}
+
+TEST_F(RPCTest, SingleFlightTest)
+{
+	/* identical calls in flight: only the first is made */
+	auto [fut1, buff1, id1] = client.call<double>(rpc::single_flight("add"), 1, 2);
+	auto [fut2, buff2, id2] = client.call<double>(rpc::single_flight(rpc::FuncHash("add")), 1, 2);
+	auto [fut3, buff3, id3] = client.call<double>(rpc::single_flight("add"), 2, 2);
+
+	EXPECT_GT(buff1.size(), 0);
+	EXPECT_EQ(buff2.size(), 0);
+	EXPECT_EQ(id2, id1);
+	EXPECT_GT(buff3.size(), 0);
+	EXPECT_NE(id3, id1);
+
+	double sum = 0;
+	auto [buff4, id4] = client.call<double>([&sum](std::exception_ptr exp, double value) {
+		sum = value;
+	}, rpc::single_flight("add"), 1, 2);
+	EXPECT_EQ(buff4.size(), 0);
+
+	/* the one response completes them all */
+	client.ingest_resp(server.handle_call(buff1));
+	EXPECT_DOUBLE_EQ(fut1.get(), 3);
+	EXPECT_DOUBLE_EQ(fut2.get(), 3);
+	EXPECT_DOUBLE_EQ(sum, 3);
+
+	client.ingest_resp(server.handle_call(buff3));
+	EXPECT_DOUBLE_EQ(fut3.get(), 4);
+
+	/* once it is done, the next one is made */
+	auto [fut5, buff5, id5] = client.call<double>(rpc::single_flight("add"), 1, 2);
+	EXPECT_GT(buff5.size(), 0);
+
+	/* and fails them all */
+	auto [fut6, buff6, id6] = client.call<double>(rpc::single_flight("add"), 1, 2);
+	EXPECT_EQ(buff6.size(), 0);
+
+	client.cancel(id6, std::runtime_error("cancelled"));
+	EXPECT_THROW(fut5.get(), std::runtime_error);
+	EXPECT_THROW(fut6.get(), std::runtime_error);
+
+#ifndef RPC_NO_METRICS
+	/* made, not joined */
+	EXPECT_EQ(client.stats()["add"].calls, 3);
+#endif
+}
+
+TEST_F(RPCTest, StubTest)
+{
+	const rpc::Stub<double(double, double)> sub("sub");
+	const rpc::Stub<double(double, double)> add(rpc::FuncHash("add"));
+	const rpc::Stub<size_t(std::string_view, int)> length("length");
+
+	server.bind("length", [](std::string_view str, int n) -> size_t {
+		return str.size() + n;
+	});
+
+	/* the same call as by name, but for the callID: the ints are packed as the doubles of the signature */
+	auto [fut1, buff1, id1] = sub(client, 5, 3);
+	auto [fut2, buff2, id2] = client.call<double>("sub", 5.0, 3.0);
+	ASSERT_EQ(buff1.size(), buff2.size());
+	EXPECT_EQ(std::memcmp(buff1.data() + 6, buff2.data() + 6, buff1.size() - 6), 0);
+
+	client.ingest_resp(server.handle_call(buff1));
+	client.ingest_resp(server.handle_call(buff2));
+	EXPECT_DOUBLE_EQ(fut1.get(), 2);
+	EXPECT_DOUBLE_EQ(fut2.get(), 2);
+
+	/* by hash */
+	auto [fut3, buff3, id3] = add(client, 1.5, 2);
+	client.ingest_resp(server.handle_call(buff3));
+	EXPECT_DOUBLE_EQ(fut3.get(), 3.5);
+
+	/* anything that converts to a number is packed as that number */
+	struct Meters {
+		double value;
+
+		operator double() const
+		{
+			return value;
+		}
+	};
+
+	auto [fut6, buff6, id6] = client.call<double>(sub, Meters{7.5}, 3);
+	ASSERT_EQ(buff6.size(), buff2.size());
+	client.ingest_resp(server.handle_call(buff6));
+	EXPECT_DOUBLE_EQ(fut6.get(), 4.5);
+
+	/* not of a fixed size, with a view argument */
+	std::string text(4096, 't');
+
+	auto [fut4, buff4, id4] = length(client, text, 1);
+	EXPECT_EQ(buff4.count(), 3);
+	client.ingest_resp(server.handle_call(buff4.gather()));
+	EXPECT_EQ(fut4.get(), 4097UL);
+
+	/* in a batch, as its name */
+	auto batch = client.batch();
+	auto fut5 = batch.call<double>(sub, 10, 4);
+	auto [buff5, ids5] = client.call_batch(std::move(batch));
+	client.ingest_resp(server.handle_call(buff5));
+	EXPECT_DOUBLE_EQ(fut5.get(), 6);
+
+#ifndef RPC_NO_METRICS
+	EXPECT_EQ(client.stats()["sub"].calls, 4);
+#endif
+
+	server.unbind("length");
+}
+
+TEST_F(RPCTest, FramingTest)
+{
+	/* room for a 4-byte header in front of each frame, as `tcp::framing` */
+	const rpc::Framing framing{4};
+	rpc::Client framed(rpc::CallTable::default_capacity, rpc::TimerWheel::shared(), framing);
+	rpc::Server peer(framing);
+	int called = 0;
+
+	peer.bind("add", add);
+
+	peer.bind("count", [](rpc::Writer<int>& out, int n) {
+		for (int i = 0; i < n; ++i)
+			out.write(i);
+	});
+
+	peer.bind("square", rpc::CachePolicy{}, [&called](int n) -> int {
+		++called;
+		return n * n;
+	});
+
+	/* the frames are handed over past the header, and come back behind one */
+	auto handle = [&](const msgpack::sbuffer& req) {
+		EXPECT_EQ(std::memcmp(req.data(), "\0\0\0\0", 4), 0);
+
+		auto resp = peer.handle_call(req.data() + 4, req.size() - 4);
+		EXPECT_GT(resp.size(), 4UL);
+
+		framed.ingest_resp(resp.data() + 4, resp.size() - 4);
+	};
+
+	auto [fut1, buff1, id1] = framed.call<double>("add", 1, 2);
+	auto [fut2, buff2, id2] = client.call<double>("add", 1, 2);
+	ASSERT_EQ(buff1.size(), buff2.size() + 4);
+	EXPECT_EQ(std::memcmp(buff1.data() + 4 + 6, buff2.data() + 6, buff2.size() - 6), 0);
+
+	handle(buff1);
+	EXPECT_DOUBLE_EQ(fut1.get(), 3);
+	client.cancel(id2, rpc::ClientError("unused"));
+
+	/* a batch, its header behind the room */
+	auto batch = framed.batch();
+	auto fut3 = batch.call<double>("add", 3, 4);
+	auto fut4 = batch.call<int>("square", 5);
+	auto [buff3, ids3] = framed.call_batch(std::move(batch));
+
+	handle(buff3);
+	EXPECT_DOUBLE_EQ(fut3.get(), 7);
+	EXPECT_EQ(fut4.get(), 25);
+
+	/* a cached response, too */
+	auto [fut5, buff5, id5] = framed.call<int>("square", 5);
+	handle(buff5);
+	EXPECT_EQ(fut5.get(), 25);
+	EXPECT_EQ(called, 1);
+
+	/* the chunks of a stream */
+	std::vector<int> chunks;
+	bool done = false;
+
+	auto [buff6, id6] = framed.stream_call<int>([&](int chunk) {
+		chunks.push_back(chunk);
+	}, [&](std::exception_ptr) {
+		done = true;
+	}, "count", 3);
+
+	peer.handle_call(buff6.data() + 4, buff6.size() - 4, [&](msgpack::sbuffer&& resp) {
+		framed.ingest_resp(resp.data() + 4, resp.size() - 4);
+	});
+
+	EXPECT_EQ(chunks, std::vector<int>({0, 1, 2}));
+	EXPECT_TRUE(done);
+
+	/* one with a view argument goes in segments, not framed */
+	std::string text(4096, 't');
+	auto [fut7, buff7, id7] = framed.call<size_t>("length", std::string_view(text));
+	EXPECT_EQ(static_cast<uint8_t>(buff7.gather().data()[0]), 0x93);	/* [callID, funcID, text] */
+	EXPECT_TRUE(framed.cancel(id7, rpc::ClientError("unused")));
+}
+
+TEST_F(RPCTest, NullClientFramingTest)
+{
+	/* a server framed for a transport, as `TcpServer` is, called in place */
+	rpc::Server peer(rpc::Framing{4});
+	rpc::NullClient null(peer);
+
+	peer.bind("add", add);
+
+	peer.bind("count", [](rpc::Writer<int>& out, int n) {
+		for (int i = 0; i < n; ++i)
+			out.write(i);
+	});
+
+	EXPECT_DOUBLE_EQ(null.call<double>("add", 1, 2), 3);
+
+	auto batch = null.batch();
+	auto fut1 = batch.call<double>("add", 3, 4);
+	auto fut2 = batch.call<double>("add", 5, 6);
+	null.call_batch(std::move(batch));
+	EXPECT_DOUBLE_EQ(fut1.get(), 7);
+	EXPECT_DOUBLE_EQ(fut2.get(), 11);
+
+	std::vector<int> chunks;
+	bool failed = true;
+
+	null.stream_call<int>([&](int chunk) {
+		chunks.push_back(chunk);
+	}, [&](std::exception_ptr exp) {
+		failed = (exp != nullptr);
+	}, "count", 3);
+
+	EXPECT_EQ(chunks, std::vector<int>({0, 1, 2}));
+	EXPECT_FALSE(failed);
+}